@@ -138,8 +138,8 @@ glm::mat4 Camera::getViewMatrix()
 glm::vec2 Camera::sampleSquareStratified(const int i, const int j, const int spp) const
 {
     float invSqrtSpp = 1.0f / std::sqrt(static_cast<float>(spp));
-    float randX = static_cast<float>(RaytracingUtility::randomDouble());
-    float randY = static_cast<float>(RaytracingUtility::randomDouble());
+    float randX = RaytracingUtility::randomFloat();
+    float randY = RaytracingUtility::randomFloat();
 
     auto px = ((i + randX) * invSqrtSpp) - 0.5f;
     auto py = ((j + randY) * invSqrtSpp) - 0.5f;
@@ -2,20 +2,268 @@
 #include "HittablePdf.h"
 #include "CosinePdf.h"
 #include "MixturePdf.h"
+#include "LightPdf.h"
 #include "Sphere.h"
 #include "Box.h"
 #include "Quad.h"
 #include "QuadLight.h"
+#include "ThreadPool.h"
+#include "ImageWriter.h"
+#include "Denoiser.h"
+#include "Checkpoint.h"
+#include "AccumulationFile.h"
 
 #include <glm/ext/matrix_clip_space.hpp> // glm::perspective
 
-#include <thread>
-#include <functional> // std::bind
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <iomanip>
+#include <numeric> // std::iota
+#include <utility> // std::move
 
 namespace raytracer
 {
+namespace
+{
+/// Width and height in pixels of the tiles the recursive integrator hands out to threads
+const int RENDER_TILE_SIZE = 16;
+/// Width and height in pixels of the tiles whose primary rays are traced as one packet
+const int PACKET_TILE_SIZE = 4;
+static_assert(PACKET_TILE_SIZE * PACKET_TILE_SIZE <= RayPacket::MAX_SIZE, "Packet tiles must fit in a RayPacket");
+static_assert(RENDER_TILE_SIZE % PACKET_TILE_SIZE == 0, "Render tiles must split into whole packet tiles");
+/// Maximum number of paths the wavefront integrator keeps in flight
+const int WAVEFRONT_MAX_PATHS = 1 << 18;
+/// Factor by which adaptive sampling may exceed the average number of samples in a pixel
+const int ADAPTIVE_MAX_SAMPLES_FACTOR = 8;
+/// Fewest samples an adaptive pass takes per pixel, fewer give unreliable variance estimates
+const int ADAPTIVE_MIN_PASS_SAMPLES = 8;
+/// Number of passes the average sample count of adaptive sampling is split into
+const int ADAPTIVE_PASSES_PER_BUDGET = 8;
+/// Width and height in pixels of the tiles adaptive sampling decides to stop together
+const int ADAPTIVE_TILE_SIZE = 8;
+/// Samples per pixel of a pass of progressive rendering, checkpoints and previews fall between passes
+const int PROGRESSIVE_PASS_SAMPLES = 1;
+/// Distance in scene units between the shading point and the start of its shadow rays, so they
+/// do not hit the surface they leave
+const float SHADOW_RAY_ORIGIN_OFFSET = 1e-3f;
+/// Fraction of the distance to a light by which shadow rays stop short of it, and light pdf
+/// lookups reach past it, so the light's own surface is never mistaken for an occluder
+const float LIGHT_DISTANCE_TOLERANCE = 1e-3f;
+/// Names of the AOVs in the order of PerspectiveCamera::AOV
+const char *const AOV_NAMES[PerspectiveCamera::AOV_COUNT] = {"albedo", "normal", "depth", "objectId", "direct", "indirect"};
+/// Offset basis of the 64-bit FNV-1a hash of the metadata of accumulation files
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+/// Prime of the 64-bit FNV-1a hash
+const uint64_t FNV_PRIME = 1099511628211ull;
+
+/// @struct BounceSamples
+/// @brief Sample values a path consumes at one bounce. They are drawn in a fixed order
+///        whether they are used or not, so every bounce takes the same sampler dimensions in
+///        every path.
+struct BounceSamples
+{
+    float light;            ///< chooses the light for next-event estimation
+    glm::vec2 lightPoint;   ///< chooses the point on that light
+    float scatter;          ///< chooses between discrete scattering events or PDF components
+    glm::vec2 direction;    ///< chooses the scattered direction
+    float roulette;         ///< decides Russian roulette
+};
+
+//----------------------------------------------------------------------------------
+BounceSamples drawBounceSamples(Sampler &sampler)
+{
+    BounceSamples samples;
+    samples.light = sampler.get1D();
+    samples.lightPoint = sampler.get2D();
+    samples.scatter = sampler.get1D();
+    samples.direction = sampler.get2D();
+    samples.roulette = sampler.get1D();
+    return samples;
+}
+
+/// @struct WavefrontPaths
+/// @brief Structure-of-arrays state of the paths in flight in the wavefront integrator
+struct WavefrontPaths
+{
+    void resize(const size_t size)
+    {
+        origin.resize(size);
+        direction.resize(size);
+        throughput.resize(size);
+        radiance.resize(size);
+        pixel.resize(size);
+        record.resize(size);
+        scatterPdf.resize(size);
+        shadowRay.resize(size);
+        shadowContribution.resize(size);
+        sampleIndex.resize(size);
+        dimension.resize(size);
+    }
+
+    void resizeAOVs(const size_t size)
+    {
+        aov.resize(size);
+        directComplete.resize(size);
+    }
+
+    std::vector<glm::vec3> origin;
+    std::vector<glm::vec3> direction;
+    std::vector<Color3f> throughput;   ///< product of the path's scattering weights so far
+    std::vector<Color3f> radiance;     ///< radiance gathered along the path so far
+    std::vector<int> pixel;
+    std::vector<HitRecord> record;     ///< closest hit of the current segment
+    std::vector<float> scatterPdf;     ///< density the current direction was sampled with
+    std::vector<Ray> shadowRay;        ///< next-event estimation ray of the current hit
+    std::vector<Color3f> shadowContribution; ///< light added if the shadow ray is unoccluded
+    std::vector<int> sampleIndex;      ///< index of the path's sample within its pixel
+    std::vector<int> dimension;        ///< next sampler dimension the path draws
+    std::vector<AOVSample> aov;        ///< auxiliary values, only if the film has AOVs
+    std::vector<uint8_t> directComplete; ///< whether aov.direct holds all direct light of the path
+};
+
+//----------------------------------------------------------------------------------
+// Replace nan components with zero
+Color3f replaceNaN(Color3f color)
+{
+    if(std::isnan(color.r)) color.r = 0.0f;
+    if(std::isnan(color.g)) color.g = 0.0f;
+    if(std::isnan(color.b)) color.b = 0.0f;
+    return color;
+}
+
+//----------------------------------------------------------------------------------
+// Get the file an AOV is written to when it is not a layer of the output file,
+// e.g. image.albedo.png for image.png
+std::string aovFilename(const std::string &outputFile, const char *aovName)
+{
+    const size_t dot = outputFile.find_last_of('.');
+    return outputFile.substr(0, dot) + '.' + aovName + outputFile.substr(dot);
+}
+
+//----------------------------------------------------------------------------------
+// Map an AOV into [0,1] for 8-bit formats: normals are offset, depths scaled to the
+// largest finite depth and object ids given distinct colors
+Image displayAOV(const Image &image, const PerspectiveCamera::AOV aov, const float farDepth)
+{
+    Image display(image.getWidth(), image.getHeight());
+    float maxDepth = 0.0f;
+    for(int pixel = 0; pixel < image.getPixelCount(); ++pixel)
+    {
+        const float depth = image.getPixel(pixel).r;
+        if(depth < farDepth)
+        {
+            maxDepth = std::max(maxDepth, depth);
+        }
+    }
+
+    for(int pixel = 0; pixel < image.getPixelCount(); ++pixel)
+    {
+        const Color3f value = image.getPixel(pixel);
+        Color3f mapped = value;
+        if(aov == PerspectiveCamera::AOV::Normal)
+        {
+            mapped = value * 0.5f + 0.5f;
+        }
+        else if(aov == PerspectiveCamera::AOV::Depth)
+        {
+            mapped = Color3f(maxDepth > 0.0f ? std::min(1.0f, value.r / maxDepth) : 1.0f);
+        }
+        else if(aov == PerspectiveCamera::AOV::ObjectId && value.r >= 0.0f)
+        {
+            const uint64_t hash = Pcg32::mixBits(static_cast<uint64_t>(value.r) + 1);
+            mapped = Color3f(static_cast<float>(hash & 0xff), static_cast<float>((hash >> 8) & 0xff),
+                             static_cast<float>((hash >> 16) & 0xff)) / 255.0f;
+        }
+        else if(aov == PerspectiveCamera::AOV::ObjectId)
+        {
+            mapped = Color3f(0.0f);
+        }
+        display.setPixel(pixel, mapped);
+    }
+    return display;
+}
+
+//----------------------------------------------------------------------------------
+// Power heuristic with exponent 2 for combining two sampling strategies
+float powerHeuristic(const float pdf, const float otherPdf)
+{
+    const float pdf2 = pdf * pdf;
+    const float otherPdf2 = otherPdf * otherPdf;
+    return pdf2 + otherPdf2 > 0.0f ? pdf2 / (pdf2 + otherPdf2) : 0.0f;
+}
+
+//----------------------------------------------------------------------------------
+// Order the tiles of a tilesX x tilesY grid along a Hilbert curve. Consecutive tiles are
+// always neighbours, so threads working on tiles taken at about the same time touch nearby
+// parts of the scene.
+std::vector<glm::ivec2> hilbertTileOrder(const int tilesX, const int tilesY)
+{
+    int size = 1;
+    while(size < tilesX || size < tilesY)
+    {
+        size *= 2;
+    }
+
+    // Walk the curve over the enclosing power of two grid and keep the tiles inside the image
+    std::vector<glm::ivec2> tiles;
+    tiles.reserve(tilesX * tilesY);
+    for(long long d = 0; d < static_cast<long long>(size) * size; ++d)
+    {
+        int x = 0;
+        int y = 0;
+        long long t = d;
+        for(int s = 1; s < size; s *= 2)
+        {
+            const int rx = static_cast<int>((t / 2) & 1);
+            const int ry = static_cast<int>((t ^ rx) & 1);
+            if(ry == 0)
+            {
+                if(rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
+            t /= 4;
+        }
+
+        if(x < tilesX && y < tilesY)
+        {
+            tiles.emplace_back(x, y);
+        }
+    }
+    return tiles;
+}
+
+//----------------------------------------------------------------------------------
+// Join the per-chunk queues in chunk order.
+void concatenateQueues(const std::vector<std::vector<int>> &chunkQueues, const int chunks, std::vector<int> &queue)
+{
+    queue.clear();
+    for(int c = 0; c < chunks; ++c)
+    {
+        queue.insert(queue.end(), chunkQueues[c].begin(), chunkQueues[c].end());
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Add the bytes of a value to a 64-bit FNV-1a hash
+template<typename T>
+void hashValue(uint64_t &hash, const T &value)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&value);
+    for(size_t i = 0; i < sizeof(T); ++i)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+}
+} // namespace
+
 //----------------------------------------------------------------------------------
 PerspectiveCamera::PerspectiveCamera()
     : PerspectiveCamera(800, 600, 10)
@@ -32,6 +280,17 @@ PerspectiveCamera::PerspectiveCamera(int width,
     m_width(width),
     m_height(height),
     m_maxDepth(maxDepth),
+    m_integrator(Integrator::Recursive),
+    m_lightSampling(LightSampling::Mixture),
+    m_rouletteDepth(DEFAULT_ROULETTE_DEPTH),
+    m_frameIndex(0),
+    m_samplerType(Sampler::Type::Sobol),
+    m_adaptiveThreshold(0.0f),
+    m_timeBudget(0.0f),
+    m_aovsEnabled(false),
+    m_denoiseEnabled(false),
+    m_checkpointInterval(static_cast<float>(DEFAULT_CHECKPOINT_INTERVAL)),
+    m_previewInterval(static_cast<float>(DEFAULT_PREVIEW_INTERVAL)),
     m_zoomFactor(1.0),
     m_fovy(fovy),
     m_near(near),
@@ -60,69 +319,710 @@ void PerspectiveCamera::reset()
 //----------------------------------------------------------------------------------
 void PerspectiveCamera::render(const BVH &world, const int samplesPerPixel, std::ostream &out)
 {
-    std::unique_ptr<uint8_t[]> image(new uint8_t[m_width * m_height * 3]);
+    const int sampleCount = std::max(1, samplesPerPixel);
+    // The denoiser is guided by the albedo and normal AOVs
+    m_film = Film(m_width, m_height, m_aovsEnabled || m_denoiseEnabled);
+
+    uint32_t seed = static_cast<uint32_t>(m_frameIndex);
+    if(m_adaptiveThreshold > 0.0f)
+    {
+        this->renderAdaptive(world, sampleCount);
+    }
+    else if(!m_checkpointFile.empty() || !m_previewFile.empty())
+    {
+        seed = this->renderProgressive(world, sampleCount);
+    }
+    else
+    {
+        std::vector<int> pixels(m_film.getPixelCount());
+        std::iota(pixels.begin(), pixels.end(), 0);
+        const std::unique_ptr<Sampler> sampler = Sampler::create(m_samplerType, sampleCount, m_frameIndex);
+        this->renderPass(world, *sampler, pixels, 0, sampleCount);
+    }
+
+    if(!m_accumulationFile.empty())
+    {
+        AccumulationFile::write(m_accumulationFile, m_film, this->computeMetadataHash(world), seed);
+        std::clog << "\nWrote accumulation file " << m_accumulationFile;
+    }
+
+    this->resolveFilm();
+    if(m_denoiseEnabled)
+    {
+        this->denoiseImage();
+    }
+    this->writeOutput(out);
+
+    if(!m_sampleCountMapFile.empty())
+    {
+        this->writeSampleCountMap(m_sampleCountMapFile);
+    }
+    std::clog << "\nDone.\n";
+}
+
+//----------------------------------------------------------------------------------
+uint64_t PerspectiveCamera::computeMetadataHash(const BVH &world) const
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hashValue(hash, m_width);
+    hashValue(hash, m_height);
+    hashValue(hash, m_maxDepth);
+    hashValue(hash, m_fovy);
+    hashValue(hash, m_near);
+    hashValue(hash, m_far);
+    hashValue(hash, m_zoomFactor);
+    hashValue(hash, this->getPosition());
+    hashValue(hash, this->getFocalPoint());
+    hashValue(hash, this->getViewUp());
+    hashValue(hash, this->getApertureRadius());
+    hashValue(hash, this->getBackgroundColor());
+    hashValue(hash, this->getCameraToWorldMatrix());
+
+    // The scene is identified by its extent and its numbers of objects and lights
+    const AxisAlignedBoundingBox bounds = world.getBounds();
+    hashValue(hash, bounds.pMin());
+    hashValue(hash, bounds.pMax());
+    hashValue(hash, world.getSceneObjects().size());
+    hashValue(hash, world.getLightSources().size());
+    return hash;
+}
+
+//----------------------------------------------------------------------------------
+void PerspectiveCamera::renderAdaptive(const BVH &world, const int samplesPerPixel)
+{
+    const int pixelCount = m_film.getPixelCount();
+    const int maxSamples = samplesPerPixel * ADAPTIVE_MAX_SAMPLES_FACTOR;
+    const int passSamples = std::min(samplesPerPixel, std::max(ADAPTIVE_MIN_PASS_SAMPLES, samplesPerPixel / ADAPTIVE_PASSES_PER_BUDGET));
+    const std::unique_ptr<Sampler> sampler = Sampler::create(m_samplerType, maxSamples, m_frameIndex);
+    const auto startTime = std::chrono::steady_clock::now();
+
+    // Every pass gives the same samples to all pixels still above the threshold, so the pixels
+    // of a pass always continue from the same sample index
+    std::vector<int> active(pixelCount);
+    std::iota(active.begin(), active.end(), 0);
+    long long remainingSamples = static_cast<long long>(pixelCount) * samplesPerPixel;
+    int firstSample = 0;
+
+    const int tilesX = (m_width + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+    const int tilesY = (m_height + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+    std::vector<float> tileError(tilesX * tilesY);
+    std::vector<int> tilePixelCount(tilesX * tilesY);
+    const auto tileIndex = [this, tilesX](const int pixel)
+    {
+        return (pixel / m_width / ADAPTIVE_TILE_SIZE) * tilesX + (pixel % m_width) / ADAPTIVE_TILE_SIZE;
+    };
+
+    for(int pass = 0; !active.empty(); ++pass)
+    {
+        const long long activeCount = static_cast<long long>(active.size());
+        const int samples = static_cast<int>(std::min<long long>(std::min(passSamples, maxSamples - firstSample),
+                                                                 remainingSamples / activeCount));
+        if(samples <= 0)
+        {
+            break;
+        }
+
+        std::clog << "Adaptive pass " << pass << ": samples " << firstSample << " to " << firstSample + samples
+                  << " of " << activeCount << " pixels\n";
+        this->renderPass(world, *sampler, active, firstSample, firstSample + samples);
+        firstSample += samples;
+        remainingSamples -= activeCount * samples;
+
+        // Tiles stop as a whole once the average error of their pixels is below the threshold.
+        // Deciding per pixel would stop the pixels whose samples happen to have missed rare
+        // bright paths, which darkens the image.
+        std::fill(tileError.begin(), tileError.end(), 0.0f);
+        std::fill(tilePixelCount.begin(), tilePixelCount.end(), 0);
+        for(const int pixel : active)
+        {
+            tileError[tileIndex(pixel)] += m_film.getDisplayError(pixel);
+            ++tilePixelCount[tileIndex(pixel)];
+        }
+        active.erase(std::remove_if(active.begin(), active.end(), [&](const int pixel)
+        {
+            const int tile = tileIndex(pixel);
+            return !(tileError[tile] > m_adaptiveThreshold * tilePixelCount[tile]);
+        }), active.end());
+        std::clog << '\n';
 
-    const int sqrtspp = static_cast<int>(std::sqrt(samplesPerPixel));
-    const float pixelSamplesScale = 1.0f / (sqrtspp * sqrtspp);
+        const std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - startTime;
+        if(m_timeBudget > 0.0f && elapsed.count() >= m_timeBudget)
+        {
+            std::clog << "Time budget of " << m_timeBudget << " s reached\n";
+            break;
+        }
+    }
+
+    const long long totalSamples = static_cast<long long>(pixelCount) * samplesPerPixel - remainingSamples;
+    std::clog << "Adaptive sampling took " << static_cast<double>(totalSamples) / pixelCount
+              << " samples per pixel on average, " << active.size() << " pixels remain above the threshold\n";
+}
+
+//----------------------------------------------------------------------------------
+uint32_t PerspectiveCamera::renderProgressive(const BVH &world, const int samplesPerPixel)
+{
+    Checkpoint checkpoint{m_samplerType, static_cast<uint32_t>(m_frameIndex), samplesPerPixel, 0};
+    if(!m_checkpointFile.empty() && Checkpoint::exists(m_checkpointFile))
+    {
+        Film film;
+        checkpoint = Checkpoint::read(m_checkpointFile, film);
+        if(film.getWidth() != m_width || film.getHeight() != m_height)
+        {
+            throw std::runtime_error("Checkpoint " + m_checkpointFile + " has a different image size");
+        }
+        if(m_film.hasAOVs() && !film.hasAOVs())
+        {
+            throw std::runtime_error("Checkpoint " + m_checkpointFile + " was rendered without AOVs");
+        }
+        m_film = std::move(film);
+        std::clog << "Resuming from " << m_checkpointFile << " with " << checkpoint.nextSample << " samples per pixel\n";
+    }
 
-    auto numThreads = std::thread::hardware_concurrency() * 4;
-    numThreads = numThreads > m_height ? m_height : numThreads;
-    std::clog << "Using " << numThreads << " threads\n";
-    std::vector<std::thread> threads(numThreads);
+    // The sampler is created as at the start of the render, so a resumed render continues
+    // the same sample sequences
+    const std::unique_ptr<Sampler> sampler = Sampler::create(checkpoint.samplerType, checkpoint.samplerSampleCount, checkpoint.seed);
+    std::vector<int> pixels(m_film.getPixelCount());
+    std::iota(pixels.begin(), pixels.end(), 0);
 
-    for(int t=0; t<numThreads; t++)
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    auto lastPreview = lastCheckpoint;
+    for(int firstSample = checkpoint.nextSample; firstSample < samplesPerPixel;)
     {
-        // std::bind is used to pass the parameters to the lambda function
-        threads[t] = std::thread(std::bind([&](int start, int end, int t)
+        const int endSample = std::min(samplesPerPixel, firstSample + PROGRESSIVE_PASS_SAMPLES);
+        std::clog << "Progressive pass: samples " << firstSample << " to " << endSample << " of " << samplesPerPixel << '\n';
+        this->renderPass(world, *sampler, pixels, firstSample, endSample);
+        std::clog << '\n';
+        firstSample = endSample;
+
+        const auto now = std::chrono::steady_clock::now();
+        const bool done = firstSample == samplesPerPixel;
+        if(!m_checkpointFile.empty()
+           && (done || std::chrono::duration<float>(now - lastCheckpoint).count() >= m_checkpointInterval))
+        {
+            checkpoint.nextSample = firstSample;
+            checkpoint.write(m_checkpointFile, m_film);
+            lastCheckpoint = now;
+            std::clog << "Saved checkpoint with " << firstSample << " samples per pixel to " << m_checkpointFile << '\n';
+        }
+        if(!m_previewFile.empty() && !done
+           && std::chrono::duration<float>(now - lastPreview).count() >= m_previewInterval)
         {
-            for(int j=start; j < end; ++j)
+            this->resolveFilm();
+            ImageWriter::write(m_image, m_previewFile);
+            lastPreview = now;
+            std::clog << "Wrote preview with " << firstSample << " samples per pixel to " << m_previewFile << '\n';
+        }
+    }
+    return checkpoint.seed;
+}
+
+//----------------------------------------------------------------------------------
+void PerspectiveCamera::renderPass(const BVH &world,
+                                   const Sampler &sampler,
+                                   const std::vector<int> &pixels,
+                                   const int firstSample,
+                                   const int endSample)
+{
+    if(m_integrator == Integrator::Wavefront)
+    {
+        this->renderWavefront(world, sampler, pixels, firstSample, endSample);
+    }
+    else
+    {
+        this->renderRecursive(world, sampler, pixels, firstSample, endSample);
+    }
+}
+
+//----------------------------------------------------------------------------------
+void PerspectiveCamera::renderRecursive(const BVH &world,
+                                        const Sampler &sampler,
+                                        const std::vector<int> &pixels,
+                                        const int firstSample,
+                                        const int endSample)
+{
+    // Mark the pixels of the pass so the tiles can skip the others
+    std::vector<uint8_t> selected(m_width * m_height, 0);
+    for(const int pixel : pixels)
+    {
+        selected[pixel] = 1;
+    }
+
+    const int tilesX = (m_width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    const int tilesY = (m_height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    const std::vector<glm::ivec2> tiles = hilbertTileOrder(tilesX, tilesY);
+    const int tileCount = static_cast<int>(tiles.size());
+
+    ThreadPool &pool = ThreadPool::global();
+    const int numThreads = std::min(pool.getThreadCount(), tileCount);
+    std::clog << "Using " << numThreads << " threads for " << tileCount << " tiles\n";
+
+    // Threads take the next tile from a shared counter as soon as they are done with one, so
+    // none of them idles while tiles remain, however unevenly the cost is spread over the image
+    std::atomic<int> nextTile(0);
+    std::atomic<int> finishedTiles(0);
+
+    // Only the calling thread reports the progress, between its own tiles, so the workers
+    // never wait on each other for the log
+    const auto renderTiles = [&](const bool reportProgress)
+    {
+        std::unique_ptr<Sampler> threadSampler = sampler.clone();
+
+        for(int tile = nextTile++; tile < tileCount; tile = nextTile++)
+        {
+            const int x0 = tiles[tile].x * RENDER_TILE_SIZE;
+            const int y0 = tiles[tile].y * RENDER_TILE_SIZE;
+            const int x1 = std::min(x0 + RENDER_TILE_SIZE, m_width);
+            const int y1 = std::min(y0 + RENDER_TILE_SIZE, m_height);
+
+            // Primary rays are traced in packets of 4x4 pixels per sample
+            for(int j0 = y0; j0 < y1; j0 += PACKET_TILE_SIZE)
             {
-                if(t == static_cast<int>((numThreads / 2)))
+                for(int i0 = x0; i0 < x1; i0 += PACKET_TILE_SIZE)
                 {
-                    std::clog << "\rScanlines remaining: " << end - j << ' ' << std::flush;
+                    int packetPixels[RayPacket::MAX_SIZE];
+                    int packetPixelCount = 0;
+                    for(int j = j0; j < std::min(j0 + PACKET_TILE_SIZE, y1); ++j)
+                    {
+                        for(int i = i0; i < std::min(i0 + PACKET_TILE_SIZE, x1); ++i)
+                        {
+                            if(selected[j * m_width + i])
+                            {
+                                packetPixels[packetPixelCount++] = j * m_width + i;
+                            }
+                        }
+                    }
+
+                    if(packetPixelCount > 0)
+                    {
+                        this->renderPacket(world, *threadSampler, packetPixels, packetPixelCount, firstSample, endSample);
+                    }
                 }
+            }
 
-                for(int i=0; i < m_width; ++i)
+            const int finished = ++finishedTiles;
+            if(reportProgress)
+            {
+                std::clog << "\rTiles remaining: " << tileCount - finished << ' ' << std::flush;
+            }
+        }
+    };
+
+    ThreadPool::TaskGroup group(pool);
+    for(int t = 1; t < numThreads; ++t)
+    {
+        group.run([&renderTiles]() { renderTiles(false); });
+    }
+    renderTiles(true);
+    group.wait();
+    std::clog << "\rTiles remaining: 0 " << std::flush;
+}
+
+//----------------------------------------------------------------------------------
+void PerspectiveCamera::renderPacket(const BVH &world,
+                                     Sampler &sampler,
+                                     const int *pixels,
+                                     const int pixelCount,
+                                     const int firstSample,
+                                     const int endSample)
+{
+    const bool withAOVs = m_film.hasAOVs();
+    for(int sampleIndex = firstSample; sampleIndex < endSample; ++sampleIndex)
+    {
+        // The sampler is suspended after the camera dimensions of each ray and resumed when
+        // the ray's path is traced
+        RayPacket packet;
+        int dimensions[RayPacket::MAX_SIZE];
+        for(int k = 0; k < pixelCount; ++k)
+        {
+            const int pixel = pixels[k];
+            sampler.startPixelSample(pixel, sampleIndex);
+            const glm::vec2 pixelSample = sampler.getPixel2D();
+            const glm::vec2 lensSample = sampler.get2D();
+            const glm::vec2 pixelPosition(pixel % m_width + pixelSample.x, pixel / m_width + pixelSample.y);
+            packet.add(this->thinLensRay(pixelPosition, lensSample));
+            dimensions[k] = sampler.getDimension();
+        }
+
+        HitRecord records[RayPacket::MAX_SIZE];
+        bool hits[RayPacket::MAX_SIZE];
+        world.hit(packet, records, hits);
+
+        for(int k = 0; k < packet.size(); ++k)
+        {
+            Color3f radiance(0.0f);
+            AOVSample aov{Color3f(0.0f), glm::vec3(0.0f), m_far, -1, Color3f(0.0f)};
+            if(m_maxDepth > 0)
+            {
+                sampler.startPixelSample(pixels[k], sampleIndex, dimensions[k]);
+
+                // Restore the full interval the closest hit narrowed
+                Ray ray = packet.ray(k);
+                ray.setTMax(std::numeric_limits<float>::max());
+
+                if(hits[k])
+                {
+                    radiance = this->shadeHit(ray, records[k], world, sampler, withAOVs ? &aov : nullptr);
+                }
+                else
                 {
-                    Color3f pixelColor(0.0f);
+                    radiance = this->getBackgroundColor();
+                    aov.albedo = glm::clamp(radiance, 0.0f, 1.0f);
+                    aov.direct = radiance;
+                }
+            }
 
-                    for(int sj = 0; sj < sqrtspp; ++sj)
+            if(withAOVs)
+            {
+                m_film.addSample(pixels[k], radiance, aov);
+            }
+            else
+            {
+                m_film.addSample(pixels[k], radiance);
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------
+void PerspectiveCamera::renderWavefront(const BVH &world,
+                                        const Sampler &sampler,
+                                        const std::vector<int> &pixels,
+                                        const int firstSample,
+                                        const int endSample)
+{
+    const int pixelCount = static_cast<int>(pixels.size());
+    const long long totalSamples = static_cast<long long>(pixelCount) * (endSample - firstSample);
+
+    // A wave never holds two samples of the same pixel, so accumulation needs no locking
+    const int waveSize = std::min(WAVEFRONT_MAX_PATHS, pixelCount);
+    const int numThreads = ThreadPool::global().getThreadCount();
+    std::clog << "Using wavefront integrator with " << numThreads << " threads and "
+              << waveSize << " paths per wave\n";
+
+    WavefrontPaths paths;
+    paths.resize(waveSize);
+    const bool withAOVs = m_film.hasAOVs();
+    if(withAOVs)
+    {
+        paths.resizeAOVs(waveSize);
+    }
+
+    std::vector<int> active;
+    std::vector<int> hitQueue;
+    std::vector<int> missQueue;
+    std::vector<int> shadowQueue;
+    std::vector<std::vector<int>> chunkHits(numThreads);
+    std::vector<std::vector<int>> chunkMisses(numThreads);
+    std::vector<std::vector<int>> chunkContinued(numThreads);
+    std::vector<std::vector<int>> chunkShadows(numThreads);
+    std::vector<std::unique_ptr<Sampler>> chunkSamplers;
+    for(int c = 0; c < numThreads; ++c)
+    {
+        chunkSamplers.push_back(sampler.clone());
+    }
+    const bool nextEvent = m_lightSampling == LightSampling::NextEvent;
+
+    for(long long waveStart = 0; waveStart < totalSamples; waveStart += waveSize)
+    {
+        const int pathCount = static_cast<int>(std::min<long long>(waveSize, totalSamples - waveStart));
+        std::clog << "\rSamples remaining: " << totalSamples - waveStart << ' ' << std::flush;
+
+        // Generate: one camera ray per path, samples are laid out pixel by pixel per sample index
+        ThreadPool::global().parallelFor(pathCount, 1, [&](size_t begin, size_t end, int chunk)
+        {
+            Sampler &chunkSampler = *chunkSamplers[chunk];
+            for(size_t p = begin; p < end; ++p)
+            {
+                const long long sample = waveStart + static_cast<long long>(p);
+                const int pixel = pixels[sample % pixelCount];
+                const int sampleIndex = firstSample + static_cast<int>(sample / pixelCount);
+
+                chunkSampler.startPixelSample(pixel, sampleIndex);
+                const glm::vec2 pixelSample = chunkSampler.getPixel2D();
+                const glm::vec2 lensSample = chunkSampler.get2D();
+                const glm::vec2 pixelPosition(pixel % m_width + pixelSample.x, pixel / m_width + pixelSample.y);
+                const Ray ray = this->thinLensRay(pixelPosition, lensSample);
+
+                paths.origin[p] = ray.origin();
+                paths.direction[p] = ray.direction();
+                paths.throughput[p] = Color3f(1.0f);
+                paths.radiance[p] = Color3f(0.0f);
+                paths.pixel[p] = pixel;
+                paths.scatterPdf[p] = 0.0f;
+                paths.sampleIndex[p] = sampleIndex;
+                paths.dimension[p] = chunkSampler.getDimension();
+                if(withAOVs)
+                {
+                    paths.aov[p] = AOVSample{Color3f(0.0f), glm::vec3(0.0f), m_far, -1, Color3f(0.0f)};
+                    paths.directComplete[p] = 0;
+                }
+            }
+        });
+
+        active.resize(pathCount);
+        for(int p = 0; p < pathCount; ++p)
+        {
+            active[p] = p;
+        }
+
+        for(int bounce = 0; bounce < m_maxDepth && !active.empty(); ++bounce)
+        {
+            // Intersect: find the closest hit of every active path and sort it into a queue
+            const int chunks = ThreadPool::global().parallelFor(active.size(), 1, [&](size_t begin, size_t end, int chunk)
+            {
+                chunkHits[chunk].clear();
+                chunkMisses[chunk].clear();
+
+                for(size_t k = begin; k < end; ++k)
+                {
+                    const int p = active[k];
+                    paths.record[p] = HitRecord();
+                    const bool hit = world.hit(Ray(paths.origin[p], paths.direction[p]), paths.record[p]);
+                    (hit ? chunkHits[chunk] : chunkMisses[chunk]).push_back(p);
+                }
+            });
+            concatenateQueues(chunkHits, chunks, hitQueue);
+            concatenateQueues(chunkMisses, chunks, missQueue);
+
+            // Miss: paths leaving the scene pick up the background and end
+            ThreadPool::global().parallelFor(missQueue.size(), 1, [&](size_t begin, size_t end, int)
+            {
+                for(size_t k = begin; k < end; ++k)
+                {
+                    const int p = missQueue[k];
+                    paths.radiance[p] += paths.throughput[p] * this->getBackgroundColor();
+                    if(withAOVs && bounce == 0)
+                    {
+                        paths.aov[p].albedo = glm::clamp(this->getBackgroundColor(), 0.0f, 1.0f);
+                    }
+                }
+            });
+
+            // Shade: paths are grouped by material so each material's code and data stay hot
+            std::sort(hitQueue.begin(), hitQueue.end(), [&paths](const int a, const int b)
+            {
+                const Material *materialA = paths.record[a].material;
+                const Material *materialB = paths.record[b].material;
+                return materialA < materialB || (materialA == materialB && a < b);
+            });
+
+            const int shadeChunks = ThreadPool::global().parallelFor(hitQueue.size(), 1, [&](size_t begin, size_t end, int chunk)
+            {
+                chunkContinued[chunk].clear();
+                chunkShadows[chunk].clear();
+                Sampler &chunkSampler = *chunkSamplers[chunk];
+
+                for(size_t k = begin; k < end; ++k)
+                {
+                    const int p = hitQueue[k];
+                    const HitRecord &record = paths.record[p];
+                    Ray ray(paths.origin[p], paths.direction[p]);
+
+                    chunkSampler.startPixelSample(paths.pixel[p], paths.sampleIndex[p], paths.dimension[p]);
+                    const BounceSamples samples = drawBounceSamples(chunkSampler);
+                    paths.dimension[p] = chunkSampler.getDimension();
+
+                    Color3f emitted = record.material->emitted(record);
+                    if(nextEvent && emitted != Color3f(0.0f))
+                    {
+                        emitted *= this->emissionWeight(ray, record, paths.scatterPdf[p], world);
+                    }
+                    paths.radiance[p] += paths.throughput[p] * emitted;
+
+                    ScatterRecord scatterRecord;
+                    const bool scatters = record.material->scatter(ray, record, scatterRecord, samples.scatter, samples.direction);
+                    if(withAOVs)
                     {
-                        for(int si = 0; si < sqrtspp; ++si)
+                        this->recordAOV(bounce, record, scatters, scatterRecord, emitted, paths.radiance[p],
+                                        paths.aov[p], paths.directComplete[p]);
+                    }
+                    if(!scatters)
+                    {
+                        continue;
+                    }
+
+                    Ray scattered;
+                    if(scatterRecord.skipPdf)
+                    {
+                        paths.throughput[p] *= scatterRecord.attenuation;
+                        paths.scatterPdf[p] = 0.0f;
+                        scattered = scatterRecord.skipPdfRay;
+                    }
+                    else
+                    {
+                        Color3f contribution;
+                        if(nextEvent && this->sampleLight(ray, record, scatterRecord, world, samples.light, samples.lightPoint,
+                                                          paths.shadowRay[p], contribution))
                         {
-                            // auto pixel = glm::vec2(i + RaytracingUtility::randomDouble() - 0.5f, j + RaytracingUtility::randomDouble() - 0.5f);
-                            auto offset = this->sampleSquareStratified(si, sj, samplesPerPixel);
-                            auto pixel = glm::vec2(i + offset.x, j + offset.y);
-                            pixel += glm::vec2(0.5f, 0.5f); // Center of the pixel
-                            std::unique_ptr<Ray> ray(this->generateThinLensRay(pixel));
-                            // std::clog << "Generated Ray: " << *ray << "\n";
-                            pixelColor += this->rayColor(ray.get(), m_maxDepth, world);
+                            paths.shadowContribution[p] = paths.throughput[p] * contribution;
+                            chunkShadows[chunk].push_back(p);
                         }
+
+                        float pdfValue = 1.0f;
+                        float scatteringPDF = 1.0f;
+                        this->scatterRay(&ray, world, record, scatterRecord, samples.scatter, samples.direction,
+                                         scattered, pdfValue, scatteringPDF);
+                        paths.throughput[p] *= scatterRecord.attenuation * scatteringPDF / pdfValue;
+                        paths.scatterPdf[p] = pdfValue;
                     }
 
-                    pixelColor *= pixelSamplesScale;
-                    // Replace nan components with zero
-                    if(std::isnan(pixelColor.r)) pixelColor.r = 0.0f;
-                    if(std::isnan(pixelColor.g)) pixelColor.g = 0.0f;
-                    if(std::isnan(pixelColor.b)) pixelColor.b = 0.0f;
+                    if(!this->survivesRoulette(bounce + 1, paths.throughput[p], samples.roulette))
+                    {
+                        continue;
+                    }
 
-                    pixelColor = glm::clamp(RaytracingUtility::gammaCorrect(pixelColor), 0.0f, 1.0f);
+                    paths.origin[p] = scattered.origin();
+                    paths.direction[p] = scattered.direction();
+                    chunkContinued[chunk].push_back(p);
+                }
+            });
+            concatenateQueues(chunkContinued, shadeChunks, active);
+            concatenateQueues(chunkShadows, shadeChunks, shadowQueue);
 
-                    image[(j * m_width + i) * 3 + 0] = static_cast<uint8_t>(255.0f * pixelColor.r);
-                    image[(j * m_width + i) * 3 + 1] = static_cast<uint8_t>(255.0f * pixelColor.g);
-                    image[(j * m_width + i) * 3 + 2] = static_cast<uint8_t>(255.0f * pixelColor.b);
+            // Shadow: light samples of next-event estimation count if nothing blocks them
+            ThreadPool::global().parallelFor(shadowQueue.size(), 1, [&](size_t begin, size_t end, int)
+            {
+                for(size_t k = begin; k < end; ++k)
+                {
+                    const int p = shadowQueue[k];
+                    if(!world.occluded(paths.shadowRay[p]))
+                    {
+                        paths.radiance[p] += paths.shadowContribution[p];
+                    }
+                }
+            });
+        }
+
+        // Accumulate: paths cut off at the maximum depth contribute what they gathered so far
+        ThreadPool::global().parallelFor(pathCount, 1, [&](size_t begin, size_t end, int)
+        {
+            for(size_t p = begin; p < end; ++p)
+            {
+                if(withAOVs)
+                {
+                    AOVSample &aov = paths.aov[p];
+                    if(!paths.directComplete[p])
+                    {
+                        aov.direct = paths.radiance[p];
+                    }
+                    m_film.addSample(paths.pixel[p], paths.radiance[p], aov);
+                }
+                else
+                {
+                    m_film.addSample(paths.pixel[p], paths.radiance[p]);
                 }
             }
-        }, t * m_height / numThreads, (t+1) == numThreads ? m_height : (t+1) * m_height / numThreads, t));
+        });
     }
+}
+
+//----------------------------------------------------------------------------------
+void PerspectiveCamera::resolveFilm()
+{
+    m_image = Image(m_width, m_height);
+    m_aovImages.assign(m_film.hasAOVs() ? AOV_COUNT : 0, Image(m_width, m_height));
 
-    for(auto &thread : threads)
+    ThreadPool::global().parallelFor(m_film.getPixelCount(), 1, [this](size_t begin, size_t end, int)
     {
-        thread.join();
+        for(int pixel = static_cast<int>(begin); pixel < static_cast<int>(end); ++pixel)
+        {
+            const Color3f pixelColor = replaceNaN(m_film.getPixelColor(pixel));
+            m_image.setPixel(pixel, pixelColor);
+
+            if(!m_aovImages.empty())
+            {
+                const AOVSample aov = m_film.getPixelAOV(pixel);
+                const Color3f direct = replaceNaN(aov.direct);
+                m_aovImages[static_cast<int>(AOV::Albedo)].setPixel(pixel, replaceNaN(aov.albedo));
+                m_aovImages[static_cast<int>(AOV::Normal)].setPixel(pixel, replaceNaN(aov.normal));
+                m_aovImages[static_cast<int>(AOV::Depth)].setPixel(pixel, Color3f(aov.depth));
+                m_aovImages[static_cast<int>(AOV::ObjectId)].setPixel(pixel, Color3f(static_cast<float>(aov.objectId)));
+                m_aovImages[static_cast<int>(AOV::Direct)].setPixel(pixel, direct);
+                m_aovImages[static_cast<int>(AOV::Indirect)].setPixel(pixel, pixelColor - direct);
+            }
+        }
+    });
+}
+
+//----------------------------------------------------------------------------------
+void PerspectiveCamera::denoiseImage()
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    // The variance of each pixel's mean, unknown where too few samples were taken to estimate it
+    std::vector<float> variance(m_film.getPixelCount());
+    for(int pixel = 0; pixel < m_film.getPixelCount(); ++pixel)
+    {
+        const int count = m_film.getSampleCount(pixel);
+        variance[pixel] = count < 2 ? -1.0f : m_film.getLuminanceVariance(pixel) / count;
     }
 
-    this->writePPMImage(image.get(), m_width, m_height, out);
-    std::clog << "\nDone.\n";
+    const Denoiser denoiser;
+    m_image = denoiser.denoise(m_image, this->getAOVImage(AOV::Albedo), this->getAOVImage(AOV::Normal), variance);
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::clog << "\nDenoised in " << elapsed.count() << " s";
+}
+
+//----------------------------------------------------------------------------------
+void PerspectiveCamera::writeOutput(std::ostream &out)
+{
+    if(m_outputFile.empty())
+    {
+        if(m_aovsEnabled)
+        {
+            std::clog << "\nAOVs are only written with an output file";
+        }
+        ImageWriter::write(m_image, ImageWriter::Format::PPM, out);
+        return;
+    }
+
+    const ImageWriter::Format format = ImageWriter::formatFromFilename(m_outputFile);
+    if(format == ImageWriter::Format::EXR && m_aovsEnabled)
+    {
+        std::vector<ImageWriter::Layer> layers = {ImageWriter::Layer{std::string(), &m_image, false}};
+        for(int i = 0; i < AOV_COUNT; ++i)
+        {
+            const AOV aov = static_cast<AOV>(i);
+            const bool singleChannel = aov == AOV::Depth || aov == AOV::ObjectId;
+            layers.push_back(ImageWriter::Layer{getAOVName(aov), &m_aovImages[i], singleChannel});
+        }
+        ImageWriter::write(layers, m_outputFile);
+        std::clog << "\nWrote image and AOV layers to " << m_outputFile;
+        return;
+    }
+
+    ImageWriter::write(m_image, m_outputFile);
+    std::clog << "\nWrote image to " << m_outputFile;
+
+    // 8-bit formats get the AOVs mapped for display, float formats their values
+    if(!m_aovsEnabled)
+    {
+        return;
+    }
+
+    const bool display = format == ImageWriter::Format::PPM || format == ImageWriter::Format::PNG;
+    for(int i = 0; i < AOV_COUNT; ++i)
+    {
+        const AOV aov = static_cast<AOV>(i);
+        const std::string filename = aovFilename(m_outputFile, getAOVName(aov));
+        const bool radiometric = aov == AOV::Albedo || aov == AOV::Direct || aov == AOV::Indirect;
+        if(display && !radiometric)
+        {
+            ImageWriter::write(displayAOV(m_aovImages[i], aov, m_far), filename, ImageWriter::Encoding::Linear);
+        }
+        else
+        {
+            ImageWriter::write(m_aovImages[i], filename);
+        }
+        std::clog << "\nWrote " << getAOVName(aov) << " to " << filename;
+    }
+}
+
+//----------------------------------------------------------------------------------
+const char *PerspectiveCamera::getAOVName(const AOV aov)
+{
+    return AOV_NAMES[static_cast<int>(aov)];
 }
 
 //----------------------------------------------------------------------------------
@@ -206,9 +1106,15 @@ void PerspectiveCamera::setScreenSize(const int width, const int height)
 
 //----------------------------------------------------------------------------------
 Ray *
-PerspectiveCamera::generateThinLensRay(const glm::vec2 &pixel)
+PerspectiveCamera::generateThinLensRay(const glm::vec2 &pixel, const glm::vec2 &lensSample)
 {
-    Ray *pinholeRay = this->generateRay(pixel);
+    return new Ray(this->thinLensRay(pixel, lensSample));
+}
+
+//----------------------------------------------------------------------------------
+Ray PerspectiveCamera::thinLensRay(const glm::vec2 &pixel, const glm::vec2 &lensSample)
+{
+    const Ray pinholeRay = this->pinholeRay(pixel);
     const float apertureRadius = this->getApertureRadius();
 
     if(apertureRadius <= 0.0f)
@@ -216,34 +1122,30 @@ PerspectiveCamera::generateThinLensRay(const glm::vec2 &pixel)
         return pinholeRay;
     }
 
-    glm::vec2 lensOffset = glm::vec2(RaytracingUtility::randomInUnitDisk());
+    // The concentric mapping keeps the stratification of the lens samples
+    const glm::vec2 lensOffset = RaytracingUtility::sampleUniformDiskConcentric(lensSample);
 
     const float focalDistance = glm::distance(this->getWorldPosition(), this->getFocalPoint());
     const float fstop = focalDistance / (apertureRadius * 2.0f);
 
-    float theta = lensOffset.x * apertureRadius * 2.0f * glm::pi<float>();
-    float radius = lensOffset.y;
-
-    float u = glm::cos(theta) * glm::sqrt(radius);
-    float v = glm::sin(theta) * glm::sqrt(radius);
-
-    glm::vec3 focusPoint = pinholeRay->direction() * (focalDistance / glm::dot(pinholeRay->direction(), this->getForwardAxis()));
+    glm::vec3 focusPoint = pinholeRay.direction() * (focalDistance / glm::dot(pinholeRay.direction(), this->getForwardAxis()));
     const float circleOfConfusionRadius = focalDistance / (2.0f * fstop);
 
-    // glm::vec3 origin = this->getPosition() + (lensOffsetWorld * circleOfConfusion);
-    glm::vec3 origin = this->getPosition() + (u * circleOfConfusionRadius * this->getHorizontalAxis()) + (v * circleOfConfusionRadius * this->getVerticalAxis());
+    glm::vec3 origin = this->getPosition() + (lensOffset.x * circleOfConfusionRadius * this->getHorizontalAxis()) + (lensOffset.y * circleOfConfusionRadius * this->getVerticalAxis());
     glm::vec3 direction = glm::normalize(focusPoint - origin);
 
-    // Clean-up
-    delete pinholeRay;
-
-    Ray *lensRay = new Ray(origin, direction);
-    return lensRay;
+    return Ray(origin, direction);
 }
 
 //----------------------------------------------------------------------------------
 Ray *
 PerspectiveCamera::generateRay(const glm::vec2 &pixel)
+{
+    return new Ray(this->pinholeRay(pixel));
+}
+
+//----------------------------------------------------------------------------------
+Ray PerspectiveCamera::pinholeRay(const glm::vec2 &pixel)
 {
     // Raster Space -> Normalized Device Coordinate Space [-1,1]
     float pxN = pixel.x / static_cast<float>(m_width-1);
@@ -270,8 +1172,7 @@ PerspectiveCamera::generateRay(const glm::vec2 &pixel)
     glm::vec3 cameraOriginWorld = this->getWorldPosition();
     glm::vec3 cameraDirectionWorld = glm::normalize((pxView * u) + (pyView * v) + (pzView * w));
 
-    Ray *ray = new Ray(cameraOriginWorld, cameraDirectionWorld);
-    return ray;
+    return Ray(cameraOriginWorld, cameraDirectionWorld);
 }
 
 //----------------------------------------------------------------------------------
@@ -303,42 +1204,187 @@ PerspectiveCamera::copy(const ProjectionCamera * const camera)
 }
 
 //----------------------------------------------------------------------------------
-Color3f PerspectiveCamera::rayColor(Ray * const ray, int depth, const BVH &world)
+Color3f PerspectiveCamera::shadeHit(const Ray &cameraRay, const HitRecord &cameraHit, const BVH &world, Sampler &sampler, AOVSample *aov)
 {
-    if(depth <= 0)
-    {
-        // std::clog << "Max ray depth reached\n";
-        return Color3f(0.0f);
-    }
+    const bool nextEvent = m_lightSampling == LightSampling::NextEvent;
 
-    HitRecord record;
+    Color3f radiance(0.0f);
+    Color3f throughput(1.0f);
+    Ray ray = cameraRay;
+    HitRecord record = cameraHit;
+    float scatterPdf = 0.0f;
+    uint8_t directComplete = 0;
+
+    for(int bounce = 0; ; ++bounce)
+    {
+        const BounceSamples samples = drawBounceSamples(sampler);
 
-    if(world.hit(*ray, record))
-    {        
         Color3f emitted = record.material->emitted(record);
+        if(nextEvent && emitted != Color3f(0.0f))
+        {
+            emitted *= this->emissionWeight(ray, record, scatterPdf, world);
+        }
+        radiance += throughput * emitted;
+
         ScatterRecord scatterRecord;
+        const bool scatters = record.material->scatter(ray, record, scatterRecord, samples.scatter, samples.direction);
+        if(aov != nullptr)
+        {
+            this->recordAOV(bounce, record, scatters, scatterRecord, emitted, radiance, *aov, directComplete);
+        }
+        if(!scatters)
+        {
+            break;
+        }
+
         Ray scattered;
-        float pdfValue = 1.0f;
-        float scatteringPDF = 1.0f;
+        if(scatterRecord.skipPdf)
+        {
+            throughput *= scatterRecord.attenuation;
+            scatterPdf = 0.0f;
+            scattered = scatterRecord.skipPdfRay;
+        }
+        else
+        {
+            Color3f directLight;
+            Ray shadowRay;
+            if(nextEvent
+               && this->sampleLight(ray, record, scatterRecord, world, samples.light, samples.lightPoint, shadowRay, directLight)
+               && !world.occluded(shadowRay))
+            {
+                radiance += throughput * directLight;
+            }
+
+            float pdfValue = 1.0f;
+            float scatteringPDF = 1.0f;
+            this->scatterRay(&ray, world, record, scatterRecord, samples.scatter, samples.direction,
+                             scattered, pdfValue, scatteringPDF);
+            throughput *= scatterRecord.attenuation * scatteringPDF / pdfValue;
+            scatterPdf = pdfValue;
+        }
 
-        if(!record.material->scatter(*ray, record, scatterRecord))
+        if(bounce + 1 >= m_maxDepth || !this->survivesRoulette(bounce + 1, throughput, samples.roulette))
         {
-            return emitted;
+            break;
         }
 
-        if(scatterRecord.skipPdf)
+        ray = scattered;
+        record = HitRecord();
+        if(!world.hit(ray, record))
         {
-            return scatterRecord.attenuation * rayColor(&scatterRecord.skipPdfRay, depth-1, world);
+            radiance += throughput * this->getBackgroundColor();
+            break;
         }
+    }
 
-        this->scatterRay(ray, world, record, scatterRecord, scattered, pdfValue, scatteringPDF);
-        
-        Color3f colorFromScatter = (scatterRecord.attenuation * scatteringPDF * rayColor(&scattered, depth-1, world)) / pdfValue;        
-        return emitted + colorFromScatter;
+    if(aov != nullptr && !directComplete)
+    {
+        aov->direct = radiance;
+    }
+    return radiance;
+}
+
+//----------------------------------------------------------------------------------
+void PerspectiveCamera::recordAOV(const int bounce,
+                                  const HitRecord &record,
+                                  const bool scatters,
+                                  const ScatterRecord &scatterRecord,
+                                  const Color3f &emitted,
+                                  const Color3f &radiance,
+                                  AOVSample &aov,
+                                  uint8_t &directComplete) const
+{
+    if(bounce == 0)
+    {
+        aov.albedo = scatters ? scatterRecord.attenuation : glm::clamp(emitted, 0.0f, 1.0f);
+        aov.normal = record.normal;
+        aov.depth = record.t;
+        aov.objectId = record.objectId;
     }
+    else if(bounce == 1)
+    {
+        // Light gathered from here on has scattered at least twice
+        aov.direct = radiance;
+        directComplete = 1;
+    }
+}
 
-    // std::clog << "Ray miss - returning background color\n";
-    return this->getBackgroundColor();
+//----------------------------------------------------------------------------------
+bool PerspectiveCamera::survivesRoulette(const int bounce, Color3f &throughput, const float u) const
+{
+    if(bounce < m_rouletteDepth)
+    {
+        return true;
+    }
+
+    // Continue with a probability proportional to the throughput, paths that carry little
+    // light are ended early and the survivors are reweighted to keep the estimate unbiased
+    const float survival = std::min(1.0f, std::max(throughput.r, std::max(throughput.g, throughput.b)));
+    if(survival <= 0.0f || u >= survival)
+    {
+        return false;
+    }
+
+    throughput /= survival;
+    return true;
+}
+
+//----------------------------------------------------------------------------------
+float PerspectiveCamera::emissionWeight(const Ray &ray, const HitRecord &record, const float scatterPdf, const BVH &world) const
+{
+    // Camera rays and specular bounces cannot be generated by light sampling
+    if(scatterPdf <= 0.0f || world.getLightTree().empty())
+    {
+        return 1.0f;
+    }
+
+    // Only the light that was hit could have produced this direction by light sampling
+    const float lightPdf = world.getLightTree().pdfValue(ray.origin(), ray.direction(), record.t * (1.0f + LIGHT_DISTANCE_TOLERANCE));
+    return powerHeuristic(scatterPdf, lightPdf);
+}
+
+//----------------------------------------------------------------------------------
+bool PerspectiveCamera::sampleLight(const Ray &ray,
+                                    const HitRecord &record,
+                                    const ScatterRecord &scatterRecord,
+                                    const BVH &world,
+                                    const float uLight,
+                                    const glm::vec2 &uLightPoint,
+                                    Ray &shadowRay,
+                                    Color3f &contribution) const
+{
+    const LightTree &lightTree = world.getLightTree();
+    if(lightTree.empty())
+    {
+        return false;
+    }
+
+    float lightPmf;
+    const int lightIndex = lightTree.sample(record.point, uLight, lightPmf);
+    const Hittable &light = lightTree.light(lightIndex);
+
+    // Find the sampled point on the light and the radiance it emits towards the hit
+    const glm::vec3 direction = glm::normalize(light.random(record.point, uLightPoint));
+    const Ray toLight(record.point, direction);
+    HitRecord lightRecord;
+    if(lightPmf <= 0.0f || !light.hit(toLight, lightRecord))
+    {
+        return false;
+    }
+
+    const Color3f emitted = lightRecord.material->emitted(lightRecord);
+    const float lightPdf = lightPmf * light.pdfValue(record.point, direction);
+    const float scatteringPDF = record.material->scatteringPDF(ray, record, toLight);
+    if(emitted == Color3f(0.0f) || lightPdf <= 0.0f || scatteringPDF <= 0.0f)
+    {
+        return false;
+    }
+
+    const float weight = powerHeuristic(lightPdf, scatterRecord.pdfPtr->value(direction));
+    contribution = scatterRecord.attenuation * scatteringPDF * emitted * weight / lightPdf;
+    shadowRay = Ray(record.point, direction, SHADOW_RAY_ORIGIN_OFFSET, lightRecord.t * (1.0f - LIGHT_DISTANCE_TOLERANCE));
+
+    return true;
 }
 
 //----------------------------------------------------------------------------------
@@ -346,42 +1392,41 @@ void PerspectiveCamera::scatterRay(Ray * const ray,
                                    const BVH &world, 
                                    const HitRecord &record,
                                    ScatterRecord &scatterRecord,
+                                   const float uc,
+                                   const glm::vec2 &u,
                                    Ray &scattered,
                                    float &pdf,
                                    float &scatteringPDF)
 {
-    
-
-    
-    std::vector<std::shared_ptr<Pdf>> pdfs;
-    pdfs.push_back(scatterRecord.pdfPtr);
-
-    auto lightSources = world.getLightSources();
-    for(const auto &light : lightSources)
+    // The PDFs live on the stack, scattering a ray does not allocate
+    MixturePdf mixturePdf;
+    mixturePdf.add(*scatterRecord.pdfPtr);
+
+    // Half of the directions go towards a light chosen by its contribution at the hit point,
+    // unless lights are sampled separately by next-event estimation
+    const LightPdf lightPdf(world.getLightTree(), record.point);
+    if(m_lightSampling == LightSampling::Mixture && !world.getLightTree().empty())
     {
-        pdfs.push_back(std::make_shared<HittablePdf>(light, record.point));
+        mixturePdf.add(lightPdf);
     }
 
-    MixturePdf mixturePdf(pdfs);
-    scattered = Ray(record.point, glm::normalize(mixturePdf.generate()));
+    scattered = Ray(record.point, glm::normalize(mixturePdf.generate(uc, u)));
     pdf = mixturePdf.value(scattered.direction());
     scatteringPDF = record.material->scatteringPDF(*ray, record, scattered);
 }
 
 //----------------------------------------------------------------------------------
-void PerspectiveCamera::writePPMImage(uint8_t *image, const int width, const int height, std::ostream &out)
+void PerspectiveCamera::writeSampleCountMap(const std::string &filename)
 {
-    out << "P3\n" << width << ' ' << height << "\n255\n";
-
-    for(int j=0; j < height; j++)
+    const int maxCount = std::max(1, m_film.getMaxSampleCount());
+    Image image(m_width, m_height);
+    for(int pixel = 0; pixel < m_film.getPixelCount(); ++pixel)
     {
-        for(int i=0; i < width; ++i)
-        {
-            out << static_cast<int>(image[(j * width + i) * 3 + 0]) << ' '
-                << static_cast<int>(image[(j * width + i) * 3 + 1]) << ' '
-                << static_cast<int>(image[(j * width + i) * 3 + 2]) << '\n';
-        }
+        image.setPixel(pixel, Color3f(static_cast<float>(m_film.getSampleCount(pixel)) / maxCount));
     }
+
+    ImageWriter::write(image, filename, ImageWriter::Encoding::Linear);
+    std::clog << "\nWrote sample counts of up to " << maxCount << " per pixel to " << filename;
 }
 
 //----------------------------------------------------------------------------------
@@ -490,15 +1535,26 @@ void PerspectiveCamera::visualizeRayPaths(const std::string &filename,
     outFile << "\n# Ray segments as cylinders (red)\n";
     outFile << "usemtl red_rays\n";
 
-    for(int row = 0; row < gridResolution; ++row)
+    // Trace the paths in parallel, one list of segments per primary ray, and write them in
+    // grid order afterwards. Every path draws its values from the sampler as the sample of the
+    // pixel with its index, so the paths do not depend on the threads tracing them.
+    const int pathCount = gridResolution * gridResolution;
+    std::vector<std::vector<std::pair<glm::vec3, glm::vec3>>> pathSegments(pathCount);
+    const std::unique_ptr<Sampler> pathSampler = Sampler::create(m_samplerType, 1, m_frameIndex);
+    ThreadPool::global().parallelFor(pathCount, 1, [&](size_t begin, size_t end, int)
     {
-        for(int col = 0; col < gridResolution; ++col)
+        std::unique_ptr<Sampler> sampler = pathSampler->clone();
+        for(int path = static_cast<int>(begin); path < static_cast<int>(end); ++path)
         {
+            const int row = path / gridResolution;
+            const int col = path % gridResolution;
             float pixelX = (col / static_cast<float>(gridResolution - 1)) * (m_width - 1);
             float pixelY = (row / static_cast<float>(gridResolution - 1)) * (m_height - 1);
             glm::vec2 pixel(pixelX+0.5f, pixelY+0.5f); // Center of pixel
 
-            std::unique_ptr<Ray> ray(useThinLens ? this->generateThinLensRay(pixel)
+            sampler->startPixelSample(path, 0);
+            const glm::vec2 lensSample = sampler->get2D();
+            std::unique_ptr<Ray> ray(useThinLens ? this->generateThinLensRay(pixel, lensSample)
                                                  : this->generateRay(pixel));
 
             int depth = m_maxDepth;
@@ -511,12 +1567,12 @@ void PerspectiveCamera::visualizeRayPaths(const std::string &filename,
                 {
                     // Miss: draw cylinder segment out to a fixed length for context
                     glm::vec3 missEnd = currentOrigin + ray->direction() * missRayLength;
-                    createCylinder(currentOrigin, missEnd, vertexIndex);
+                    pathSegments[path].emplace_back(currentOrigin, missEnd);
                     break;
                 }
 
                 // Hit: draw cylinder segment to the intersection point
-                createCylinder(currentOrigin, record.point, vertexIndex);
+                pathSegments[path].emplace_back(currentOrigin, record.point);
 
                 // Generate scattered ray to continue path
                 ScatterRecord scatterRecord;
@@ -524,7 +1580,10 @@ void PerspectiveCamera::visualizeRayPaths(const std::string &filename,
                 float pdfValue = 1.0f;
                 float scatteringPDF = 1.0f;
 
-                if(!record.material->scatter(*ray, record, scatterRecord))
+                const BounceSamples samples = drawBounceSamples(*sampler);
+                const float uc = samples.scatter;
+                const glm::vec2 u = samples.direction;
+                if(!record.material->scatter(*ray, record, scatterRecord, uc, u))
                 {
                     break; // absorption or emission-only material
                 }
@@ -535,13 +1594,21 @@ void PerspectiveCamera::visualizeRayPaths(const std::string &filename,
                 }
                 else
                 {   
-                    this->scatterRay(ray.get(), world, record, scatterRecord, scattered, pdfValue, scatteringPDF);
+                    this->scatterRay(ray.get(), world, record, scatterRecord, uc, u, scattered, pdfValue, scatteringPDF);
                 }
 
                 currentOrigin = record.point;
                 ray.reset(new Ray(scattered));
             }
         }
+    });
+
+    for(const auto &segments : pathSegments)
+    {
+        for(const auto &segment : segments)
+        {
+            createCylinder(segment.first, segment.second, vertexIndex);
+        }
     }
 
     // Optional: add camera and focal point markers
@@ -3,8 +3,15 @@
 
 #include "ProjectionCamera.h"
 #include "BVH.h"
+#include "Film.h"
+#include "Image.h"
+#include "Sampler.h"
 #include "Utility.h"
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 namespace raytracer
 {
 
@@ -19,6 +26,44 @@ namespace raytracer
 class PerspectiveCamera : public ProjectionCamera
 {
 public:
+    /// @brief Algorithm used to compute the radiance of the camera samples
+    enum class Integrator
+    {
+        Recursive,  ///< each sample's path is traced to its end, one sample at a time
+        Wavefront   ///< large batches of paths advance together through separate stages
+    };
+
+    /// @brief Strategy used to gather direct lighting at non-specular hits
+    enum class LightSampling
+    {
+        Mixture,    ///< scattered directions are drawn from a mixture of the BSDF and light PDFs
+        NextEvent   ///< a light is sampled and tested with a shadow ray at every non-specular hit,
+                    ///< and combined with BSDF sampling by multiple importance sampling
+    };
+
+    /// @brief Auxiliary images render() can produce from the same samples as the radiance
+    enum class AOV
+    {
+        Albedo,     ///< reflectance at the first hit
+        Normal,     ///< world space shading normal at the first hit
+        Depth,      ///< distance from the camera to the first hit, the far plane on a miss
+        ObjectId,   ///< index of the scene object hit first by the pixel's first sample, -1 on a miss
+        Direct,     ///< radiance that scattered at most once between the light and the camera
+        Indirect    ///< radiance that scattered more than once
+    };
+
+    /// @brief Number of AOV values
+    static const int AOV_COUNT = 6;
+
+    /// @brief Default number of bounces before paths are subject to Russian roulette
+    static const int DEFAULT_ROULETTE_DEPTH = 3;
+
+    /// @brief Default time in seconds between checkpoints of a progressive render
+    static const int DEFAULT_CHECKPOINT_INTERVAL = 60;
+
+    /// @brief Default time in seconds between preview images of a progressive render
+    static const int DEFAULT_PREVIEW_INTERVAL = 10;
+
     /// Default constructor.
     PerspectiveCamera();
 
@@ -43,12 +88,163 @@ public:
     /// @see Camera::reset
     void reset() override;
 
-    /// @brief Renders the scene to the specified output stream.
+    /// @brief Renders the scene to the output file, or as a binary PPM image to the specified
+    ///        output stream if no output file is set.
     /// @param world the hittable list representing the scene
-    /// @param samplesPerPixel the number of samples per pixel.
+    /// @param samplesPerPixel the number of samples per pixel. With adaptive sampling this is
+    ///        the average over the image, pixels get between a few and several times as many.
     /// @param out the output stream to write the rendered image to (default is std::cout)
     void render(const BVH &world, const int samplesPerPixel=1, std::ostream &out=std::cout);
 
+    /// @brief Get the samples accumulated by the last render()
+    const Film &getFilm() const { return m_film; }
+
+    /// @brief Get the linear radiance of every pixel rendered by the last render()
+    const Image &getImage() const { return m_image; }
+
+    /// @brief Get an auxiliary image rendered by the last render() with AOVs enabled
+    const Image &getAOVImage(const AOV aov) const { return m_aovImages[static_cast<int>(aov)]; }
+
+    /// @brief Get the name of an AOV, as used for its layer or file
+    static const char *getAOVName(const AOV aov);
+
+    //@{
+    /// @brief Set/get whether render() also produces the auxiliary images of every AOV. They
+    ///        are gathered from the first hit and the path of every sample, so the scene is
+    ///        traversed no more often than without them. With an output file they are written
+    ///        as layers of an .exr file, or as separate files named <file>.<aov>.<extension>.
+    void setAOVsEnabled(const bool enabled) { m_aovsEnabled = enabled; }
+    bool getAOVsEnabled() const { return m_aovsEnabled; }
+    //@}
+
+    //@{
+    /// @brief Set/get whether render() filters the noise out of the image before writing it,
+    ///        guided by the albedo, normal and variance of every pixel. The AOVs are written
+    ///        as rendered.
+    void setDenoiseEnabled(const bool enabled) { m_denoiseEnabled = enabled; }
+    bool getDenoiseEnabled() const { return m_denoiseEnabled; }
+    //@}
+
+    //@{
+    /// @brief Set/get the file render() writes the image to, empty to write to the stream
+    ///        passed to render(). The format follows the extension: .ppm and .png are gamma
+    ///        corrected 8-bit images, .pfm and .exr keep the linear float radiance.
+    void setOutputFile(const std::string &filename) { m_outputFile = filename; }
+    const std::string &getOutputFile() const { return m_outputFile; }
+    //@}
+
+    //@{
+    /// @brief Set/get the integrator used by render(). Both compute the same estimate; the
+    ///        wavefront integrator runs generation, intersection, shading and accumulation as
+    ///        separate parallel passes over queues of paths kept in structure-of-arrays form.
+    void setIntegrator(const Integrator integrator) { m_integrator = integrator; }
+    Integrator getIntegrator() const { return m_integrator; }
+    //@}
+
+    //@{
+    /// @brief Set/get how direct lighting is sampled. With next-event estimation, light samples
+    ///        and BSDF samples that hit a light are weighted with the power heuristic.
+    void setLightSampling(const LightSampling lightSampling) { m_lightSampling = lightSampling; }
+    LightSampling getLightSampling() const { return m_lightSampling; }
+    //@}
+
+    //@{
+    /// @brief Set/get the number of bounces after which paths are ended by Russian roulette
+    ///        with a probability that grows as their throughput falls. Surviving paths are
+    ///        reweighted, so the estimate stays unbiased. A depth of at least the maximum
+    ///        depth disables Russian roulette.
+    void setRouletteDepth(const int depth) { m_rouletteDepth = depth; }
+    int getRouletteDepth() const { return m_rouletteDepth; }
+    //@}
+
+    //@{
+    /// @brief Set/get the index of the frame being rendered. Random numbers are drawn from
+    ///        sequences chosen by pixel, sample and frame, so a frame renders the same image
+    ///        regardless of the number of threads and successive frames get independent noise.
+    void setFrameIndex(const int frameIndex) { m_frameIndex = frameIndex; }
+    int getFrameIndex() const { return m_frameIndex; }
+    //@}
+
+    //@{
+    /// @brief Set/get the algorithm generating the sample values of the pixel position, the
+    ///        lens position, light selection and scattering. Every bounce of a path draws from
+    ///        its own sampler dimensions.
+    void setSamplerType(const Sampler::Type samplerType) { m_samplerType = samplerType; }
+    Sampler::Type getSamplerType() const { return m_samplerType; }
+    //@}
+
+    //@{
+    /// @brief Set/get the error threshold of adaptive sampling, 0 to sample every pixel
+    ///        equally. Adaptive sampling renders in passes and only gives further samples to
+    ///        the pixels whose estimated error, in gamma-corrected units of the [0,1] output
+    ///        range, is still above the threshold, until the sample budget of render() is
+    ///        spent or the time budget runs out.
+    void setAdaptiveThreshold(const float threshold) { m_adaptiveThreshold = threshold; }
+    float getAdaptiveThreshold() const { return m_adaptiveThreshold; }
+    //@}
+
+    //@{
+    /// @brief Set/get the time in seconds after which adaptive sampling stops starting new
+    ///        passes, 0 for no limit. The first pass always completes.
+    void setTimeBudget(const float seconds) { m_timeBudget = seconds; }
+    float getTimeBudget() const { return m_timeBudget; }
+    //@}
+
+    //@{
+    /// @brief Set/get the file render() writes the number of samples of every pixel to as a
+    ///        grayscale image scaled to the largest count, empty to write none. The format
+    ///        follows the extension as for setOutputFile().
+    void setSampleCountMapFile(const std::string &filename) { m_sampleCountMapFile = filename; }
+    const std::string &getSampleCountMapFile() const { return m_sampleCountMapFile; }
+    //@}
+
+    //@{
+    /// @brief Set/get the checkpoint file of progressive rendering, empty for none. If the
+    ///        file exists, render() resumes from it and only takes the samples still missing
+    ///        from the sample budget, so a larger budget adds samples to a finished render.
+    ///        The sampler type and frame index are taken from the checkpoint. The progress is
+    ///        saved at the checkpoint interval and when the render is done.
+    void setCheckpointFile(const std::string &filename) { m_checkpointFile = filename; }
+    const std::string &getCheckpointFile() const { return m_checkpointFile; }
+    //@}
+
+    //@{
+    /// @brief Set/get the time in seconds between checkpoints, 0 to save after every pass
+    void setCheckpointInterval(const float seconds) { m_checkpointInterval = seconds; }
+    float getCheckpointInterval() const { return m_checkpointInterval; }
+    //@}
+
+    //@{
+    /// @brief Set/get the file progressive rendering writes the image rendered so far to at
+    ///        the preview interval, empty for none. The format follows the extension as for
+    ///        setOutputFile().
+    void setPreviewFile(const std::string &filename) { m_previewFile = filename; }
+    const std::string &getPreviewFile() const { return m_previewFile; }
+    //@}
+
+    //@{
+    /// @brief Set/get the file render() writes the film to as an accumulation file, empty for
+    ///        none. Accumulation files of processes rendering the same scene with different
+    ///        frame indices can be merged into one image with raytracing-merge.
+    void setAccumulationFile(const std::string &filename) { m_accumulationFile = filename; }
+    const std::string &getAccumulationFile() const { return m_accumulationFile; }
+    //@}
+
+    /// @brief Hash the settings of the camera and the extent of the scene that determine the
+    ///        expected value of every pixel. Settings that only change the noise, such as the
+    ///        integrator, the sampler and the frame index, are left out, so films that differ
+    ///        only in those can be merged.
+    /// @param world the scene
+    /// @return the hash stored in accumulation files
+    uint64_t computeMetadataHash(const BVH &world) const;
+
+    //@{
+    /// @brief Set/get the time in seconds between preview images, 0 to write one after
+    ///        every pass
+    void setPreviewInterval(const float seconds) { m_previewInterval = seconds; }
+    float getPreviewInterval() const { return m_previewInterval; }
+    //@}
+
     /// @brief Creates a ray in world space from a screen pixel location. Caller is responsible
     ///        for managing the memory allocated for this object.
     ///        Implementation based on: https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-generating-camera-rays/generating-camera-rays.html
@@ -59,8 +255,9 @@ public:
     /// @brief Creates a ray in world space from a screen pixel location and a lens offset to simulate
     ///        depth of field. Caller is responsible for managing the memory allocated for this object.
     /// @param pixel the x- and y-coordinates of the pixel in raster space
+    /// @param lensSample a uniform sample in [0,1)^2 that selects the point on the lens
     /// @return the generated ray
-    Ray *generateThinLensRay(const glm::vec2 &pixel);
+    Ray *generateThinLensRay(const glm::vec2 &pixel, const glm::vec2 &lensSample);
 
     /// @brief Change the view angle by the specified factor
     /// @param factor
@@ -113,23 +310,154 @@ public:
                            float missRayLength = 50.0f);
 
 private:
-    /// @brief Compute the color of a ray.
-    /// @param ray the ray to compute the color for
-    /// @param depth the maximum number of ray bounces into the scene
+    /// @brief Render in passes until every pixel's error is below the adaptive threshold or
+    ///        the sample or time budget is spent.
+    /// @param world the hittable list representing the scene
+    /// @param samplesPerPixel the average number of samples per pixel the budget allows
+    void renderAdaptive(const BVH &world, const int samplesPerPixel);
+
+    /// @brief Render in passes over all pixels, resuming from the checkpoint file if it
+    ///        exists, and save checkpoints and preview images between passes.
     /// @param world the hittable list representing the scene
-    Color3f rayColor(Ray * const ray, int depth, const BVH &world);
+    /// @param samplesPerPixel the number of samples every pixel has when done
+    /// @return the seed the samples were taken with, that of the checkpoint when resumed
+    uint32_t renderProgressive(const BVH &world, const int samplesPerPixel);
 
-    /// @brief  Write a PPM image to the output stream.
-    /// @param image PPM image data
-    /// @param width the width of the image
-    /// @param height the height of the image
-    /// @param out the output stream
-    void writePPMImage(uint8_t *image, const int width, const int height, std::ostream &out);
+    /// @brief Add a range of samples to some pixels of the film with the selected integrator.
+    /// @param world the hittable list representing the scene
+    /// @param sampler the sampler, copied for every thread
+    /// @param pixels the indices of the pixels to sample, in increasing order
+    /// @param firstSample the index of the first sample to take in every pixel
+    /// @param endSample the index one past the last sample to take in every pixel
+    void renderPass(const BVH &world,
+                    const Sampler &sampler,
+                    const std::vector<int> &pixels,
+                    const int firstSample,
+                    const int endSample);
+
+    /// @brief Render a pass with the recursive integrator. The image is split into tiles that
+    ///        threads take one at a time until none are left. @see renderPass
+    void renderRecursive(const BVH &world,
+                         const Sampler &sampler,
+                         const std::vector<int> &pixels,
+                         const int firstSample,
+                         const int endSample);
+
+    /// @brief Add a range of samples to up to 4x4 pixels whose primary rays are traced as
+    ///        one packet per sample index.
+    /// @param world the hittable list representing the scene
+    /// @param sampler the sampler of the calling thread
+    /// @param pixels the indices of the pixels
+    /// @param pixelCount the number of pixels, at most RayPacket::MAX_SIZE
+    /// @param firstSample the index of the first sample to take in every pixel
+    /// @param endSample the index one past the last sample to take in every pixel
+    void renderPacket(const BVH &world,
+                      Sampler &sampler,
+                      const int *pixels,
+                      const int pixelCount,
+                      const int firstSample,
+                      const int endSample);
+
+    /// @brief Render a pass with the wavefront integrator. @see renderPass
+    void renderWavefront(const BVH &world,
+                         const Sampler &sampler,
+                         const std::vector<int> &pixels,
+                         const int firstSample,
+                         const int endSample);
+
+    /// @brief Write the number of samples of every pixel of the film as a grayscale image.
+    /// @param filename the output filename, whose extension selects the format
+    void writeSampleCountMap(const std::string &filename);
+
+    /// @brief Store the average radiance and auxiliary values of every pixel of the film in
+    ///        the images.
+    void resolveFilm();
+
+    /// @brief Replace the image with its denoised version, requires the film to have AOVs
+    void denoiseImage();
+
+    /// @brief Write the image and the auxiliary images to the output file, or the image alone
+    ///        to the stream if no output file is set.
+    void writeOutput(std::ostream &out);
+
+    /// @brief Create a pinhole camera ray by value, see generateRay()
+    Ray pinholeRay(const glm::vec2 &pixel);
+
+    /// @brief Create a thin lens camera ray by value, see generateThinLensRay()
+    /// @param pixel the x- and y-coordinates of the pixel in raster space
+    /// @param lensSample a uniform sample in [0,1)^2 that selects the point on the lens
+    Ray thinLensRay(const glm::vec2 &pixel, const glm::vec2 &lensSample);
+
+    /// @brief Compute the color of a camera ray from its closest hit. The path is followed
+    ///        iteratively, carrying its throughput, until it leaves the scene, is absorbed,
+    ///        reaches the maximum depth or is ended by Russian roulette.
+    /// @param cameraRay the ray that hit the scene
+    /// @param cameraHit the closest hit of the ray
+    /// @param world the hittable list representing the scene
+    /// @param sampler the sampler positioned at the first bounce dimension of the pixel sample
+    /// @param aov receives the auxiliary values of the sample if not null
+    Color3f shadeHit(const Ray &cameraRay, const HitRecord &cameraHit, const BVH &world, Sampler &sampler, AOVSample *aov = nullptr);
+
+    /// @brief Record the auxiliary values of a path at a bounce.
+    /// @param bounce the number of bounces of the path so far
+    /// @param record the hit of the bounce
+    /// @param scatters whether the hit material scatters
+    /// @param scatterRecord the scattering of the hit material, if it scatters
+    /// @param emitted the light emitted at the hit
+    /// @param radiance the radiance gathered by the path including the emitted light
+    /// @param aov the auxiliary values of the path
+    /// @param directComplete set once aov.direct holds all light that scattered at most once
+    void recordAOV(const int bounce,
+                   const HitRecord &record,
+                   const bool scatters,
+                   const ScatterRecord &scatterRecord,
+                   const Color3f &emitted,
+                   const Color3f &radiance,
+                   AOVSample &aov,
+                   uint8_t &directComplete) const;
+
+    /// @brief Decide by Russian roulette whether a path continues after a bounce.
+    /// @param bounce the number of bounces of the path so far
+    /// @param throughput the path throughput, divided by the survival probability if the
+    ///        path continues
+    /// @param u a uniform sample in [0,1)
+    /// @return true if the path continues, false if it ends
+    bool survivesRoulette(const int bounce, Color3f &throughput, const float u) const;
+
+    /// @brief Get the multiple importance sampling weight of the light a scattered ray hit
+    ///        under next-event estimation.
+    /// @param ray the ray that hit the light
+    /// @param record the hit on the light
+    /// @param scatterPdf the density the ray's direction was sampled with
+    /// @param world the hittable list representing the scene
+    /// @return the weight, 1 for camera rays and specular bounces
+    float emissionWeight(const Ray &ray, const HitRecord &record, const float scatterPdf, const BVH &world) const;
+
+    /// @brief Sample a light for next-event estimation.
+    /// @param ray the ray that hit the scene
+    /// @param record the closest hit of the ray
+    /// @param scatterRecord the scattering of the hit material
+    /// @param world the hittable list representing the scene
+    /// @param uLight a uniform sample in [0,1) that chooses the light
+    /// @param uLightPoint a uniform sample in [0,1)^2 that chooses the point on the light
+    /// @param shadowRay receives the ray that has to be unoccluded for the light to count
+    /// @param contribution receives the weighted light reflected towards the ray
+    /// @return true if the light sample contributes, false otherwise
+    bool sampleLight(const Ray &ray,
+                     const HitRecord &record,
+                     const ScatterRecord &scatterRecord,
+                     const BVH &world,
+                     const float uLight,
+                     const glm::vec2 &uLightPoint,
+                     Ray &shadowRay,
+                     Color3f &contribution) const;
 
     void scatterRay(Ray * const ray, 
                     const BVH &world, 
                     const HitRecord &record,
                     ScatterRecord &scatterRecord,
+                    const float uc,
+                    const glm::vec2 &u,
                     Ray &scattered,
                     float &pdf,
                     float &scatteringPDF);
@@ -137,6 +465,25 @@ private:
     int m_width;
     int m_height;
     int m_maxDepth;
+    Integrator m_integrator;
+    LightSampling m_lightSampling;
+    int m_rouletteDepth;
+    int m_frameIndex;
+    Sampler::Type m_samplerType;
+    float m_adaptiveThreshold;
+    float m_timeBudget;
+    std::string m_sampleCountMapFile;
+    std::string m_outputFile;
+    bool m_aovsEnabled;
+    bool m_denoiseEnabled;
+    std::string m_checkpointFile;
+    float m_checkpointInterval;
+    std::string m_previewFile;
+    float m_previewInterval;
+    std::string m_accumulationFile;
+    Film m_film;
+    Image m_image;
+    std::vector<Image> m_aovImages;
 
     float m_zoomFactor;
 
@@ -0,0 +1,362 @@
+#include "AccumulationFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator> // std::istreambuf_iterator
+#include <memory>
+#include <ostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace raytracer
+{
+namespace
+{
+/// Identifies accumulation files and the version of their layout
+const char ACCUMULATION_MAGIC[8] = {'R', 'T', 'A', 'C', 'C', 'U', '0', '2'};
+/// Size in bytes of the magic number, the metadata hash and the number of seeds before the seeds
+const size_t ACCUMULATION_FIXED_HEADER_SIZE = sizeof(ACCUMULATION_MAGIC) + sizeof(uint64_t) + sizeof(uint32_t);
+/// The header is padded to a multiple of this many bytes so the sums of the film stay aligned
+const size_t ACCUMULATION_HEADER_ALIGNMENT = sizeof(double);
+/// Size in bytes of the header of the film as written by Film::write()
+const size_t FILM_HEADER_SIZE = 4 * sizeof(int32_t);
+/// Bytes per pixel of the arrays every film has: luminance sums, squared sums, radiance sums and counts
+const size_t FILM_PIXEL_SIZE = 2 * sizeof(double) + sizeof(Color3f) + sizeof(int32_t);
+/// Number of pixels merged at a time, small enough for the sums of a chunk to stay in cache
+const int MERGE_CHUNK_PIXELS = 1 << 14;
+
+using FileList = std::vector<std::unique_ptr<AccumulationFile>>;
+
+//----------------------------------------------------------------------------------
+// Size in bytes of the header of a file with the given number of seeds
+size_t headerSize(const size_t seedCount)
+{
+    const size_t size = ACCUMULATION_FIXED_HEADER_SIZE + seedCount * sizeof(uint32_t);
+    return (size + ACCUMULATION_HEADER_ALIGNMENT - 1) / ACCUMULATION_HEADER_ALIGNMENT * ACCUMULATION_HEADER_ALIGNMENT;
+}
+
+//----------------------------------------------------------------------------------
+// Write the header of a file before its film
+void writeHeader(std::ostream &out, const uint64_t metadataHash, const std::vector<uint32_t> &seeds)
+{
+    const uint32_t seedCount = static_cast<uint32_t>(seeds.size());
+    const size_t padding = headerSize(seeds.size()) - ACCUMULATION_FIXED_HEADER_SIZE - seeds.size() * sizeof(uint32_t);
+    const char zeros[ACCUMULATION_HEADER_ALIGNMENT] = {};
+    out.write(ACCUMULATION_MAGIC, sizeof(ACCUMULATION_MAGIC));
+    out.write(reinterpret_cast<const char *>(&metadataHash), sizeof(metadataHash));
+    out.write(reinterpret_cast<const char *>(&seedCount), sizeof(seedCount));
+    out.write(reinterpret_cast<const char *>(seeds.data()), static_cast<std::streamsize>(seeds.size() * sizeof(uint32_t)));
+    out.write(zeros, static_cast<std::streamsize>(padding));
+}
+
+//----------------------------------------------------------------------------------
+// Sum one array of all files chunk by chunk and pass every chunk of sums to
+// consume(firstPixel, sums, pixelCount)
+template<typename T, typename Get, typename Consume>
+void sumArray(const FileList &files, const int pixelCount, Get get, Consume consume)
+{
+    std::vector<T> sums(MERGE_CHUNK_PIXELS);
+    for(int begin = 0; begin < pixelCount; begin += MERGE_CHUNK_PIXELS)
+    {
+        const int count = std::min(MERGE_CHUNK_PIXELS, pixelCount - begin);
+        std::fill(sums.begin(), sums.begin() + count, T(0));
+        for(const auto &file : files)
+        {
+            const T *values = get(*file) + begin;
+            for(int i = 0; i < count; ++i)
+            {
+                sums[i] += values[i];
+            }
+        }
+        consume(begin, sums.data(), count);
+    }
+}
+} // namespace
+
+//----------------------------------------------------------------------------------
+AccumulationFile::AccumulationFile(const std::string &filename)
+    : m_data(nullptr)
+    , m_size(0)
+    , m_mapped(false)
+    , m_metadataHash(0)
+    , m_headerSize(0)
+    , m_width(0)
+    , m_height(0)
+    , m_hasAOVs(false)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        throw std::runtime_error("Could not open accumulation file " + filename);
+    }
+    struct stat status;
+    if(::fstat(fd, &status) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Could not read accumulation file " + filename);
+    }
+    m_size = static_cast<size_t>(status.st_size);
+    if(m_size > 0)
+    {
+        void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED)
+        {
+            ::close(fd);
+            throw std::runtime_error("Could not map accumulation file " + filename);
+        }
+        // Merging reads every file once from front to back
+        ::madvise(data, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const uint8_t *>(data);
+        m_mapped = true;
+    }
+    ::close(fd);
+#else
+    std::ifstream inFile(filename, std::ios::binary);
+    if(!inFile.is_open())
+    {
+        throw std::runtime_error("Could not open accumulation file " + filename);
+    }
+    m_buffer.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#endif
+
+    int32_t filmHeader[4] = {0, 0, 0, 0};
+    uint32_t seedCount = 0;
+    if(m_size >= ACCUMULATION_FIXED_HEADER_SIZE
+       && std::memcmp(m_data, ACCUMULATION_MAGIC, sizeof(ACCUMULATION_MAGIC)) == 0)
+    {
+        std::memcpy(&m_metadataHash, m_data + sizeof(ACCUMULATION_MAGIC), sizeof(m_metadataHash));
+        std::memcpy(&seedCount, m_data + sizeof(ACCUMULATION_MAGIC) + sizeof(m_metadataHash), sizeof(seedCount));
+    }
+    if(seedCount > 0 && seedCount <= m_size / sizeof(uint32_t) && m_size >= headerSize(seedCount) + FILM_HEADER_SIZE)
+    {
+        m_seeds.resize(seedCount);
+        std::memcpy(m_seeds.data(), m_data + ACCUMULATION_FIXED_HEADER_SIZE, seedCount * sizeof(uint32_t));
+        m_headerSize = headerSize(seedCount);
+        std::memcpy(filmHeader, m_data + m_headerSize, sizeof(filmHeader));
+    }
+    m_width = filmHeader[0];
+    m_height = filmHeader[1];
+    m_hasAOVs = filmHeader[2] != 0;
+
+    const size_t pixelSize = FILM_PIXEL_SIZE + (m_hasAOVs ? sizeof(AOVSample) : 0);
+    if(m_width <= 0 || m_height <= 0 || (filmHeader[2] != 0 && filmHeader[2] != 1) || filmHeader[3] != 0
+       || m_size != m_headerSize + FILM_HEADER_SIZE + static_cast<size_t>(this->getPixelCount()) * pixelSize)
+    {
+        this->unmap();
+        throw std::runtime_error(filename + " is not a valid accumulation file");
+    }
+}
+
+//----------------------------------------------------------------------------------
+AccumulationFile::~AccumulationFile()
+{
+    this->unmap();
+}
+
+//----------------------------------------------------------------------------------
+void AccumulationFile::unmap()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if(m_mapped)
+    {
+        ::munmap(const_cast<uint8_t *>(m_data), m_size);
+    }
+#endif
+    m_mapped = false;
+    m_data = nullptr;
+    m_size = 0;
+    m_buffer.clear();
+}
+
+//----------------------------------------------------------------------------------
+const double *AccumulationFile::getLuminanceSums() const
+{
+    return reinterpret_cast<const double *>(m_data + m_headerSize + FILM_HEADER_SIZE);
+}
+
+//----------------------------------------------------------------------------------
+const double *AccumulationFile::getLuminanceSquaredSums() const
+{
+    return this->getLuminanceSums() + this->getPixelCount();
+}
+
+//----------------------------------------------------------------------------------
+const Color3f *AccumulationFile::getRadianceSums() const
+{
+    return reinterpret_cast<const Color3f *>(this->getLuminanceSquaredSums() + this->getPixelCount());
+}
+
+//----------------------------------------------------------------------------------
+const int32_t *AccumulationFile::getSampleCounts() const
+{
+    return reinterpret_cast<const int32_t *>(this->getRadianceSums() + this->getPixelCount());
+}
+
+//----------------------------------------------------------------------------------
+const AOVSample *AccumulationFile::getAOVSums() const
+{
+    return m_hasAOVs ? reinterpret_cast<const AOVSample *>(this->getSampleCounts() + this->getPixelCount()) : nullptr;
+}
+
+//----------------------------------------------------------------------------------
+void AccumulationFile::write(const std::string &filename, const Film &film, const uint64_t metadataHash, const uint32_t seed)
+{
+    std::ofstream outFile(filename, std::ios::binary);
+    if(!outFile.is_open())
+    {
+        throw std::runtime_error("Could not open file " + filename + " for writing");
+    }
+    writeHeader(outFile, metadataHash, std::vector<uint32_t>(1, seed));
+    film.write(outFile);
+    outFile.close();
+    if(!outFile)
+    {
+        throw std::runtime_error("Failed to write accumulation file " + filename);
+    }
+}
+
+//----------------------------------------------------------------------------------
+Image AccumulationFile::merge(const std::vector<std::string> &filenames, const std::string &mergedFilename)
+{
+    if(filenames.empty())
+    {
+        throw std::invalid_argument("No accumulation files to merge");
+    }
+
+    FileList files;
+    bool withAOVs = true;
+    // Files rendered with the same seed hold the same samples, which would be counted twice
+    std::vector<uint32_t> seeds;
+    std::set<uint32_t> mergedSeeds;
+    for(const std::string &filename : filenames)
+    {
+        files.emplace_back(new AccumulationFile(filename));
+        const AccumulationFile &file = *files.back();
+        if(file.getWidth() != files.front()->getWidth() || file.getHeight() != files.front()->getHeight())
+        {
+            throw std::runtime_error(filename + " differs in size from " + filenames.front());
+        }
+        if(file.getMetadataHash() != files.front()->getMetadataHash())
+        {
+            throw std::runtime_error(filename + " was rendered with another scene or camera than " + filenames.front());
+        }
+        for(const uint32_t seed : file.getSeeds())
+        {
+            if(!mergedSeeds.insert(seed).second)
+            {
+                throw std::runtime_error(filename + " repeats the samples of seed " + std::to_string(seed)
+                                         + " of another file, every file needs its own seed");
+            }
+            seeds.push_back(seed);
+        }
+        withAOVs = withAOVs && file.hasAOVs();
+    }
+
+    const int width = files.front()->getWidth();
+    const int height = files.front()->getHeight();
+    const int pixelCount = width * height;
+
+    // The merged film is streamed to its file in the layout of Film::write(), after the seeds
+    // of all files
+    std::ofstream merged;
+    if(!mergedFilename.empty())
+    {
+        merged.open(mergedFilename, std::ios::binary);
+        if(!merged.is_open())
+        {
+            throw std::runtime_error("Could not open file " + mergedFilename + " for writing");
+        }
+        const uint64_t metadataHash = files.front()->getMetadataHash();
+        const int32_t filmHeader[4] = {width, height, withAOVs ? 1 : 0, 0};
+        writeHeader(merged, metadataHash, seeds);
+        merged.write(reinterpret_cast<const char *>(filmHeader), sizeof(filmHeader));
+    }
+    const auto writeChunk = [&merged](const void *data, const size_t size)
+    {
+        if(merged.is_open())
+        {
+            merged.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+        }
+    };
+
+    sumArray<double>(files, pixelCount, [](const AccumulationFile &file) { return file.getLuminanceSums(); },
+                     [&](int, const double *sums, int count) { writeChunk(sums, count * sizeof(double)); });
+    sumArray<double>(files, pixelCount, [](const AccumulationFile &file) { return file.getLuminanceSquaredSums(); },
+                     [&](int, const double *sums, int count) { writeChunk(sums, count * sizeof(double)); });
+
+    // The image holds the radiance sums until the counts are known
+    Image image(width, height);
+    sumArray<Color3f>(files, pixelCount, [](const AccumulationFile &file) { return file.getRadianceSums(); },
+                      [&](int begin, const Color3f *sums, int count)
+    {
+        writeChunk(sums, count * sizeof(Color3f));
+        for(int i = 0; i < count; ++i)
+        {
+            image.setPixel(begin + i, sums[i]);
+        }
+    });
+    sumArray<int32_t>(files, pixelCount, [](const AccumulationFile &file) { return file.getSampleCounts(); },
+                      [&](int begin, const int32_t *sums, int count)
+    {
+        writeChunk(sums, count * sizeof(int32_t));
+        for(int i = 0; i < count; ++i)
+        {
+            const Color3f &sum = image.getPixel(begin + i);
+            image.setPixel(begin + i, sums[i] > 0 ? sum / static_cast<float>(sums[i]) : Color3f(0.0f));
+        }
+    });
+
+    if(merged.is_open() && withAOVs)
+    {
+        // The object id of a pixel is that of its first sample, i.e. of the first file with samples
+        std::vector<AOVSample> sums(MERGE_CHUNK_PIXELS);
+        std::vector<uint8_t> sampled(MERGE_CHUNK_PIXELS);
+        for(int begin = 0; begin < pixelCount; begin += MERGE_CHUNK_PIXELS)
+        {
+            const int count = std::min(MERGE_CHUNK_PIXELS, pixelCount - begin);
+            std::fill(sums.begin(), sums.begin() + count, AOVSample{Color3f(0.0f), glm::vec3(0.0f), 0.0f, -1, Color3f(0.0f)});
+            std::fill(sampled.begin(), sampled.begin() + count, 0);
+            for(const auto &file : files)
+            {
+                const AOVSample *values = file->getAOVSums() + begin;
+                const int32_t *sampleCounts = file->getSampleCounts() + begin;
+                for(int i = 0; i < count; ++i)
+                {
+                    if(!sampled[i] && sampleCounts[i] > 0)
+                    {
+                        sums[i].objectId = values[i].objectId;
+                        sampled[i] = 1;
+                    }
+                    sums[i].albedo += values[i].albedo;
+                    sums[i].normal += values[i].normal;
+                    sums[i].depth += values[i].depth;
+                    sums[i].direct += values[i].direct;
+                }
+            }
+            writeChunk(sums.data(), count * sizeof(AOVSample));
+        }
+    }
+
+    if(merged.is_open())
+    {
+        merged.close();
+        if(!merged)
+        {
+            throw std::runtime_error("Failed to write accumulation file " + mergedFilename);
+        }
+    }
+    return image;
+}
+} // namespace raytracer
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Film.h"
+#include "Image.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace raytracer
+{
+/// @class AccumulationFile
+/// @brief A film saved to be merged with the films of other processes rendering the same scene.
+///
+/// The file holds a magic number, a hash of the scene and camera and the seeds the samples were
+/// taken with, followed by the film as written by Film::write(). Processes rendering with
+/// different seeds take independent samples, so adding up the sums and counts of their films
+/// gives the film of one render with all their samples. A merged file keeps the seeds of all its
+/// inputs, so merging it again with one of them is rejected instead of counting samples twice.
+/// Files are mapped into memory read-only and merged chunk by chunk, so merging many large
+/// files touches every page once and keeps little more than the output image in memory.
+class AccumulationFile
+{
+public:
+    /// @brief Constructor, maps a file for reading
+    /// @param filename the name of the file
+    /// @throw std::runtime_error if the file cannot be read or is not an accumulation file
+    explicit AccumulationFile(const std::string &filename);
+
+    /// @brief Destructor, unmaps the file
+    ~AccumulationFile();
+
+    AccumulationFile(const AccumulationFile &) = delete;
+    AccumulationFile &operator=(const AccumulationFile &) = delete;
+
+    /// @brief Write a film to an accumulation file
+    /// @param filename the name of the file
+    /// @param film the film
+    /// @param metadataHash identifies the scene and camera the film was rendered with
+    /// @param seed the seed of the sample patterns the film was rendered with
+    /// @throw std::runtime_error if the file cannot be written
+    static void write(const std::string &filename, const Film &film, const uint64_t metadataHash, const uint32_t seed);
+
+    /// @brief Merge accumulation files of the same scene and camera
+    /// @param filenames the names of the files
+    /// @param mergedFilename the name of an accumulation file the merged film is written to,
+    ///        which can be merged again, empty for none. It keeps the AOVs only if every
+    ///        file has them.
+    /// @return the average radiance of every pixel over the samples of all files
+    /// @throw std::invalid_argument if no files are given
+    /// @throw std::runtime_error if a file cannot be read or written, if the files differ
+    ///        in size or metadata hash, or if two files were rendered with the same seed
+    static Image merge(const std::vector<std::string> &filenames, const std::string &mergedFilename = std::string());
+
+    /// @brief Get the hash of the scene and camera the film was rendered with
+    uint64_t getMetadataHash() const { return m_metadataHash; }
+
+    /// @brief Get the seeds the samples were taken with, several for a merged file
+    const std::vector<uint32_t> &getSeeds() const { return m_seeds; }
+
+    /// @brief Get the width in pixels
+    int getWidth() const { return m_width; }
+
+    /// @brief Get the height in pixels
+    int getHeight() const { return m_height; }
+
+    /// @brief Get the number of pixels
+    int getPixelCount() const { return m_width * m_height; }
+
+    /// @brief Whether the film has the sums of the auxiliary values
+    bool hasAOVs() const { return m_hasAOVs; }
+
+    //@{
+    /// @brief Get the arrays of the film in pixel order, as stored in the mapped file
+    const double *getLuminanceSums() const;
+    const double *getLuminanceSquaredSums() const;
+    const Color3f *getRadianceSums() const;
+    const int32_t *getSampleCounts() const;
+    const AOVSample *getAOVSums() const;
+    //@}
+
+private:
+    void unmap();
+
+    const uint8_t *m_data;
+    size_t m_size;
+    bool m_mapped;
+    std::vector<uint8_t> m_buffer;  ///< the file contents where it cannot be mapped
+    uint64_t m_metadataHash;
+    std::vector<uint32_t> m_seeds;
+    size_t m_headerSize;            ///< bytes before the film
+    int m_width;
+    int m_height;
+    bool m_hasAOVs;
+};
+} // namespace raytracer
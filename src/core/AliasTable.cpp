@@ -0,0 +1,86 @@
+#include "AliasTable.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+namespace raytracer
+{
+//----------------------------------------------------------------------------------
+AliasTable::AliasTable(const std::vector<float> &weights)
+    : m_pmf(weights.size())
+    , m_keepProbability(weights.size(), 1.0f)
+    , m_alias(weights.size())
+{
+    if(std::any_of(weights.begin(), weights.end(), [](const float w) { return w < 0.0f; }))
+    {
+        throw std::invalid_argument("Alias table weights must not be negative");
+    }
+
+    const size_t n = weights.size();
+    const double sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        m_pmf[i] = sum > 0.0 ? static_cast<float>(weights[i] / sum) : 1.0f / n;
+        m_alias[i] = static_cast<int>(i);
+    }
+
+    // Split the buckets by whether their scaled probability under- or overfills them
+    std::vector<double> scaled(n);
+    std::vector<int> small;
+    std::vector<int> large;
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        scaled[i] = static_cast<double>(m_pmf[i]) * n;
+        (scaled[i] < 1.0 ? small : large).push_back(static_cast<int>(i));
+    }
+
+    // Fill every underfull bucket with the excess of an overfull one
+    while(!small.empty() && !large.empty())
+    {
+        const int s = small.back();
+        small.pop_back();
+        const int l = large.back();
+
+        m_keepProbability[s] = static_cast<float>(scaled[s]);
+        m_alias[s] = l;
+
+        scaled[l] -= 1.0 - scaled[s];
+        if(scaled[l] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Whatever remains is full up to rounding error
+    for(const int i : small)
+    {
+        m_keepProbability[i] = 1.0f;
+    }
+    for(const int i : large)
+    {
+        m_keepProbability[i] = 1.0f;
+    }
+}
+
+//----------------------------------------------------------------------------------
+int AliasTable::sample(const float u) const
+{
+    if(m_pmf.empty())
+    {
+        return -1;
+    }
+
+    // The integer part of u * n picks the bucket, the fraction decides index or alias
+    const int n = static_cast<int>(m_pmf.size());
+    const float scaled = u * n;
+    const int bucket = std::min(static_cast<int>(scaled), n - 1);
+    const float remainder = scaled - bucket;
+
+    return remainder < m_keepProbability[bucket] ? bucket : m_alias[bucket];
+}
+
+} // namespace raytracer
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+
+namespace raytracer
+{
+/// @class AliasTable
+/// @brief Samples an index from a discrete distribution in constant time.
+///
+/// Every bucket of the table holds the probability of keeping its own index and the alias
+/// index used otherwise (Vose's alias method). Drawing a sample picks a bucket uniformly and
+/// then decides between the bucket's index and its alias, so the cost does not depend on the
+/// number of entries.
+class AliasTable
+{
+public:
+    /// @brief Default constructor, creates an empty table
+    AliasTable() = default;
+
+    /// @brief Build the table for the given weights
+    /// @param weights non-negative weights, normalized by the table. If they sum to zero
+    ///        every index is equally likely.
+    /// @throw std::invalid_argument if a weight is negative
+    explicit AliasTable(const std::vector<float> &weights);
+
+    /// @brief Sample an index
+    /// @param u a uniformly distributed number in [0,1)
+    /// @return the sampled index, -1 if the table is empty
+    int sample(const float u) const;
+
+    /// @brief Get the probability of sampling an index
+    /// @param index the index
+    /// @return the probability of the index
+    float pmf(const int index) const { return m_pmf[index]; }
+
+    /// @brief Get the number of entries
+    int size() const { return static_cast<int>(m_pmf.size()); }
+
+    /// @brief Check if the table has no entries
+    bool empty() const { return m_pmf.empty(); }
+
+private:
+    std::vector<float> m_pmf;
+    std::vector<float> m_keepProbability;
+    std::vector<int> m_alias;
+};
+} // namespace raytracer
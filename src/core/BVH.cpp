@@ -1,198 +1,1586 @@
 #include "BVH.h"
 #include "AABB.h"
+#include "ThreadPool.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace raytracer
 {
-/// @class BVHNode
-/// @brief A class to represent a node in the BVH tree.
-///
-/// The BVH node contains a left and right child node, and a bounding box
-/// that encompasses all the objects in the node.
-class BVHNode : public Hittable
+namespace
+{
+/// Number of buckets used per axis when evaluating the surface area heuristic
+const int NUM_SAH_BUCKETS = 16;
+/// Maximum number of primitives a leaf may hold when the SAH prefers a leaf
+const size_t MAX_PRIMITIVES_IN_LEAF = 4;
+/// Cost of traversing an interior node relative to intersecting a primitive
+const float SAH_TRAVERSAL_COST = 0.5f;
+/// Maximum depth of the tree, which bounds the size of the traversal stack
+const int BVH_MAX_DEPTH = 64;
+/// Number of children of a wide BVH node
+const int WIDE_BVH_WIDTH = 4;
+/// Subtrees with at least this many primitives may be built in their own thread
+const size_t PARALLEL_SUBTREE_MIN_PRIMITIVES = 4096;
+/// Nodes with at least this many primitives are binned and partitioned in parallel
+const size_t PARALLEL_NODE_MIN_PRIMITIVES = 65536;
+/// Scenes with more primitives than this use 63-bit instead of 30-bit Morton codes
+const size_t MORTON_64_MIN_PRIMITIVES = 1 << 20;
+/// Refit trees whose SAH cost grew by more than this factor since the build are rebuilt
+const float REFIT_REBUILD_COST_RATIO = 1.5f;
+
+/// @struct BVHPrimitiveInfo
+/// @brief Cached world space bounds and centroid of a scene object used during the build
+struct BVHPrimitiveInfo
 {
-public:
-    BVHNode(std::vector<std::shared_ptr<Hittable>> &objects) 
-        : BVHNode(objects, 0, objects.size()) {}
-        
-    BVHNode(std::vector<std::shared_ptr<Hittable>> &objects, size_t start, size_t end) 
+    BVHPrimitiveInfo() : index(0), centroid(0.0f) {}
+
+    BVHPrimitiveInfo(size_t primitiveIndex, const AxisAlignedBoundingBox &primitiveBounds)
+        : index(primitiveIndex)
+        , bounds(primitiveBounds)
+        , centroid(0.5f * (primitiveBounds.pMin() + primitiveBounds.pMax()))
     {
-        size_t objectSpan = end - start;
+    }
 
-        // Compute bounds of all primitives in this node
-        AxisAlignedBoundingBox bounds;
-        for(size_t i = start; i < end; i++)
+    size_t index;
+    AxisAlignedBoundingBox bounds;
+    glm::vec3 centroid;
+};
+
+/// @struct SAHBucket
+/// @brief Primitive count and bounds of the primitives whose centroids fall in a bucket
+struct SAHBucket
+{
+    int count = 0;
+    AxisAlignedBoundingBox bounds;
+};
+
+/// @struct BVHBuildSettings
+/// @brief Options shared by every recursive call of a single build
+struct BVHBuildSettings
+{
+    BVH::SplitMethod splitMethod;
+    int threadCount;        ///< number of threads used for parallel loops
+    int maxParallelDepth;   ///< subtrees above this depth are built in their own thread
+};
+
+/// @struct NodeBinning
+/// @brief Bounds of a node and the SAH buckets of its primitives along each axis
+struct NodeBinning
+{
+    AxisAlignedBoundingBox bounds;
+    AxisAlignedBoundingBox centroidBounds;
+    SAHBucket buckets[3][NUM_SAH_BUCKETS];
+};
+
+/// @struct BVHBuildNode
+/// @brief Temporary pointer based node used while building the tree before it is flattened
+struct BVHBuildNode
+{
+    /// @brief Initialize the node as a leaf over primitives [offset, offset+count)
+    void initLeaf(size_t offset, size_t count, const AxisAlignedBoundingBox &nodeBounds)
+    {
+        firstPrimitiveOffset = offset;
+        primitiveCount = count;
+        bounds = nodeBounds;
+    }
+
+    /// @brief Initialize the node as an interior node with two children
+    void initInterior(int axis, std::unique_ptr<BVHBuildNode> c0, std::unique_ptr<BVHBuildNode> c1)
+    {
+        bounds = AxisAlignedBoundingBox::combine(c0->bounds, c1->bounds);
+        children[0] = std::move(c0);
+        children[1] = std::move(c1);
+        splitAxis = axis;
+        primitiveCount = 0;
+    }
+
+    AxisAlignedBoundingBox bounds;
+    std::unique_ptr<BVHBuildNode> children[2];
+    int splitAxis = 0;
+    size_t firstPrimitiveOffset = 0;
+    size_t primitiveCount = 0;
+};
+
+//----------------------------------------------------------------------------------
+// Map a centroid coordinate to its SAH bucket.
+inline int bucketIndex(const float centroid, const float cMin, const float scale)
+{
+    const int b = static_cast<int>((centroid - cMin) * scale);
+    return b < NUM_SAH_BUCKETS ? b : NUM_SAH_BUCKETS - 1;
+}
+
+//----------------------------------------------------------------------------------
+// Compute the bounds of primitiveInfo[start,end). When binBuckets is set the primitives are
+// also binned along every axis of the given centroid bounds.
+void binRange(const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+              size_t start,
+              size_t end,
+              bool binBuckets,
+              NodeBinning &binning)
+{
+    float cMin[3];
+    float scale[3];
+
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        cMin[axis] = binning.centroidBounds.pMin()[axis];
+        const float extent = binning.centroidBounds.pMax()[axis] - cMin[axis];
+        scale[axis] = extent > 0.0f ? NUM_SAH_BUCKETS / extent : 0.0f;
+    }
+
+    NodeBinning local;
+
+    for(size_t i = start; i < end; ++i)
+    {
+        const BVHPrimitiveInfo &info = primitiveInfo[i];
+
+        if(binBuckets)
+        {
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                SAHBucket &bucket = local.buckets[axis][bucketIndex(info.centroid[axis], cMin[axis], scale[axis])];
+                bucket.count++;
+                bucket.bounds = AxisAlignedBoundingBox::combine(bucket.bounds, info.bounds);
+            }
+        }
+        else
+        {
+            local.bounds = AxisAlignedBoundingBox::combine(local.bounds, info.bounds);
+            local.centroidBounds = AxisAlignedBoundingBox::combine(local.centroidBounds, info.centroid);
+        }
+    }
+
+    if(binBuckets)
+    {
+        std::copy(&local.buckets[0][0], &local.buckets[0][0] + 3 * NUM_SAH_BUCKETS, &binning.buckets[0][0]);
+    }
+    else
+    {
+        binning.bounds = local.bounds;
+        binning.centroidBounds = local.centroidBounds;
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Compute the node bounds of primitiveInfo[start,end), or when binBuckets is set its SAH
+// buckets, which needs the centroid bounds of an earlier call. Large nodes are processed in
+// parallel chunks that are merged in chunk order. Counts add and bounds combine exactly, so
+// the result does not depend on the number of chunks. Nodes too small to split into chunks
+// are binned in place without the per-chunk copies.
+void binNode(const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+             size_t start,
+             size_t end,
+             bool binBuckets,
+             const BVHBuildSettings &settings,
+             NodeBinning &binning)
+{
+    const size_t minChunkSize = PARALLEL_NODE_MIN_PRIMITIVES / 4;
+    if(settings.threadCount <= 1 || (end - start) / minChunkSize <= 1)
+    {
+        binRange(primitiveInfo, start, end, binBuckets, binning);
+        return;
+    }
+
+    std::vector<NodeBinning> partial(settings.threadCount, binning);
+
+    const int chunks = ThreadPool::global().parallelFor(end - start, minChunkSize, settings.threadCount,
+                                                        [&](size_t chunkStart, size_t chunkEnd, int chunk)
+                                                        {
+                                                            binRange(primitiveInfo, start + chunkStart, start + chunkEnd, binBuckets, partial[chunk]);
+                                                        });
+
+    for(int c = 0; c < chunks; ++c)
+    {
+        if(binBuckets)
+        {
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                for(int b = 0; b < NUM_SAH_BUCKETS; ++b)
+                {
+                    SAHBucket &bucket = binning.buckets[axis][b];
+                    bucket.count += partial[c].buckets[axis][b].count;
+                    bucket.bounds = AxisAlignedBoundingBox::combine(bucket.bounds, partial[c].buckets[axis][b].bounds);
+                }
+            }
+        }
+        else
+        {
+            binning.bounds = AxisAlignedBoundingBox::combine(binning.bounds, partial[c].bounds);
+            binning.centroidBounds = AxisAlignedBoundingBox::combine(binning.centroidBounds, partial[c].centroidBounds);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Partition [start,end) at the median centroid along the given axis.
+size_t partitionEqualCounts(std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                            size_t start,
+                            size_t end,
+                            const int axis)
+{
+    size_t mid = (start + end) / 2;
+    std::nth_element(primitiveInfo.begin() + start, primitiveInfo.begin() + mid, primitiveInfo.begin() + end,
+                     [axis](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b)
+                     {
+                         return a.centroid[axis] < b.centroid[axis];
+                     });
+    return mid;
+}
+
+//----------------------------------------------------------------------------------
+// Partition [start,end) so the primitives in buckets up to and including splitBucket come
+// first. Large ranges use a parallel stable partition: each chunk counts its left side, the
+// counts are prefix summed and every chunk scatters into its slots of a scratch buffer. The
+// stable order makes the result independent of the number of chunks.
+size_t partitionSAH(std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                    size_t start,
+                    size_t end,
+                    const int axis,
+                    const int splitBucket,
+                    const AxisAlignedBoundingBox &centroidBounds,
+                    const BVHBuildSettings &settings)
+{
+    const float cMin = centroidBounds.pMin()[axis];
+    const float scale = NUM_SAH_BUCKETS / (centroidBounds.pMax()[axis] - cMin);
+    auto isLeft = [=](const BVHPrimitiveInfo &info)
+    {
+        return bucketIndex(info.centroid[axis], cMin, scale) <= splitBucket;
+    };
+
+    if(end - start < PARALLEL_NODE_MIN_PRIMITIVES)
+    {
+        auto midIter = std::partition(primitiveInfo.begin() + start, primitiveInfo.begin() + end, isLeft);
+        return static_cast<size_t>(midIter - primitiveInfo.begin());
+    }
+
+    const size_t count = end - start;
+    std::vector<size_t> chunkBegin(settings.threadCount + 1, 0);
+    std::vector<size_t> leftCount(settings.threadCount, 0);
+
+    const int chunks = ThreadPool::global().parallelFor(count, PARALLEL_NODE_MIN_PRIMITIVES / 4, settings.threadCount,
+                                                        [&](size_t chunkStart, size_t chunkEnd, int chunk)
+                                                        {
+                                                            chunkBegin[chunk] = chunkStart;
+                                                            leftCount[chunk] = std::count_if(primitiveInfo.begin() + start + chunkStart,
+                                                                                             primitiveInfo.begin() + start + chunkEnd, isLeft);
+                                                        });
+    chunkBegin[chunks] = count;
+
+    std::vector<size_t> leftOffset(chunks);
+    std::vector<size_t> rightOffset(chunks);
+    size_t totalLeft = 0;
+    for(int c = 0; c < chunks; ++c)
+    {
+        leftOffset[c] = totalLeft;
+        totalLeft += leftCount[c];
+    }
+    for(int c = 0; c < chunks; ++c)
+    {
+        rightOffset[c] = totalLeft + (chunkBegin[c] - leftOffset[c]);
+    }
+
+    std::vector<BVHPrimitiveInfo> scratch(primitiveInfo.begin() + start, primitiveInfo.begin() + end);
+
+    ThreadPool::global().parallelFor(count, PARALLEL_NODE_MIN_PRIMITIVES / 4, settings.threadCount,
+                                     [&](size_t chunkStart, size_t chunkEnd, int chunk)
+                                     {
+                                         size_t l = start + leftOffset[chunk];
+                                         size_t r = start + rightOffset[chunk];
+
+                                         for(size_t i = chunkStart; i < chunkEnd; ++i)
+                                         {
+                                             primitiveInfo[isLeft(scratch[i]) ? l++ : r++] = scratch[i];
+                                         }
+                                     });
+
+    return start + totalLeft;
+}
+
+//----------------------------------------------------------------------------------
+// Find the cheapest bucket boundary over all three axes using the binned surface area
+// heuristic. Returns false if a leaf is cheaper than any split.
+bool findSAHSplit(const NodeBinning &binning,
+                  size_t primitiveCount,
+                  int &splitAxis,
+                  int &splitBucket)
+{
+    const float invBoundsArea = 1.0f / binning.bounds.surfaceArea();
+    float minCost = std::numeric_limits<float>::max();
+
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        if(binning.centroidBounds.pMax()[axis] <= binning.centroidBounds.pMin()[axis])
         {
-            bounds = AxisAlignedBoundingBox::combine(bounds, objects[i]->getBounds());
+            continue;
         }
-        m_bounds = bounds;
 
-        if(objectSpan == 1)
+        const SAHBucket *buckets = binning.buckets[axis];
+
+        // Sweep from the right to accumulate the area and count above each boundary
+        float rightArea[NUM_SAH_BUCKETS - 1];
+        int rightCount[NUM_SAH_BUCKETS - 1];
+        AxisAlignedBoundingBox rightBounds;
+        int count = 0;
+
+        for(int b = NUM_SAH_BUCKETS - 1; b > 0; --b)
         {
-            m_left = m_right = objects[start];
+            rightBounds = AxisAlignedBoundingBox::combine(rightBounds, buckets[b].bounds);
+            count += buckets[b].count;
+            rightArea[b - 1] = rightBounds.surfaceArea();
+            rightCount[b - 1] = count;
         }
-        else if(objectSpan == 2)
+
+        // Sweep from the left and evaluate the cost of splitting after each bucket
+        AxisAlignedBoundingBox leftBounds;
+        count = 0;
+
+        for(int b = 0; b < NUM_SAH_BUCKETS - 1; ++b)
         {
-            if(objects[start]->getBounds().pMin()[bounds.maxExtent()] < objects[start + 1]->getBounds().pMin()[bounds.maxExtent()])
+            leftBounds = AxisAlignedBoundingBox::combine(leftBounds, buckets[b].bounds);
+            count += buckets[b].count;
+
+            if(count == 0 || rightCount[b] == 0)
             {
-                m_left = objects[start];
-                m_right = objects[start + 1];
+                continue;
             }
-            else
+
+            const float cost = SAH_TRAVERSAL_COST +
+                               (count * leftBounds.surfaceArea() + rightCount[b] * rightArea[b]) * invBoundsArea;
+
+            if(cost < minCost)
+            {
+                minCost = cost;
+                splitAxis = axis;
+                splitBucket = b;
+            }
+        }
+    }
+
+    if(minCost == std::numeric_limits<float>::max())
+    {
+        // All centroids coincide so no split can separate them
+        return false;
+    }
+
+    const float leafCost = static_cast<float>(primitiveCount);
+    return !(primitiveCount <= MAX_PRIMITIVES_IN_LEAF && minCost >= leafCost);
+}
+
+//----------------------------------------------------------------------------------
+// Recursively build the subtree over primitiveInfo[start,end). Leaves refer to the range of
+// primitiveInfo they cover, so the primitive order is fixed once the build completes. The
+// two subtrees of the upper levels are built concurrently; since every split depends only on
+// the primitives of its node the tree is the same for any number of threads.
+std::unique_ptr<BVHBuildNode> buildRecursive(std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                                             size_t start,
+                                             size_t end,
+                                             int depth,
+                                             const BVHBuildSettings &settings,
+                                             int &totalNodes)
+{
+    std::unique_ptr<BVHBuildNode> node(new BVHBuildNode());
+    totalNodes++;
+    const size_t objectSpan = end - start;
+
+    // Compute bounds of all primitives in this node
+    NodeBinning binning;
+    binNode(primitiveInfo, start, end, false, settings, binning);
+    const AxisAlignedBoundingBox &bounds = binning.bounds;
+    const AxisAlignedBoundingBox &centroidBounds = binning.centroidBounds;
+
+    // Leaves must fit in the node's primitive count and the traversal stack bounds the depth
+    const bool canBeLeaf = objectSpan <= std::numeric_limits<uint16_t>::max();
+
+    if(objectSpan == 1 || (canBeLeaf && depth >= BVH_MAX_DEPTH))
+    {
+        node->initLeaf(start, objectSpan, bounds);
+        return node;
+    }
+
+    size_t mid = start;
+    int axis = bounds.maxExtent();
+
+    if(settings.splitMethod == BVH::SplitMethod::SAH)
+    {
+        int splitBucket = 0;
+        binNode(primitiveInfo, start, end, true, settings, binning);
+
+        if(!findSAHSplit(binning, objectSpan, axis, splitBucket))
+        {
+            if(canBeLeaf && (objectSpan <= MAX_PRIMITIVES_IN_LEAF || centroidBounds.diagonal() == glm::vec3(0.0f)))
             {
-                m_left = objects[start + 1];
-                m_right = objects[start];
+                node->initLeaf(start, objectSpan, bounds);
+                return node;
             }
+
+            // A split is forced because the node is too large for a leaf
+            axis = bounds.maxExtent();
+            mid = partitionEqualCounts(primitiveInfo, start, end, axis);
         }
         else
         {
-            // Sort the primitives along the longest axis of the centroid
-            std::sort(objects.begin() + start, objects.begin() + end, [bounds](const std::shared_ptr<Hittable> &a, const std::shared_ptr<Hittable> &b)
-                      {
-                            return a->center()[bounds.maxExtent()] < b->center()[bounds.maxExtent()];
-                      });
+            mid = partitionSAH(primitiveInfo, start, end, axis, splitBucket, centroidBounds, settings);
+        }
+    }
+    else
+    {
+        mid = partitionEqualCounts(primitiveInfo, start, end, axis);
+    }
+
+    // Recursively build the left and right subtrees
+    std::unique_ptr<BVHBuildNode> left;
+    std::unique_ptr<BVHBuildNode> right;
+    int leftNodes = 0;
+    int rightNodes = 0;
+
+    if(depth < settings.maxParallelDepth && objectSpan >= PARALLEL_SUBTREE_MIN_PRIMITIVES)
+    {
+        ThreadPool::TaskGroup group(ThreadPool::global());
+        group.run([&]()
+        {
+            left = buildRecursive(primitiveInfo, start, mid, depth + 1, settings, leftNodes);
+        });
+        right = buildRecursive(primitiveInfo, mid, end, depth + 1, settings, rightNodes);
+        group.wait();
+    }
+    else
+    {
+        left = buildRecursive(primitiveInfo, start, mid, depth + 1, settings, leftNodes);
+        right = buildRecursive(primitiveInfo, mid, end, depth + 1, settings, rightNodes);
+    }
+
+    totalNodes += leftNodes + rightNodes;
+    node->initInterior(axis, std::move(left), std::move(right));
+
+    return node;
+}
+
+//----------------------------------------------------------------------------------
+// Spread the lowest 10 bits of x so there are two zero bits between each of them.
+inline uint32_t leftShift3(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+//----------------------------------------------------------------------------------
+// Spread the lowest 21 bits of x so there are two zero bits between each of them.
+inline uint64_t leftShift3(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x001f00000000ffffull;
+    x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+    x = (x | (x << 8)) & 0x100f00f00f00f00full;
+    x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+    x = (x | (x << 2)) & 0x1249249249249249ull;
+    return x;
+}
+
+/// @struct MortonPrimitive
+/// @brief Morton code of a primitive centroid and the index of the primitive it belongs to
+template<typename CodeType>
+struct MortonPrimitive
+{
+    CodeType code;
+    uint32_t primitiveIndex;
+};
+
+//----------------------------------------------------------------------------------
+// Sort the primitives by Morton code with a least significant digit radix sort. Every pass
+// histograms the chunks in parallel and scatters them in chunk order, which keeps the sort
+// stable and its result independent of the number of chunks.
+template<typename CodeType>
+void radixSort(std::vector<MortonPrimitive<CodeType>> &mortonPrimitives, const int codeBits, const int threadCount)
+{
+    const int BITS_PER_PASS = 8;
+    const int NUM_BUCKETS = 1 << BITS_PER_PASS;
+    const int numPasses = (codeBits + BITS_PER_PASS - 1) / BITS_PER_PASS;
+    const size_t count = mortonPrimitives.size();
+
+    std::vector<MortonPrimitive<CodeType>> scratch(count);
+    std::vector<std::vector<size_t>> bucketOffsets(threadCount, std::vector<size_t>(NUM_BUCKETS));
+
+    for(int pass = 0; pass < numPasses; ++pass)
+    {
+        const int lowBit = pass * BITS_PER_PASS;
+        auto digit = [lowBit](const MortonPrimitive<CodeType> &mp)
+        {
+            return static_cast<int>((mp.code >> lowBit) & (NUM_BUCKETS - 1));
+        };
+
+        const int chunks = ThreadPool::global().parallelFor(count, PARALLEL_SUBTREE_MIN_PRIMITIVES, threadCount,
+                                                            [&](size_t chunkStart, size_t chunkEnd, int chunk)
+                                                            {
+                                                                std::vector<size_t> &counts = bucketOffsets[chunk];
+                                                                std::fill(counts.begin(), counts.end(), 0);
+                                                                for(size_t i = chunkStart; i < chunkEnd; ++i)
+                                                                {
+                                                                    counts[digit(mortonPrimitives[i])]++;
+                                                                }
+                                                            });
 
-            // Recursively build the left and right subtrees
-            size_t mid = (start + end) / 2;
-            m_left = std::make_shared<BVHNode>(objects, start, mid);
-            m_right = std::make_shared<BVHNode>(objects, mid, end);
+        // Turn the per chunk counts into output offsets, buckets first and chunks second
+        size_t offset = 0;
+        for(int b = 0; b < NUM_BUCKETS; ++b)
+        {
+            for(int c = 0; c < chunks; ++c)
+            {
+                const size_t bucketCount = bucketOffsets[c][b];
+                bucketOffsets[c][b] = offset;
+                offset += bucketCount;
+            }
         }
+
+        ThreadPool::global().parallelFor(count, PARALLEL_SUBTREE_MIN_PRIMITIVES, threadCount,
+                                         [&](size_t chunkStart, size_t chunkEnd, int chunk)
+                                         {
+                                             std::vector<size_t> &offsets = bucketOffsets[chunk];
+                                             for(size_t i = chunkStart; i < chunkEnd; ++i)
+                                             {
+                                                 scratch[offsets[digit(mortonPrimitives[i])]++] = mortonPrimitives[i];
+                                             }
+                                         });
+
+        mortonPrimitives.swap(scratch);
     }
+}
 
-    ~BVHNode() = default;
+//----------------------------------------------------------------------------------
+// Emit the subtree over the Morton ordered primitiveInfo[start,end). All codes in the range
+// agree above bitIndex, so each level splits the range where the highest remaining bit
+// changes, found by binary search.
+template<typename CodeType>
+std::unique_ptr<BVHBuildNode> emitLBVH(const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                                       const std::vector<CodeType> &codes,
+                                       size_t start,
+                                       size_t end,
+                                       int bitIndex,
+                                       int depth,
+                                       const BVHBuildSettings &settings,
+                                       int &totalNodes)
+{
+    std::unique_ptr<BVHBuildNode> node(new BVHBuildNode());
+    totalNodes++;
+    const size_t objectSpan = end - start;
+    const bool canBeLeaf = objectSpan <= std::numeric_limits<uint16_t>::max();
 
-    //----------------------------------------------------------------------------------
-    AxisAlignedBoundingBox getBounds() const override
+    // Skip the bits all codes in the range share
+    while(bitIndex >= 0)
     {
-        return m_bounds;
+        const CodeType mask = CodeType(1) << bitIndex;
+        if((codes[start] & mask) != (codes[end - 1] & mask))
+        {
+            break;
+        }
+        --bitIndex;
     }
 
-    //----------------------------------------------------------------------------------
-    bool hit(const Ray &ray, HitRecord &record) const override
+    if(objectSpan <= MAX_PRIMITIVES_IN_LEAF || (canBeLeaf && (bitIndex < 0 || depth >= BVH_MAX_DEPTH)))
     {
-        if(!m_bounds.intersect(ray))
+        AxisAlignedBoundingBox bounds;
+        for(size_t i = start; i < end; ++i)
         {
-            return false;
+            bounds = AxisAlignedBoundingBox::combine(bounds, primitiveInfo[i].bounds);
         }
+        node->initLeaf(start, objectSpan, bounds);
+        return node;
+    }
+
+    size_t mid = (start + end) / 2;
+    int axis = 0;
+
+    if(bitIndex >= 0)
+    {
+        // The codes interleave x, y and z starting with x in the lowest bit
+        const CodeType mask = CodeType(1) << bitIndex;
+        mid = std::partition_point(codes.begin() + start, codes.begin() + end,
+                                   [mask](const CodeType code)
+                                   {
+                                       return (code & mask) == 0;
+                                   }) - codes.begin();
+        axis = bitIndex % 3;
+        --bitIndex;
+    }
+
+    std::unique_ptr<BVHBuildNode> left;
+    std::unique_ptr<BVHBuildNode> right;
+    int leftNodes = 0;
+    int rightNodes = 0;
+
+    if(depth < settings.maxParallelDepth && objectSpan >= PARALLEL_SUBTREE_MIN_PRIMITIVES)
+    {
+        ThreadPool::TaskGroup group(ThreadPool::global());
+        group.run([&]()
+        {
+            left = emitLBVH(primitiveInfo, codes, start, mid, bitIndex, depth + 1, settings, leftNodes);
+        });
+        right = emitLBVH(primitiveInfo, codes, mid, end, bitIndex, depth + 1, settings, rightNodes);
+        group.wait();
+    }
+    else
+    {
+        left = emitLBVH(primitiveInfo, codes, start, mid, bitIndex, depth + 1, settings, leftNodes);
+        right = emitLBVH(primitiveInfo, codes, mid, end, bitIndex, depth + 1, settings, rightNodes);
+    }
+
+    totalNodes += leftNodes + rightNodes;
+    node->initInterior(axis, std::move(left), std::move(right));
+
+    return node;
+}
+
+//----------------------------------------------------------------------------------
+// Build a linear BVH: quantize the centroids to a grid over their bounds, sort them along
+// the Morton curve and emit the hierarchy from the bits of the sorted codes. primitiveInfo is
+// reordered along the curve.
+template<typename CodeType>
+std::unique_ptr<BVHBuildNode> buildLBVH(std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                                        const int bitsPerAxis,
+                                        const BVHBuildSettings &settings,
+                                        int &totalNodes)
+{
+    const size_t count = primitiveInfo.size();
 
-        const bool hitLeft = m_left->hit(ray, record);
+    NodeBinning binning;
+    binNode(primitiveInfo, 0, count, false, settings, binning);
+    const glm::vec3 cMin = binning.centroidBounds.pMin();
+    const glm::vec3 extent = binning.centroidBounds.pMax() - cMin;
+    const float gridSize = static_cast<float>(1u << bitsPerAxis);
+
+    std::vector<MortonPrimitive<CodeType>> mortonPrimitives(count);
+    ThreadPool::global().parallelFor(count, PARALLEL_SUBTREE_MIN_PRIMITIVES, settings.threadCount,
+                                     [&](size_t chunkStart, size_t chunkEnd, int)
+                                     {
+                                         for(size_t i = chunkStart; i < chunkEnd; ++i)
+                                         {
+                                             CodeType code = 0;
+                                             for(int axis = 0; axis < 3; ++axis)
+                                             {
+                                                 const float offset = extent[axis] > 0.0f ? (primitiveInfo[i].centroid[axis] - cMin[axis]) / extent[axis] : 0.0f;
+                                                 const float cell = std::min(offset * gridSize, gridSize - 1.0f);
+                                                 code |= leftShift3(static_cast<CodeType>(cell)) << axis;
+                                             }
+                                             mortonPrimitives[i].code = code;
+                                             mortonPrimitives[i].primitiveIndex = static_cast<uint32_t>(i);
+                                         }
+                                     });
+
+    radixSort(mortonPrimitives, 3 * bitsPerAxis, settings.threadCount);
+
+    std::vector<BVHPrimitiveInfo> sortedInfo(count);
+    std::vector<CodeType> codes(count);
+    ThreadPool::global().parallelFor(count, PARALLEL_SUBTREE_MIN_PRIMITIVES, settings.threadCount,
+                                     [&](size_t chunkStart, size_t chunkEnd, int)
+                                     {
+                                         for(size_t i = chunkStart; i < chunkEnd; ++i)
+                                         {
+                                             sortedInfo[i] = primitiveInfo[mortonPrimitives[i].primitiveIndex];
+                                             codes[i] = mortonPrimitives[i].code;
+                                         }
+                                     });
+    primitiveInfo.swap(sortedInfo);
+
+    return emitLBVH(primitiveInfo, codes, 0, count, 3 * bitsPerAxis - 1, 0, settings, totalNodes);
+}
+
+//----------------------------------------------------------------------------------
+// Write the subtree into the linear node array in depth-first order. The first child of an
+// interior node immediately follows its parent so only the second child offset is stored.
+int flattenTree(const BVHBuildNode *node, std::vector<LinearBVHNode> &nodes)
+{
+    const int offset = static_cast<int>(nodes.size());
+    nodes.emplace_back();
 
-        // Create narrowed ray for right child if left child was hit
-        Ray rightRay = hitLeft ? Ray(ray.origin(), ray.direction(), ray.tMin(), record.t)
-                               : ray;
-        const bool hitRight = m_right->hit(rightRay, record);
+    LinearBVHNode linearNode;
+    linearNode.pMin = node->bounds.pMin();
+    linearNode.pMax = node->bounds.pMax();
 
-        return hitLeft || hitRight;
+    if(node->primitiveCount > 0)
+    {
+        linearNode.primitivesOffset = static_cast<int>(node->firstPrimitiveOffset);
+        linearNode.primitiveCount = static_cast<uint16_t>(node->primitiveCount);
+    }
+    else
+    {
+        linearNode.axis = static_cast<uint8_t>(node->splitAxis);
+        linearNode.primitiveCount = 0;
+        flattenTree(node->children[0].get(), nodes);
+        linearNode.secondChildOffset = flattenTree(node->children[1].get(), nodes);
     }
 
-    //----------------------------------------------------------------------------------
-    glm::vec3 center() const override
+    nodes[offset] = linearNode;
+    return offset;
+}
+
+//----------------------------------------------------------------------------------
+// Slab test against a flattened node using the precomputed reciprocal ray direction.
+inline bool intersectNode(const LinearBVHNode &node,
+                          const glm::vec3 &origin,
+                          const glm::vec3 &invDir,
+                          const float tMin,
+                          const float tMax)
+{
+    const glm::vec3 tLower = (node.pMin - origin) * invDir;
+    const glm::vec3 tUpper = (node.pMax - origin) * invDir;
+    const glm::vec3 tNear = glm::min(tLower, tUpper);
+    const glm::vec3 tFar = glm::max(tLower, tUpper);
+
+    const float tBoxMin = glm::max(glm::max(glm::max(tNear.x, tNear.y), tNear.z), tMin);
+    const float tBoxMax = glm::min(glm::min(glm::min(tFar.x, tFar.y), tFar.z), tMax);
+
+    return tBoxMin <= tBoxMax;
+}
+
+//----------------------------------------------------------------------------------
+// Conservative slab test of a whole packet against a node using interval arithmetic over the
+// packet's origins and inverse directions. Returns false only if every ray misses the node.
+// Requires the inverse directions of each axis to share their sign.
+inline bool intersectPacketBounds(const LinearBVHNode &node,
+                                  const float originMin[3],
+                                  const float originMax[3],
+                                  const float invDirMin[3],
+                                  const float invDirMax[3],
+                                  const float tMin,
+                                  const float tMax)
+{
+    float tEnter = tMin;
+    float tExit = tMax;
+
+    for(int axis = 0; axis < 3; ++axis)
     {
-        return 0.5f * (m_bounds.pMin() + m_bounds.pMax());
+        // Distances to each plane span the products of the two interval endpoints
+        const float lower[4] = { (node.pMin[axis] - originMin[axis]) * invDirMin[axis],
+                                 (node.pMin[axis] - originMin[axis]) * invDirMax[axis],
+                                 (node.pMin[axis] - originMax[axis]) * invDirMin[axis],
+                                 (node.pMin[axis] - originMax[axis]) * invDirMax[axis] };
+        const float upper[4] = { (node.pMax[axis] - originMin[axis]) * invDirMin[axis],
+                                 (node.pMax[axis] - originMin[axis]) * invDirMax[axis],
+                                 (node.pMax[axis] - originMax[axis]) * invDirMin[axis],
+                                 (node.pMax[axis] - originMax[axis]) * invDirMax[axis] };
+
+        const float lowerMin = std::min(std::min(lower[0], lower[1]), std::min(lower[2], lower[3]));
+        const float lowerMax = std::max(std::max(lower[0], lower[1]), std::max(lower[2], lower[3]));
+        const float upperMin = std::min(std::min(upper[0], upper[1]), std::min(upper[2], upper[3]));
+        const float upperMax = std::max(std::max(upper[0], upper[1]), std::max(upper[2], upper[3]));
+
+        // The near plane depends on the shared direction sign
+        const bool negative = invDirMin[axis] < 0.0f;
+        tEnter = std::max(tEnter, negative ? upperMin : lowerMin);
+        tExit = std::min(tExit, negative ? lowerMax : upperMax);
     }
 
-    /// @brief left child node
-    std::shared_ptr<Hittable> m_left;
-    /// @brief right child node
-    std::shared_ptr<Hittable> m_right;
-    /// @brief bounds of the node
-    AxisAlignedBoundingBox m_bounds;
+    return tEnter <= tExit;
+}
+
+/// @struct WideStackEntry
+/// @brief A wide node waiting to be visited and the distance at which the ray enters it
+struct WideStackEntry
+{
+    int node;
+    float tNear;
 };
 
 //----------------------------------------------------------------------------------
-BVH::BVH() : m_root(nullptr) {}
+// Slab test of a ray against the four children of a wide node. The near and far planes are
+// selected per axis from the sign of the ray direction, so no min/max swap is needed.
+// Returns a bit mask of the children that are hit and their entry distances.
+inline int intersectWideNode(const WideBVHNode &node,
+                             const float origin[3],
+                             const float invDir[3],
+                             const int nearPlane[3],
+                             const float tMin,
+                             const float tMax,
+                             float tNear[WIDE_BVH_WIDTH])
+{
+#if defined(__SSE2__)
+    __m128 tEnter = _mm_set1_ps(tMin);
+    __m128 tExit = _mm_set1_ps(tMax);
+
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        const __m128 o = _mm_set1_ps(origin[axis]);
+        const __m128 id = _mm_set1_ps(invDir[axis]);
+        const __m128 tNearPlane = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearPlane[axis]]), o), id);
+        const __m128 tFarPlane = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[(nearPlane[axis] + 3) % 6]), o), id);
+        tEnter = _mm_max_ps(tEnter, tNearPlane);
+        tExit = _mm_min_ps(tExit, tFarPlane);
+    }
+
+    _mm_storeu_ps(tNear, tEnter);
+    return _mm_movemask_ps(_mm_cmple_ps(tEnter, tExit));
+#else
+    int mask = 0;
+
+    for(int i = 0; i < WIDE_BVH_WIDTH; ++i)
+    {
+        float tEnter = tMin;
+        float tExit = tMax;
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            tEnter = std::max(tEnter, (node.bounds[nearPlane[axis]][i] - origin[axis]) * invDir[axis]);
+            tExit = std::min(tExit, (node.bounds[(nearPlane[axis] + 3) % 6][i] - origin[axis]) * invDir[axis]);
+        }
+
+        tNear[i] = tEnter;
+        mask |= (tEnter <= tExit) ? (1 << i) : 0;
+    }
+
+    return mask;
+#endif
+}
+} // namespace
+
+//----------------------------------------------------------------------------------
+BVH::BVH() : m_splitMethod(SplitMethod::SAH), m_nodeLayout(NodeLayout::Binary), m_buildSAHCost(0.0f) {}
 
 BVH::~BVH() {}
 
 //----------------------------------------------------------------------------------
-void BVH::build()
+void BVH::build(SplitMethod splitMethod, NodeLayout nodeLayout)
 {
+    m_splitMethod = splitMethod;
+    m_nodeLayout = nodeLayout;
+    m_nodes.clear();
+    m_wideNodes.clear();
+    m_orderedPrimitives.clear();
+    m_orderedPrimitiveIds.clear();
+
+    this->buildLightSampling();
+
     if(m_sceneObjects.empty())
     {
         return;
     }
 
-    std::clog << "Building BVH..." << std::endl;
-    m_root.reset(new BVHNode(m_sceneObjects));
+    std::clog << "Building BVH..." << std::flush;
+    const auto startTime = std::chrono::steady_clock::now();
+
+    // Subtrees are handed to new threads until there are a few per hardware thread
+    BVHBuildSettings settings;
+    settings.splitMethod = splitMethod;
+    settings.threadCount = ThreadPool::global().getThreadCount();
+    settings.maxParallelDepth = static_cast<int>(std::ceil(std::log2(settings.threadCount))) + 2;
+
+    std::vector<BVHPrimitiveInfo> primitiveInfo(m_sceneObjects.size());
+    ThreadPool::global().parallelFor(m_sceneObjects.size(), PARALLEL_SUBTREE_MIN_PRIMITIVES, settings.threadCount,
+                                     [&](size_t chunkStart, size_t chunkEnd, int)
+                                     {
+                                         for(size_t i = chunkStart; i < chunkEnd; ++i)
+                                         {
+                                             primitiveInfo[i] = BVHPrimitiveInfo(i, m_sceneObjects[i]->getBounds());
+                                         }
+                                     });
+
+    int totalNodes = 0;
+    std::unique_ptr<BVHBuildNode> root;
+
+    if(splitMethod == SplitMethod::Morton)
+    {
+        // 10 bits per axis are too coarse to separate millions of primitives
+        root = primitiveInfo.size() > MORTON_64_MIN_PRIMITIVES ?
+               buildLBVH<uint64_t>(primitiveInfo, 21, settings, totalNodes) :
+               buildLBVH<uint32_t>(primitiveInfo, 10, settings, totalNodes);
+    }
+    else
+    {
+        root = buildRecursive(primitiveInfo, 0, primitiveInfo.size(), 0, settings, totalNodes);
+    }
+
+    // Leaves index into the primitives in the order the build left them
+    m_orderedPrimitives.reserve(primitiveInfo.size());
+    m_orderedPrimitiveIds.reserve(primitiveInfo.size());
+    for(const auto &info : primitiveInfo)
+    {
+        m_orderedPrimitives.push_back(m_sceneObjects[info.index]);
+        m_orderedPrimitiveIds.push_back(static_cast<int>(info.index));
+    }
+
+    m_nodes.reserve(totalNodes);
+    flattenTree(root.get(), m_nodes);
+
+    if(m_nodeLayout == NodeLayout::Wide4)
+    {
+        this->collapseToWide();
+    }
+
+    m_buildSAHCost = this->computeSAHCost();
+
+    const std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - startTime;
+    std::clog << " done in " << buildTime.count() << " ms using " << settings.threadCount << " thread(s), "
+              << totalNodes << " nodes" << std::endl;
 
     // Print world bounds
-    auto worldBounds = m_root->m_bounds;
+    auto worldBounds = root->bounds;
     std::clog << "World Bounds" << std::endl;
     std::clog << "pMin: [" << worldBounds.pMin()[0] << " , " << worldBounds.pMin()[1] << " , " << worldBounds.pMin()[2] << "]\n"
                  "pMax: [" << worldBounds.pMax()[0] << " , " << worldBounds.pMax()[1] << " , " << worldBounds.pMax()[2] << "]\n";
 }
 
+//----------------------------------------------------------------------------------
+void BVH::buildLightSampling()
+{
+    // Collect the emitters once so light sampling never has to scan the scene
+    m_lights.clear();
+    std::vector<float> lightPowers;
+    for(const auto &object : m_sceneObjects)
+    {
+        if(object->isLight())
+        {
+            m_lights.push_back(object);
+            lightPowers.push_back(object->getPower());
+        }
+    }
+    m_lightTable = AliasTable(lightPowers);
+    m_lightTree.build(m_lights);
+}
+
+//----------------------------------------------------------------------------------
+bool BVH::refit()
+{
+    if(m_nodes.empty() || m_orderedPrimitives.size() != m_sceneObjects.size())
+    {
+        this->build(m_splitMethod, m_nodeLayout);
+        return false;
+    }
+
+    const auto startTime = std::chrono::steady_clock::now();
+    const int threadCount = ThreadPool::global().getThreadCount();
+
+    // Leaves are independent, so their bounds are recomputed in parallel
+    ThreadPool::global().parallelFor(m_nodes.size(), PARALLEL_SUBTREE_MIN_PRIMITIVES, threadCount,
+                                     [&](size_t chunkStart, size_t chunkEnd, int)
+                                     {
+                                         for(size_t i = chunkStart; i < chunkEnd; ++i)
+                                         {
+                                             LinearBVHNode &node = m_nodes[i];
+                                             if(node.primitiveCount == 0)
+                                             {
+                                                 continue;
+                                             }
+
+                                             AxisAlignedBoundingBox bounds;
+                                             for(int p = 0; p < node.primitiveCount; ++p)
+                                             {
+                                                 bounds = AxisAlignedBoundingBox::combine(bounds, m_orderedPrimitives[node.primitivesOffset + p]->getBounds());
+                                             }
+                                             node.pMin = bounds.pMin();
+                                             node.pMax = bounds.pMax();
+                                         }
+                                     });
+
+    // Children are stored after their parent, so a reverse sweep visits them first
+    for(size_t i = m_nodes.size(); i-- > 0;)
+    {
+        LinearBVHNode &node = m_nodes[i];
+        if(node.primitiveCount == 0)
+        {
+            const LinearBVHNode &first = m_nodes[i + 1];
+            const LinearBVHNode &second = m_nodes[node.secondChildOffset];
+            node.pMin = glm::min(first.pMin, second.pMin);
+            node.pMax = glm::max(first.pMax, second.pMax);
+        }
+    }
+
+    const float refitSAHCost = this->computeSAHCost();
+    if(refitSAHCost > REFIT_REBUILD_COST_RATIO * m_buildSAHCost)
+    {
+        std::clog << "BVH refit cost " << refitSAHCost << " exceeds build cost " << m_buildSAHCost
+                  << ", rebuilding" << std::endl;
+        this->build(m_splitMethod, m_nodeLayout);
+        return false;
+    }
+
+    if(m_nodeLayout == NodeLayout::Wide4)
+    {
+        this->collapseToWide();
+    }
+
+    // Moved lights change the bounds, orientation cones and power the light sampling uses
+    this->buildLightSampling();
+
+    const std::chrono::duration<double, std::milli> refitTime = std::chrono::steady_clock::now() - startTime;
+    std::clog << "Refit BVH in " << refitTime.count() << " ms" << std::endl;
+
+    return true;
+}
+
+//----------------------------------------------------------------------------------
+float BVH::computeSAHCost() const
+{
+    auto surfaceArea = [](const LinearBVHNode &node)
+    {
+        const glm::vec3 d = node.pMax - node.pMin;
+        return d.x * d.y + d.x * d.z + d.y * d.z;
+    };
+
+    // Expected cost of tracing a random ray that hits the root
+    double cost = 0.0;
+    for(const LinearBVHNode &node : m_nodes)
+    {
+        cost += surfaceArea(node) * (node.primitiveCount > 0 ? node.primitiveCount : SAH_TRAVERSAL_COST);
+    }
+
+    const float rootArea = surfaceArea(m_nodes[0]);
+    return rootArea > 0.0f ? static_cast<float>(cost / rootArea) : 0.0f;
+}
+
 //----------------------------------------------------------------------------------
 AxisAlignedBoundingBox BVH::getBounds() const
 {
-    return m_root ? m_root->m_bounds : AxisAlignedBoundingBox();
+    return m_nodes.empty() ? AxisAlignedBoundingBox() : AxisAlignedBoundingBox(m_nodes[0].pMin, m_nodes[0].pMax);
 }
 
 //----------------------------------------------------------------------------------
 glm::vec3 BVH::center() const
 {
-    return m_root ? m_root->center() : glm::vec3(0);
+    return m_nodes.empty() ? glm::vec3(0) : 0.5f * (m_nodes[0].pMin + m_nodes[0].pMax);
+}
+
+//----------------------------------------------------------------------------------
+void BVH::collapseToWide()
+{
+    m_wideNodes.clear();
+    m_wideNodes.reserve(m_nodes.size() / 2 + 1);
+
+    auto surfaceArea = [](const LinearBVHNode &node)
+    {
+        const glm::vec3 d = node.pMax - node.pMin;
+        return d.x * d.y + d.x * d.z + d.y * d.z;
+    };
+
+    // Collapse the binary subtree rooted at the given node into a wide node by repeatedly
+    // opening the interior child with the largest surface area until four children remain.
+    std::function<int(int)> collapse = [&](int binaryIndex) -> int
+    {
+        int candidates[WIDE_BVH_WIDTH];
+        int candidateCount = 0;
+
+        if(m_nodes[binaryIndex].primitiveCount > 0)
+        {
+            candidates[candidateCount++] = binaryIndex;
+        }
+        else
+        {
+            candidates[candidateCount++] = binaryIndex + 1;
+            candidates[candidateCount++] = m_nodes[binaryIndex].secondChildOffset;
+        }
+
+        while(candidateCount < WIDE_BVH_WIDTH)
+        {
+            int largest = -1;
+            float largestArea = -1.0f;
+
+            for(int i = 0; i < candidateCount; ++i)
+            {
+                const LinearBVHNode &candidate = m_nodes[candidates[i]];
+                if(candidate.primitiveCount == 0 && surfaceArea(candidate) > largestArea)
+                {
+                    largest = i;
+                    largestArea = surfaceArea(candidate);
+                }
+            }
+
+            if(largest < 0)
+            {
+                break;
+            }
+
+            const int opened = candidates[largest];
+            candidates[largest] = opened + 1;
+            candidates[candidateCount++] = m_nodes[opened].secondChildOffset;
+        }
+
+        const int wideIndex = static_cast<int>(m_wideNodes.size());
+        m_wideNodes.emplace_back();
+
+        WideBVHNode wideNode;
+        for(int i = 0; i < WIDE_BVH_WIDTH; ++i)
+        {
+            // Empty slots get inverted bounds so they are never hit
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                wideNode.bounds[axis][i] = std::numeric_limits<float>::max();
+                wideNode.bounds[axis + 3][i] = std::numeric_limits<float>::lowest();
+            }
+            wideNode.children[i] = -1;
+            wideNode.primitiveCount[i] = 0;
+        }
+
+        for(int i = 0; i < candidateCount; ++i)
+        {
+            const LinearBVHNode &child = m_nodes[candidates[i]];
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                wideNode.bounds[axis][i] = child.pMin[axis];
+                wideNode.bounds[axis + 3][i] = child.pMax[axis];
+            }
+
+            if(child.primitiveCount > 0)
+            {
+                wideNode.children[i] = child.primitivesOffset;
+                wideNode.primitiveCount[i] = child.primitiveCount;
+            }
+            else
+            {
+                wideNode.children[i] = collapse(candidates[i]);
+            }
+        }
+
+        m_wideNodes[wideIndex] = wideNode;
+        return wideIndex;
+    };
+
+    collapse(0);
 }
 
 //----------------------------------------------------------------------------------
 bool BVH::hit(const Ray& ray, HitRecord& record) const
 {
-    if(!m_root)
+    if(m_nodes.empty())
     {
         return false;
     }
 
-    return m_root->hit(ray, record);
+    if(m_nodeLayout == NodeLayout::Wide4)
+    {
+        return this->hitWide(ray, record);
+    }
+
+    return this->hitBinary(ray, record);
 }
 
 //----------------------------------------------------------------------------------
-bool BVH::randomPointOnLight(glm::vec3 &point) const
+bool BVH::occluded(const Ray &ray) const
 {
-    if(m_sceneObjects.empty())
+    if(m_nodes.empty())
     {
-        // throw std::runtime_error("No objects in the scene.");
         return false;
     }
 
-    // Find all light sources in the scene
-    std::vector<std::shared_ptr<Hittable>> lights;
-    for(const auto &obj : m_sceneObjects)
+    if(m_nodeLayout == NodeLayout::Wide4)
+    {
+        return this->occludedWide(ray);
+    }
+
+    return this->occludedBinary(ray);
+}
+
+//----------------------------------------------------------------------------------
+bool BVH::hitWide(const Ray &ray, HitRecord &record) const
+{
+    // The ray is narrowed after every hit so only closer primitives are reported
+    Ray closestRay = ray;
+    const glm::vec3 direction = ray.direction();
+    const float origin[3] = { ray.origin().x, ray.origin().y, ray.origin().z };
+    const float invDir[3] = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    const int nearPlane[3] = { invDir[0] < 0.0f ? 3 : 0, invDir[1] < 0.0f ? 4 : 1, invDir[2] < 0.0f ? 5 : 2 };
+
+    bool hitAnything = false;
+    WideStackEntry nodesToVisit[(WIDE_BVH_WIDTH - 1) * BVH_MAX_DEPTH + 1];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = { 0, closestRay.tMin() };
+
+    while(toVisitOffset > 0)
+    {
+        const WideStackEntry entry = nodesToVisit[--toVisitOffset];
+
+        // Skip nodes that lie beyond a hit found after they were pushed
+        if(entry.tNear > closestRay.tMax())
+        {
+            continue;
+        }
+
+        const WideBVHNode &node = m_wideNodes[entry.node];
+        float tNear[WIDE_BVH_WIDTH];
+        int mask = intersectWideNode(node, origin, invDir, nearPlane, closestRay.tMin(), closestRay.tMax(), tNear);
+
+        // Order the children that were hit from near to far
+        int order[WIDE_BVH_WIDTH];
+        int hitCount = 0;
+        for(int i = 0; i < WIDE_BVH_WIDTH; ++i)
+        {
+            if(mask & (1 << i))
+            {
+                int j = hitCount++;
+                while(j > 0 && tNear[order[j - 1]] > tNear[i])
+                {
+                    order[j] = order[j - 1];
+                    --j;
+                }
+                order[j] = i;
+            }
+        }
+
+        // Intersect leaf children first so the narrowed ray can cull interior children
+        for(int k = 0; k < hitCount; ++k)
+        {
+            const int i = order[k];
+            if(node.primitiveCount[i] > 0 && tNear[i] <= closestRay.tMax())
+            {
+                for(int p = 0; p < node.primitiveCount[i]; ++p)
+                {
+                    if(m_orderedPrimitives[node.children[i] + p]->hit(closestRay, record))
+                    {
+                        hitAnything = true;
+                        record.objectId = m_orderedPrimitiveIds[node.children[i] + p];
+                        closestRay.setTMax(record.t);
+                    }
+                }
+            }
+        }
+
+        // Push interior children far to near so the nearest is visited next
+        for(int k = hitCount - 1; k >= 0; --k)
+        {
+            const int i = order[k];
+            if(node.primitiveCount[i] == 0 && node.children[i] >= 0 && tNear[i] <= closestRay.tMax())
+            {
+                nodesToVisit[toVisitOffset++] = { node.children[i], tNear[i] };
+            }
+        }
+    }
+
+    return hitAnything;
+}
+
+//----------------------------------------------------------------------------------
+bool BVH::hitBinary(const Ray &ray, HitRecord &record) const
+{
+
+    // The ray is narrowed after every hit so only closer primitives are reported
+    Ray closestRay = ray;
+    const glm::vec3 origin = ray.origin();
+    const glm::vec3 direction = ray.direction();
+    const glm::vec3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    const bool dirIsNeg[3] = { invDir.x < 0.0f, invDir.y < 0.0f, invDir.z < 0.0f };
+
+    bool hitAnything = false;
+    int nodesToVisit[BVH_MAX_DEPTH];
+    int toVisitOffset = 0;
+    int currentNodeIndex = 0;
+
+    while(true)
     {
-        if(obj->isLight())
+        const LinearBVHNode &node = m_nodes[currentNodeIndex];
+
+        if(intersectNode(node, origin, invDir, closestRay.tMin(), closestRay.tMax()))
         {
-            lights.push_back(obj);
+            if(node.primitiveCount > 0)
+            {
+                for(int i = 0; i < node.primitiveCount; ++i)
+                {
+                    if(m_orderedPrimitives[node.primitivesOffset + i]->hit(closestRay, record))
+                    {
+                        hitAnything = true;
+                        record.objectId = m_orderedPrimitiveIds[node.primitivesOffset + i];
+                        closestRay.setTMax(record.t);
+                    }
+                }
+
+                if(toVisitOffset == 0)
+                {
+                    break;
+                }
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+            else
+            {
+                // Visit the child nearer to the ray origin first
+                if(dirIsNeg[node.axis])
+                {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node.secondChildOffset;
+                }
+                else
+                {
+                    nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        }
+        else
+        {
+            if(toVisitOffset == 0)
+            {
+                break;
+            }
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
 
-    if(lights.empty())
+    return hitAnything;
+}
+
+//----------------------------------------------------------------------------------
+bool BVH::occludedWide(const Ray &ray) const
+{
+    // Any hit ends the query, so children are visited in stored order
+    const glm::vec3 direction = ray.direction();
+    const float origin[3] = { ray.origin().x, ray.origin().y, ray.origin().z };
+    const float invDir[3] = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    const int nearPlane[3] = { invDir[0] < 0.0f ? 3 : 0, invDir[1] < 0.0f ? 4 : 1, invDir[2] < 0.0f ? 5 : 2 };
+
+    int nodesToVisit[(WIDE_BVH_WIDTH - 1) * BVH_MAX_DEPTH + 1];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = 0;
+
+    while(toVisitOffset > 0)
     {
-        // throw std::runtime_error("No light sources found in the scene.");
-        return false;
+        const WideBVHNode &node = m_wideNodes[nodesToVisit[--toVisitOffset]];
+        float tNear[WIDE_BVH_WIDTH];
+        const int mask = intersectWideNode(node, origin, invDir, nearPlane, ray.tMin(), ray.tMax(), tNear);
+
+        for(int i = 0; i < WIDE_BVH_WIDTH; ++i)
+        {
+            if(!(mask & (1 << i)))
+            {
+                continue;
+            }
+
+            if(node.primitiveCount[i] > 0)
+            {
+                for(int p = 0; p < node.primitiveCount[i]; ++p)
+                {
+                    if(m_orderedPrimitives[node.children[i] + p]->occluded(ray))
+                    {
+                        return true;
+                    }
+                }
+            }
+            else if(node.children[i] >= 0)
+            {
+                nodesToVisit[toVisitOffset++] = node.children[i];
+            }
+        }
     }
 
-    // Randomly select a light source and return a random point on it
-    auto light = lights[RaytracingUtility::randomInt(0, lights.size() - 1)];
-    point = light->randomPointOnSurface();
+    return false;
+}
+
+//----------------------------------------------------------------------------------
+bool BVH::occludedBinary(const Ray &ray) const
+{
+    const glm::vec3 origin = ray.origin();
+    const glm::vec3 direction = ray.direction();
+    const glm::vec3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    const bool dirIsNeg[3] = { invDir.x < 0.0f, invDir.y < 0.0f, invDir.z < 0.0f };
 
-    return true;
+    int nodesToVisit[BVH_MAX_DEPTH];
+    int toVisitOffset = 0;
+    int currentNodeIndex = 0;
+
+    while(true)
+    {
+        const LinearBVHNode &node = m_nodes[currentNodeIndex];
+
+        if(intersectNode(node, origin, invDir, ray.tMin(), ray.tMax()))
+        {
+            if(node.primitiveCount > 0)
+            {
+                for(int i = 0; i < node.primitiveCount; ++i)
+                {
+                    if(m_orderedPrimitives[node.primitivesOffset + i]->occluded(ray))
+                    {
+                        return true;
+                    }
+                }
+
+                if(toVisitOffset == 0)
+                {
+                    break;
+                }
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+            else
+            {
+                // Visiting the near child first still tends to find blockers sooner
+                if(dirIsNeg[node.axis])
+                {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node.secondChildOffset;
+                }
+                else
+                {
+                    nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        }
+        else
+        {
+            if(toVisitOffset == 0)
+            {
+                break;
+            }
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+
+    return false;
 }
 
 //----------------------------------------------------------------------------------
-std::vector<std::shared_ptr<Hittable>> BVH::getLightSources() const
+void BVH::hit(RayPacket &packet, HitRecord records[], bool hits[]) const
 {
-    std::vector<std::shared_ptr<Hittable>> lights;
+    const int size = packet.size();
+    for(int i = 0; i < size; ++i)
+    {
+        hits[i] = false;
+    }
+
+    if(m_nodes.empty() || size == 0)
+    {
+        return;
+    }
+
+    // Rays that diverge in direction defeat the interval test, trace them one by one
+    if(!packet.isCoherent())
+    {
+        for(int i = 0; i < size; ++i)
+        {
+            hits[i] = this->hit(packet.ray(i), records[i]);
+        }
+        return;
+    }
+
+    const float (&origins)[3][RayPacket::MAX_SIZE] = packet.origins();
+    const float (&invDirs)[3][RayPacket::MAX_SIZE] = packet.invDirections();
+
+    float originMin[3], originMax[3], invDirMin[3], invDirMax[3];
+    float packetTMin = packet.tMin(0);
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        originMin[axis] = originMax[axis] = origins[axis][0];
+        invDirMin[axis] = invDirMax[axis] = invDirs[axis][0];
+        for(int i = 1; i < size; ++i)
+        {
+            originMin[axis] = std::min(originMin[axis], origins[axis][i]);
+            originMax[axis] = std::max(originMax[axis], origins[axis][i]);
+            invDirMin[axis] = std::min(invDirMin[axis], invDirs[axis][i]);
+            invDirMax[axis] = std::max(invDirMax[axis], invDirs[axis][i]);
+        }
+    }
+    for(int i = 1; i < size; ++i)
+    {
+        packetTMin = std::min(packetTMin, packet.tMin(i));
+    }
+
+    auto packetTMax = [&packet, size]()
+    {
+        float tMax = packet.tMax(0);
+        for(int i = 1; i < size; ++i)
+        {
+            tMax = std::max(tMax, packet.tMax(i));
+        }
+        return tMax;
+    };
+
+    auto rayHitsNode = [&](const LinearBVHNode &node, const int i)
+    {
+        return intersectNode(node,
+                             glm::vec3(origins[0][i], origins[1][i], origins[2][i]),
+                             glm::vec3(invDirs[0][i], invDirs[1][i], invDirs[2][i]),
+                             packet.tMin(i),
+                             packet.tMax(i));
+    };
+
+    const bool dirIsNeg[3] = { invDirMin[0] < 0.0f, invDirMin[1] < 0.0f, invDirMin[2] < 0.0f };
+    float tMax = packetTMax();
+
+    int nodesToVisit[BVH_MAX_DEPTH];
+    int toVisitOffset = 0;
+    int currentNodeIndex = 0;
 
-    for(const auto &obj : m_sceneObjects)
+    while(true)
     {
-        if(obj->isLight())
+        const LinearBVHNode &node = m_nodes[currentNodeIndex];
+        bool visit = intersectPacketBounds(node, originMin, originMax, invDirMin, invDirMax, packetTMin, tMax);
+
+        if(visit && node.primitiveCount > 0)
+        {
+            // Only the rays that reach the leaf are tested against its primitives
+            for(int i = 0; i < size; ++i)
+            {
+                if(!rayHitsNode(node, i))
+                {
+                    continue;
+                }
+
+                for(int p = 0; p < node.primitiveCount; ++p)
+                {
+                    if(m_orderedPrimitives[node.primitivesOffset + p]->hit(packet.ray(i), records[i]))
+                    {
+                        hits[i] = true;
+                        records[i].objectId = m_orderedPrimitiveIds[node.primitivesOffset + p];
+                        packet.setTMax(i, records[i].t);
+                    }
+                }
+            }
+            tMax = packetTMax();
+            visit = false;
+        }
+        else if(visit)
+        {
+            // Descend as soon as any ray of the packet hits the node
+            visit = false;
+            for(int i = 0; i < size && !visit; ++i)
+            {
+                visit = rayHitsNode(node, i);
+            }
+        }
+
+        if(visit)
         {
-            lights.push_back(obj);
+            // All rays share direction signs, so the near child is the same for the packet
+            if(dirIsNeg[node.axis])
+            {
+                nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                currentNodeIndex = node.secondChildOffset;
+            }
+            else
+            {
+                nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+                currentNodeIndex = currentNodeIndex + 1;
+            }
+        }
+        else
+        {
+            if(toVisitOffset == 0)
+            {
+                break;
+            }
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+}
 
-    return lights;
+//----------------------------------------------------------------------------------
+bool BVH::randomPointOnLight(glm::vec3 &point) const
+{
+    if(m_lights.empty())
+    {
+        return false;
+    }
+
+    // Choose a light proportionally to its power and return a random point on it
+    const int index = m_lightTable.sample(RaytracingUtility::randomFloat());
+    point = m_lights[index]->randomPointOnSurface();
+
+    return true;
 }
 
 } // namespace raytracer
\ No newline at end of file
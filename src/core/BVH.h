@@ -2,7 +2,11 @@
 #define INCLUDED_BVH_H
 
 #include "Hittable.h"
+#include "AliasTable.h"
+#include "LightTree.h"
+#include "RayPacket.h"
 
+#include <cstdint>
 #include <vector>
 #include <memory>
 
@@ -10,7 +14,44 @@ namespace raytracer
 {
 class AxisAlignedBoundingBox;
 class Ray;
-class BVHNode;
+
+/// @struct LinearBVHNode
+/// @brief A 32-byte BVH node stored in a flat, depth-first ordered array.
+///
+/// The first child of an interior node is the node that immediately follows it in the array,
+/// so only the offset of the second child is stored. Leaves store the range of primitives
+/// they contain instead.
+struct LinearBVHNode
+{
+    glm::vec3 pMin;
+    glm::vec3 pMax;
+    union
+    {
+        int primitivesOffset;   ///< leaf: index of the first primitive
+        int secondChildOffset;  ///< interior: index of the second child
+    };
+    uint16_t primitiveCount;    ///< 0 for interior nodes
+    uint8_t axis;               ///< interior: axis the primitives were partitioned along
+    uint8_t pad[1];
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode is expected to be 32 bytes");
+
+/// @struct WideBVHNode
+/// @brief A 4-wide BVH node with its child bounds stored in structure-of-arrays layout.
+///
+/// Storing the child bounds per plane lets the traversal test all four children against a
+/// ray at once using SIMD slab tests.
+struct alignas(16) WideBVHNode
+{
+    /// @brief child bounds per plane: min x, min y, min z, max x, max y, max z
+    float bounds[6][4];
+    /// @brief interior child: node index, leaf child: first primitive offset, empty slot: -1
+    int children[4];
+    /// @brief number of primitives of a leaf child, 0 for interior children and empty slots
+    uint16_t primitiveCount[4];
+    uint8_t pad[8];
+};
+static_assert(sizeof(WideBVHNode) == 128, "WideBVHNode is expected to be 128 bytes");
 
 /// @class BVH
 /// @brief Bounding Volume Hierarchy
@@ -21,11 +62,37 @@ class BVHNode;
 /// in the nodes beneath it. Thus, as a ray traverses through the tree, any time it doesn't
 /// intersect a node's bounds, the subtree beneath that node can be skipped.
 ///
-/// This implementation uses equal counts to partition primitives into equally sized subsets
-/// when building the tree.
+/// The tree can be built either by partitioning primitives into equally sized subsets, by
+/// using the surface area heuristic (SAH) evaluated over a fixed number of buckets per axis, or
+/// by sorting the primitives along a Morton curve (LBVH). The LBVH builds in linear time at
+/// the cost of tree quality and is meant for scenes with millions of primitives.
+/// After the build the tree is flattened into a compact array of nodes that is traversed
+/// without recursion using a small fixed-size stack. Optionally the binary tree is collapsed
+/// into 4-wide nodes whose children are tested against the ray simultaneously.
+///
+/// The upper levels of the tree are built concurrently, with large nodes binned and
+/// partitioned in parallel. The resulting tree does not depend on the number of threads.
+///
+/// When objects move between frames the tree can be refit in linear time instead of being
+/// rebuilt. Refitting keeps the topology, so the tree is rebuilt once its quality degrades.
 class BVH : public Hittable
 {
 public:
+    /// @brief Algorithm used to partition the primitives when building the tree
+    enum class SplitMethod
+    {
+        EqualCounts,    ///< split at the median centroid along the longest axis
+        SAH,            ///< binned surface area heuristic with a leaf-cost cutoff
+        Morton          ///< linear BVH emitted from radix sorted Morton codes of the centroids
+    };
+
+    /// @brief Node layout used when traversing the tree
+    enum class NodeLayout
+    {
+        Binary,         ///< two children per node
+        Wide4           ///< binary tree collapsed into four children per node with SIMD box tests
+    };
+
     /// @brief Default constructor
     // BVH(const std::vector<std::shared_ptr<Hittable>>);
     BVH();
@@ -34,7 +101,17 @@ public:
     ~BVH();
 
     /// @brief Build the BVH tree
-    void build();
+    /// @param splitMethod the algorithm used to partition the primitives
+    /// @param nodeLayout the node layout used for traversal
+    void build(SplitMethod splitMethod = SplitMethod::SAH, NodeLayout nodeLayout = NodeLayout::Binary);
+
+    /// @brief Recompute the node bounds bottom-up after scene objects were transformed, keeping
+    ///        the tree topology, and rebuild the light tree and light table from the moved
+    ///        lights. Falls back to a full build if objects were added or removed since the
+    ///        last build, or if the SAH cost of the refit tree exceeds that of the built tree
+    ///        by too much.
+    /// @return true if the tree was refit, false if it was rebuilt
+    bool refit();
 
     /// @brief add a hittable object to the list.
     void add(std::shared_ptr<Hittable> object) { m_sceneObjects.push_back(object); }
@@ -48,6 +125,19 @@ public:
     /// @see Hittable::hit
     bool hit(const Ray& ray, HitRecord& record) const override;
 
+    /// @brief Find the closest hit of every ray in a packet with a single traversal of the
+    ///        binary tree. Nodes are culled for the whole packet with a conservative interval
+    ///        test; packets whose direction signs differ are traced ray by ray.
+    /// @param packet the rays to trace, their tMax is narrowed to the closest hit
+    /// @param records receives the hit record of each ray that hits
+    /// @param hits receives whether each ray hit anything
+    void hit(RayPacket &packet, HitRecord records[], bool hits[]) const;
+
+    /// @brief Determines if anything blocks the ray within [tMin, tMax]. Traversal stops at the
+    ///        first hit and no hit record is filled, which makes it the query for shadow rays.
+    /// @see Hittable::occluded
+    bool occluded(const Ray &ray) const override;
+
     /// @see Hittable::center
     virtual glm::vec3 center() const override;
 
@@ -56,17 +146,44 @@ public:
     /// @return true if a point was found, false otherwise
     bool randomPointOnLight(glm::vec3 &point) const;
 
-    /// @brief Get the light sources in the scene
+    /// @brief Get the light sources in the scene, collected when the tree is built
     /// @return a vector of shared pointers to the light sources in the scene
-    std::vector<std::shared_ptr<Hittable>> getLightSources() const;
+    const std::vector<std::shared_ptr<Hittable>>& getLightSources() const { return m_lights; }
+
+    /// @brief Get the table for choosing a light source proportionally to its emitted power
+    /// @return the alias table over the entries of getLightSources()
+    const AliasTable& getLightTable() const { return m_lightTable; }
+
+    /// @brief Get the hierarchy for choosing a light source by its contribution at a point
+    /// @return the light tree over the entries of getLightSources()
+    const LightTree& getLightTree() const { return m_lightTree; }
 
     /// @brief Get all scene objects
     /// @return a vector of shared pointers to all objects in the scene
     const std::vector<std::shared_ptr<Hittable>>& getSceneObjects() const { return m_sceneObjects; }
 
 private:
-    std::unique_ptr<BVHNode> m_root;
+    /// @brief Collect the lights and build the structures that sample them
+    void buildLightSampling();
+
+    bool hitBinary(const Ray &ray, HitRecord &record) const;
+    bool hitWide(const Ray &ray, HitRecord &record) const;
+    bool occludedBinary(const Ray &ray) const;
+    bool occludedWide(const Ray &ray) const;
+    void collapseToWide();
+    float computeSAHCost() const;
+
+    SplitMethod m_splitMethod;
+    NodeLayout m_nodeLayout;
+    float m_buildSAHCost;
+    std::vector<LinearBVHNode> m_nodes;
+    std::vector<WideBVHNode> m_wideNodes;
+    std::vector<std::shared_ptr<Hittable>> m_orderedPrimitives;
+    std::vector<int> m_orderedPrimitiveIds;     ///< index in m_sceneObjects of every ordered primitive
     std::vector<std::shared_ptr<Hittable>> m_sceneObjects;
+    std::vector<std::shared_ptr<Hittable>> m_lights;
+    AliasTable m_lightTable;
+    LightTree m_lightTree;
 };
 } // namespace raytracer
 
@@ -0,0 +1,101 @@
+#include "Checkpoint.h"
+
+#include <cstdio> // std::rename, std::remove
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace raytracer
+{
+namespace
+{
+/// Identifies checkpoint files and the version of their layout
+const char CHECKPOINT_MAGIC[8] = {'R', 'T', 'C', 'K', 'P', 'T', '0', '2'};
+/// Suffix of the temporary file a checkpoint is written to before it replaces the previous one
+const char *const CHECKPOINT_TEMP_SUFFIX = ".tmp";
+
+/// @struct CheckpointHeader
+/// @brief The fields of a checkpoint file before its film
+struct CheckpointHeader
+{
+    char magic[8];
+    int32_t samplerType;
+    uint32_t seed;
+    int32_t samplerSampleCount;
+    int32_t nextSample;
+};
+} // namespace
+
+//----------------------------------------------------------------------------------
+void Checkpoint::write(const std::string &filename, const Film &film) const
+{
+    CheckpointHeader header;
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.samplerType = static_cast<int32_t>(samplerType);
+    header.seed = seed;
+    header.samplerSampleCount = samplerSampleCount;
+    header.nextSample = nextSample;
+
+    const std::string tempFilename = filename + CHECKPOINT_TEMP_SUFFIX;
+    {
+        std::ofstream outFile(tempFilename, std::ios::binary);
+        if(!outFile.is_open())
+        {
+            throw std::runtime_error("Could not open file " + tempFilename + " for writing");
+        }
+        outFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        film.write(outFile);
+        outFile.close();
+        if(!outFile)
+        {
+            std::remove(tempFilename.c_str());
+            throw std::runtime_error("Failed to write checkpoint to " + tempFilename);
+        }
+    }
+
+    // Renaming replaces the previous checkpoint in one step
+    if(std::rename(tempFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(tempFilename.c_str());
+        throw std::runtime_error("Failed to replace checkpoint " + filename);
+    }
+}
+
+//----------------------------------------------------------------------------------
+Checkpoint Checkpoint::read(const std::string &filename, Film &film)
+{
+    std::ifstream inFile(filename, std::ios::binary);
+    if(!inFile.is_open())
+    {
+        throw std::runtime_error("Could not open checkpoint " + filename);
+    }
+
+    CheckpointHeader header;
+    inFile.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if(!inFile || std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0)
+    {
+        throw std::runtime_error(filename + " is not a checkpoint");
+    }
+    if(header.samplerType < static_cast<int32_t>(Sampler::Type::Independent)
+       || header.samplerType > static_cast<int32_t>(Sampler::Type::Halton)
+       || header.samplerSampleCount <= 0 || header.nextSample < 0)
+    {
+        throw std::runtime_error("Invalid checkpoint " + filename);
+    }
+
+    film = Film::read(inFile);
+
+    Checkpoint checkpoint;
+    checkpoint.samplerType = static_cast<Sampler::Type>(header.samplerType);
+    checkpoint.seed = header.seed;
+    checkpoint.samplerSampleCount = header.samplerSampleCount;
+    checkpoint.nextSample = header.nextSample;
+    return checkpoint;
+}
+
+//----------------------------------------------------------------------------------
+bool Checkpoint::exists(const std::string &filename)
+{
+    return std::ifstream(filename, std::ios::binary).is_open();
+}
+} // namespace raytracer
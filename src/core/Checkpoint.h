@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Film.h"
+#include "Sampler.h"
+
+#include <cstdint>
+#include <string>
+
+namespace raytracer
+{
+/// @struct Checkpoint
+/// @brief The progress of a render, from which it can be resumed or continued with more
+///        samples.
+///
+/// A checkpoint file holds the film with the sums and counts of all pixels and the state of
+/// the sample generator. Samplers derive every value from the pixel, the sample index, the
+/// dimension and their seed, so their type, seed and sample count together with the index of
+/// the next sample describe it completely: a resumed render takes exactly the samples it would
+/// have taken without the interruption.
+struct Checkpoint
+{
+    Sampler::Type samplerType;  ///< algorithm of the sampler
+    uint32_t seed;              ///< seed of the sampler, the frame index
+    int samplerSampleCount;     ///< samples per pixel the sampler was created for
+    int nextSample;             ///< index of the next sample of every pixel
+
+    /// @brief Write the checkpoint to a file atomically: it is written to a temporary file next
+    ///        to it first, which then replaces the file, so an interruption leaves the previous
+    ///        checkpoint intact.
+    /// @param filename the name of the file
+    /// @param film the samples taken so far
+    /// @throw std::runtime_error if the file cannot be written
+    void write(const std::string &filename, const Film &film) const;
+
+    /// @brief Read a checkpoint written by write()
+    /// @param filename the name of the file
+    /// @param[out] film the samples taken so far
+    /// @return the checkpoint
+    /// @throw std::runtime_error if the file cannot be read or is not a checkpoint
+    static Checkpoint read(const std::string &filename, Film &film);
+
+    /// @brief Check whether a file exists and can be opened for reading
+    static bool exists(const std::string &filename);
+};
+} // namespace raytracer
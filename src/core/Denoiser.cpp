@@ -0,0 +1,213 @@
+#include "Denoiser.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+
+namespace raytracer
+{
+namespace
+{
+/// Width and height in pixels of the tiles filtered in parallel
+const int DENOISE_TILE_SIZE = 32;
+/// Weights of the 5-tap B-spline kernel by distance from its center
+const float KERNEL_WEIGHTS[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+/// Weights of the 3x3 Gaussian that smooths the variance used for edge stopping
+const float VARIANCE_KERNEL_WEIGHTS[2] = {1.0f / 4.0f, 1.0f / 8.0f};
+/// Albedo below which a channel is not divided out, it would only amplify noise
+const float DEMODULATION_MIN_ALBEDO = 0.01f;
+/// Smallest standard deviation of the luminance, keeps noise-free pixels from dividing by zero
+const float MIN_LUMINANCE_DEVIATION = 1e-6f;
+
+//----------------------------------------------------------------------------------
+// Run func(x0, y0, x1, y1) on every tile of an image in parallel
+void forEachTile(const int width, const int height, const std::function<void(int, int, int, int)> &func)
+{
+    const int tilesX = (width + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+    const int tilesY = (height + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+    ThreadPool::global().parallelFor(static_cast<size_t>(tilesX) * tilesY, 1, [&](size_t begin, size_t end, int)
+    {
+        for(size_t tile = begin; tile < end; ++tile)
+        {
+            const int x0 = static_cast<int>(tile % tilesX) * DENOISE_TILE_SIZE;
+            const int y0 = static_cast<int>(tile / tilesX) * DENOISE_TILE_SIZE;
+            func(x0, y0, std::min(x0 + DENOISE_TILE_SIZE, width), std::min(y0 + DENOISE_TILE_SIZE, height));
+        }
+    });
+}
+} // namespace
+
+//----------------------------------------------------------------------------------
+Denoiser::Denoiser()
+    : m_iterations(5)
+    , m_luminanceSigma(4.0f)
+    , m_normalPower(128.0f)
+    , m_albedoSigma(0.1f)
+{
+}
+
+//----------------------------------------------------------------------------------
+Image Denoiser::denoise(const Image &color,
+                        const Image &albedo,
+                        const Image &normal,
+                        const std::vector<float> &variance) const
+{
+    const int width = color.getWidth();
+    const int height = color.getHeight();
+    const int pixelCount = color.getPixelCount();
+    if(albedo.getWidth() != width || albedo.getHeight() != height
+       || normal.getWidth() != width || normal.getHeight() != height
+       || static_cast<int>(variance.size()) != pixelCount)
+    {
+        throw std::invalid_argument("Denoiser inputs differ in size");
+    }
+
+    // Divide out the albedo, the variance scales with the square of the factor
+    std::vector<Color3f> factor(pixelCount);
+    std::vector<Color3f> irradiance(pixelCount);
+    std::vector<float> irradianceVariance(pixelCount);
+    for(int pixel = 0; pixel < pixelCount; ++pixel)
+    {
+        const Color3f &a = albedo.getPixel(pixel);
+        factor[pixel] = Color3f(a.r > DEMODULATION_MIN_ALBEDO ? a.r : 1.0f,
+                                a.g > DEMODULATION_MIN_ALBEDO ? a.g : 1.0f,
+                                a.b > DEMODULATION_MIN_ALBEDO ? a.b : 1.0f);
+        irradiance[pixel] = color.getPixel(pixel) / factor[pixel];
+
+        const float luminanceFactor = RaytracingUtility::luminance(factor[pixel]);
+        irradianceVariance[pixel] = variance[pixel] / (luminanceFactor * luminanceFactor);
+    }
+
+    // Pixels with too few samples to know their variance get that of their neighborhood
+    forEachTile(width, height, [&](int x0, int y0, int x1, int y1)
+    {
+        for(int y = y0; y < y1; ++y)
+        {
+            for(int x = x0; x < x1; ++x)
+            {
+                if(variance[y * width + x] >= 0.0f)
+                {
+                    continue;
+                }
+
+                float sum = 0.0f;
+                float squaredSum = 0.0f;
+                int count = 0;
+                for(int qy = std::max(0, y - 1); qy <= std::min(height - 1, y + 1); ++qy)
+                {
+                    for(int qx = std::max(0, x - 1); qx <= std::min(width - 1, x + 1); ++qx)
+                    {
+                        const float luminance = RaytracingUtility::luminance(irradiance[qy * width + qx]);
+                        sum += luminance;
+                        squaredSum += luminance * luminance;
+                        ++count;
+                    }
+                }
+                const float mean = sum / count;
+                irradianceVariance[y * width + x] = std::max(0.0f, squaredSum / count - mean * mean);
+            }
+        }
+    });
+
+    std::vector<Color3f> filtered(pixelCount);
+    std::vector<float> filteredVariance(pixelCount);
+    std::vector<float> edgeVariance(pixelCount);
+    for(int iteration = 0; iteration < m_iterations; ++iteration)
+    {
+        const int step = 1 << iteration;
+
+        // Smooth the variance the luminance weights are based on, a single pixel's estimate
+        // is itself noisy
+        forEachTile(width, height, [&](int x0, int y0, int x1, int y1)
+        {
+            for(int y = y0; y < y1; ++y)
+            {
+                for(int x = x0; x < x1; ++x)
+                {
+                    float sum = 0.0f;
+                    float weightSum = 0.0f;
+                    for(int dy = -1; dy <= 1; ++dy)
+                    {
+                        for(int dx = -1; dx <= 1; ++dx)
+                        {
+                            const int qx = x + dx;
+                            const int qy = y + dy;
+                            if(qx < 0 || qx >= width || qy < 0 || qy >= height)
+                            {
+                                continue;
+                            }
+                            const float weight = VARIANCE_KERNEL_WEIGHTS[std::abs(dx)] * VARIANCE_KERNEL_WEIGHTS[std::abs(dy)];
+                            sum += weight * irradianceVariance[qy * width + qx];
+                            weightSum += weight;
+                        }
+                    }
+                    edgeVariance[y * width + x] = sum / weightSum;
+                }
+            }
+        });
+
+        forEachTile(width, height, [&](int x0, int y0, int x1, int y1)
+        {
+            for(int y = y0; y < y1; ++y)
+            {
+                for(int x = x0; x < x1; ++x)
+                {
+                    const int p = y * width + x;
+                    const float luminanceP = RaytracingUtility::luminance(irradiance[p]);
+                    const glm::vec3 &normalP = normal.getPixel(p);
+                    const Color3f &albedoP = albedo.getPixel(p);
+                    const float deviation = m_luminanceSigma * std::sqrt(edgeVariance[p]) + MIN_LUMINANCE_DEVIATION;
+
+                    Color3f sum(0.0f);
+                    float varianceSum = 0.0f;
+                    float weightSum = 0.0f;
+                    for(int dy = -2; dy <= 2; ++dy)
+                    {
+                        for(int dx = -2; dx <= 2; ++dx)
+                        {
+                            const int qx = x + dx * step;
+                            const int qy = y + dy * step;
+                            if(qx < 0 || qx >= width || qy < 0 || qy >= height)
+                            {
+                                continue;
+                            }
+
+                            const int q = qy * width + qx;
+                            float weight = KERNEL_WEIGHTS[std::abs(dx)] * KERNEL_WEIGHTS[std::abs(dy)];
+                            if(q != p)
+                            {
+                                // Pixels without a hit have no normal and only match each other
+                                const glm::vec3 &normalQ = normal.getPixel(q);
+                                const bool noNormals = normalP == glm::vec3(0.0f) && normalQ == glm::vec3(0.0f);
+                                const float normalWeight = noNormals ? 1.0f : std::pow(std::max(0.0f, glm::dot(normalP, normalQ)), m_normalPower);
+                                const float albedoWeight = std::exp(-glm::length(albedoP - albedo.getPixel(q)) / m_albedoSigma);
+                                const float luminanceWeight = std::exp(-std::abs(luminanceP - RaytracingUtility::luminance(irradiance[q])) / deviation);
+                                weight *= normalWeight * albedoWeight * luminanceWeight;
+                            }
+
+                            sum += weight * irradiance[q];
+                            varianceSum += weight * weight * irradianceVariance[q];
+                            weightSum += weight;
+                        }
+                    }
+
+                    filtered[p] = sum / weightSum;
+                    filteredVariance[p] = varianceSum / (weightSum * weightSum);
+                }
+            }
+        });
+
+        irradiance.swap(filtered);
+        irradianceVariance.swap(filteredVariance);
+    }
+
+    Image result(width, height);
+    for(int pixel = 0; pixel < pixelCount; ++pixel)
+    {
+        result.setPixel(pixel, irradiance[pixel] * factor[pixel]);
+    }
+    return result;
+}
+} // namespace raytracer
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Image.h"
+
+#include <vector>
+
+namespace raytracer
+{
+/// @class Denoiser
+/// @brief Removes Monte Carlo noise from a rendered image with an edge-avoiding à-trous
+///        wavelet filter guided by albedo, normals and the variance of every pixel.
+///
+/// The image is divided by its albedo first, so textures are kept out of the filter and only
+/// the smoother incident light is blurred, and multiplied by it again afterwards. Every
+/// iteration convolves with a 5x5 B-spline kernel whose taps are spread twice as far apart as
+/// in the previous one, so a few iterations cover a large footprint at a small cost. Each tap
+/// is weighted down by how much its normal and albedo differ from the center pixel's, and by
+/// how much its luminance differs compared with the standard deviation expected from noise,
+/// so edges and features that are resolved in the image survive. The variance is filtered
+/// along with the image, so later, wider iterations blur less. Every iteration is split into
+/// tiles that run in parallel on the global thread pool.
+class Denoiser
+{
+public:
+    /// @brief Constructor, sets the default parameters
+    Denoiser();
+
+    /// @brief Filter an image
+    /// @param color the noisy linear radiance
+    /// @param albedo the albedo at the first hit of every pixel
+    /// @param normal the shading normal at the first hit of every pixel, zero if none
+    /// @param variance the variance of the luminance estimate of every pixel, i.e. the sample
+    ///        variance divided by the number of samples, negative if unknown
+    /// @return the filtered radiance
+    /// @throw std::invalid_argument if the sizes of the inputs differ
+    Image denoise(const Image &color,
+                  const Image &albedo,
+                  const Image &normal,
+                  const std::vector<float> &variance) const;
+
+    //@{
+    /// @brief Set/get the number of filter iterations, each doubling the footprint
+    void setIterations(const int iterations) { m_iterations = iterations; }
+    int getIterations() const { return m_iterations; }
+    //@}
+
+    //@{
+    /// @brief Set/get how many standard deviations of noise a luminance difference may span
+    ///        before a tap is weighted down, larger values blur more
+    void setLuminanceSigma(const float sigma) { m_luminanceSigma = sigma; }
+    float getLuminanceSigma() const { return m_luminanceSigma; }
+    //@}
+
+    //@{
+    /// @brief Set/get the exponent applied to the cosine between normals, larger values
+    ///        keep geometric edges sharper
+    void setNormalPower(const float power) { m_normalPower = power; }
+    float getNormalPower() const { return m_normalPower; }
+    //@}
+
+    //@{
+    /// @brief Set/get the albedo difference at which a tap's weight has fallen to 1/e
+    void setAlbedoSigma(const float sigma) { m_albedoSigma = sigma; }
+    float getAlbedoSigma() const { return m_albedoSigma; }
+    //@}
+
+private:
+    int m_iterations;
+    float m_luminanceSigma;
+    float m_normalPower;
+    float m_albedoSigma;
+};
+} // namespace raytracer
@@ -0,0 +1,154 @@
+#include "Film.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+namespace raytracer
+{
+namespace
+{
+/// Luminance below which pixels count as equally dark when their display error is estimated
+const double DISPLAY_ERROR_MIN_LUMINANCE = 1e-4;
+
+static_assert(sizeof(Color3f) == 3 * sizeof(float), "Radiance sums are written as packed floats");
+static_assert(sizeof(AOVSample) == 11 * sizeof(float), "AOV sums are written as packed 32-bit values");
+
+//----------------------------------------------------------------------------------
+// Write the elements of a vector as they are laid out in memory
+template<typename T>
+void writeArray(std::ostream &out, const std::vector<T> &values)
+{
+    out.write(reinterpret_cast<const char *>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+//----------------------------------------------------------------------------------
+// Read the elements of a vector of the right size as written by writeArray()
+template<typename T>
+void readArray(std::istream &in, std::vector<T> &values)
+{
+    in.read(reinterpret_cast<char *>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+} // namespace
+
+//----------------------------------------------------------------------------------
+Film::Film(const int width, const int height, const bool withAOVs)
+    : m_width(width)
+    , m_height(height)
+{
+    if(width <= 0 || height <= 0)
+    {
+        throw std::invalid_argument("Invalid film size");
+    }
+
+    const size_t pixelCount = static_cast<size_t>(width) * height;
+    m_radianceSum.assign(pixelCount, Color3f(0.0f));
+    m_luminanceSum.assign(pixelCount, 0.0);
+    m_luminanceSquaredSum.assign(pixelCount, 0.0);
+    m_sampleCount.assign(pixelCount, 0);
+    if(withAOVs)
+    {
+        m_sampleAOVs.assign(pixelCount, AOVSample{Color3f(0.0f), glm::vec3(0.0f), 0.0f, -1, Color3f(0.0f)});
+    }
+}
+
+//----------------------------------------------------------------------------------
+Color3f Film::getPixelColor(const int pixel) const
+{
+    const int count = m_sampleCount[pixel];
+    return count > 0 ? m_radianceSum[pixel] / static_cast<float>(count) : Color3f(0.0f);
+}
+
+//----------------------------------------------------------------------------------
+AOVSample Film::getPixelAOV(const int pixel) const
+{
+    AOVSample aov = m_sampleAOVs[pixel];
+    const int count = m_sampleCount[pixel];
+    if(count > 0)
+    {
+        const float scale = 1.0f / static_cast<float>(count);
+        aov.albedo *= scale;
+        aov.depth *= scale;
+        aov.direct *= scale;
+
+        const float normalLength = glm::length(aov.normal);
+        aov.normal = normalLength > 0.0f ? aov.normal / normalLength : glm::vec3(0.0f);
+    }
+    return aov;
+}
+
+//----------------------------------------------------------------------------------
+int Film::getMaxSampleCount() const
+{
+    return m_sampleCount.empty() ? 0 : *std::max_element(m_sampleCount.begin(), m_sampleCount.end());
+}
+
+//----------------------------------------------------------------------------------
+float Film::getLuminanceVariance(const int pixel) const
+{
+    const int count = m_sampleCount[pixel];
+    if(count < 2)
+    {
+        return 0.0f;
+    }
+
+    const double mean = m_luminanceSum[pixel] / count;
+    const double variance = (m_luminanceSquaredSum[pixel] - mean * m_luminanceSum[pixel]) / (count - 1);
+    return static_cast<float>(std::max(0.0, variance));
+}
+
+//----------------------------------------------------------------------------------
+float Film::getDisplayError(const int pixel) const
+{
+    const int count = m_sampleCount[pixel];
+    if(count < 2)
+    {
+        return std::numeric_limits<float>::infinity();
+    }
+
+    // The output is gamma corrected with a square root, whose slope is 1/(2 sqrt(L))
+    const double standardError = std::sqrt(this->getLuminanceVariance(pixel) / count);
+    const double mean = std::max(DISPLAY_ERROR_MIN_LUMINANCE, m_luminanceSum[pixel] / count);
+    return static_cast<float>(standardError / (2.0 * std::sqrt(mean)));
+}
+//----------------------------------------------------------------------------------
+void Film::write(std::ostream &out) const
+{
+    const int32_t header[4] = {m_width, m_height, this->hasAOVs() ? 1 : 0, 0};
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    writeArray(out, m_luminanceSum);
+    writeArray(out, m_luminanceSquaredSum);
+    writeArray(out, m_radianceSum);
+    writeArray(out, m_sampleCount);
+    writeArray(out, m_sampleAOVs);
+    if(!out)
+    {
+        throw std::runtime_error("Failed to write film");
+    }
+}
+
+//----------------------------------------------------------------------------------
+Film Film::read(std::istream &in)
+{
+    int32_t header[4] = {0, 0, 0, 0};
+    in.read(reinterpret_cast<char *>(header), sizeof(header));
+    if(!in || header[0] <= 0 || header[1] <= 0 || (header[2] != 0 && header[2] != 1) || header[3] != 0)
+    {
+        throw std::runtime_error("Invalid film data");
+    }
+
+    Film film(header[0], header[1], header[2] != 0);
+    readArray(in, film.m_luminanceSum);
+    readArray(in, film.m_luminanceSquaredSum);
+    readArray(in, film.m_radianceSum);
+    readArray(in, film.m_sampleCount);
+    readArray(in, film.m_sampleAOVs);
+    if(!in)
+    {
+        throw std::runtime_error("Truncated film data");
+    }
+    return film;
+}
+} // namespace raytracer
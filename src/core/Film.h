@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Utility.h"
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace raytracer
+{
+/// @struct AOVSample
+/// @brief Auxiliary values of a camera sample, taken from its first hit and its path
+struct AOVSample
+{
+    Color3f albedo;     ///< reflectance at the first hit, or the light seen if it does not scatter
+    glm::vec3 normal;   ///< shading normal at the first hit, facing the camera, zero on a miss
+    float depth;        ///< distance from the camera to the first hit
+    int objectId;       ///< scene object of the first hit, -1 on a miss
+    Color3f direct;     ///< part of the radiance that scattered at most once on its way
+};
+
+/// @class Film
+/// @brief Accumulates the radiance samples taken for the pixels of an image.
+///
+/// Besides the sum of its samples, every pixel keeps their number and the sum and squared sum
+/// of their luminance, from which the variance of the pixel estimate follows. A film created
+/// with AOVs also averages the auxiliary values of the samples, except the object id, which
+/// is that of the pixel's first sample. Pixels can be given different numbers of samples.
+/// Samples of different pixels may be added concurrently, samples of the same pixel may not.
+class Film
+{
+public:
+    /// @brief Default constructor, creates an empty film
+    Film() = default;
+
+    /// @brief Constructor, creates a film without samples
+    /// @param width the width in pixels
+    /// @param height the height in pixels
+    /// @param withAOVs whether samples carry auxiliary values
+    /// @throw std::invalid_argument if the size is invalid
+    Film(int width, int height, bool withAOVs = false);
+
+    /// @brief Get the width in pixels
+    int getWidth() const { return m_width; }
+
+    /// @brief Get the height in pixels
+    int getHeight() const { return m_height; }
+
+    /// @brief Get the number of pixels
+    int getPixelCount() const { return m_width * m_height; }
+
+    /// @brief Whether samples carry auxiliary values
+    bool hasAOVs() const { return !m_sampleAOVs.empty(); }
+
+    /// @brief Add a radiance sample to a pixel
+    /// @param pixel the index of the pixel, row by row from the top
+    /// @param radiance the radiance carried by the sample
+    void addSample(const int pixel, const Color3f &radiance)
+    {
+        const double luminance = RaytracingUtility::luminance(radiance);
+        m_radianceSum[pixel] += radiance;
+        m_luminanceSum[pixel] += luminance;
+        m_luminanceSquaredSum[pixel] += luminance * luminance;
+        ++m_sampleCount[pixel];
+    }
+
+    /// @brief Add a radiance sample with its auxiliary values to a pixel of a film with AOVs
+    /// @param pixel the index of the pixel, row by row from the top
+    /// @param radiance the radiance carried by the sample
+    /// @param aov the auxiliary values of the sample
+    void addSample(const int pixel, const Color3f &radiance, const AOVSample &aov)
+    {
+        AOVSample &sum = m_sampleAOVs[pixel];
+        if(m_sampleCount[pixel] == 0)
+        {
+            sum.objectId = aov.objectId;
+        }
+        sum.albedo += aov.albedo;
+        sum.normal += aov.normal;
+        sum.depth += aov.depth;
+        sum.direct += aov.direct;
+        this->addSample(pixel, radiance);
+    }
+
+    /// @brief Get the estimate of a pixel, the average of its samples
+    /// @param pixel the index of the pixel
+    /// @return the average radiance, black if the pixel has no samples
+    Color3f getPixelColor(const int pixel) const;
+
+    /// @brief Get the auxiliary values of a pixel of a film with AOVs, averaged over its
+    ///        samples. The normal is renormalized.
+    /// @param pixel the index of the pixel
+    /// @return the values, zero and id -1 if the pixel has no samples
+    AOVSample getPixelAOV(const int pixel) const;
+
+    /// @brief Get the number of samples added to a pixel
+    int getSampleCount(const int pixel) const { return m_sampleCount[pixel]; }
+
+    /// @brief Get the largest number of samples added to any pixel
+    int getMaxSampleCount() const;
+
+    /// @brief Get the sample variance of the luminance of a pixel's samples
+    /// @param pixel the index of the pixel
+    /// @return the variance, 0 if the pixel has fewer than two samples
+    float getLuminanceVariance(const int pixel) const;
+
+    /// @brief Estimate the error of a pixel as displayed. The standard error of the average
+    ///        luminance is carried through the gamma curve of the output, so the same noise
+    ///        counts for more in dark pixels than in bright ones.
+    /// @param pixel the index of the pixel
+    /// @return the estimated error of the gamma-corrected luminance
+    float getDisplayError(const int pixel) const;
+
+    /// @brief Write the sums and counts of all pixels in binary, in the byte order of the
+    ///        machine. After a header of four 32-bit integers, the width, the height, whether
+    ///        there are AOVs and zero, come one array per quantity in pixel order: the
+    ///        luminance sums and squared sums as doubles, the radiance sums as three floats,
+    ///        the sample counts as 32-bit integers and, with AOVs, the AOVSample sums. Every
+    ///        array is aligned to its elements if the film starts at a multiple of 8 bytes,
+    ///        so a mapped file can be read in place.
+    /// @param out the output stream, which should be opened in binary mode
+    /// @throw std::runtime_error if the stream fails
+    void write(std::ostream &out) const;
+
+    /// @brief Create a film from the data written by write()
+    /// @param in the input stream, which should be opened in binary mode
+    /// @return the film
+    /// @throw std::runtime_error if the data is truncated or invalid
+    static Film read(std::istream &in);
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<Color3f> m_radianceSum;
+    std::vector<double> m_luminanceSum;
+    std::vector<double> m_luminanceSquaredSum;
+    std::vector<int> m_sampleCount;
+    std::vector<AOVSample> m_sampleAOVs;    ///< sums of the auxiliary values, if enabled
+};
+} // namespace raytracer
@@ -21,7 +21,8 @@ namespace raytracer
     {
         glm::vec3 point;
         glm::vec3 normal;
-        std::shared_ptr<Material> material;
+        Material *material;     ///< not owned, the hit object keeps its material alive
+        int objectId;           ///< index of the hit object in the outermost BVH it was added to
         float t;
         float u;
         float v;
@@ -31,6 +32,7 @@ namespace raytracer
             : point()
             , normal()
             , material(nullptr)
+            , objectId(-1)
             , t(-1.0f)
             , u(0.0f)
             , v(0.0f)
@@ -64,6 +66,17 @@ namespace raytracer
         /// @return true if the ray intersects the object, false otherwise
         virtual bool hit(const Ray& ray, HitRecord& record) const = 0;
 
+        /// @brief Determines if the ray intersects the object anywhere within [tMin, tMax].
+        ///        Used for visibility queries that do not need the closest hit or its record.
+        ///        The default falls back to hit(), shapes override it with a cheaper test.
+        /// @param ray the ray to test for intersection
+        /// @return true if the ray intersects the object, false otherwise
+        virtual bool occluded(const Ray& ray) const
+        {
+            HitRecord record;
+            return this->hit(ray, record);
+        }
+
         /// @brief Get the world space bounds for this object
         /// @return Bounding box for the object using world space coordinates
         virtual AxisAlignedBoundingBox getBounds() const = 0;
@@ -115,6 +128,23 @@ namespace raytracer
             return 0.0f;
         }
 
+        /// @brief Get the total power emitted by the object
+        /// @return the emitted power, 0 for objects that are not light sources
+        virtual float getPower() const
+        {
+            return 0.0f;
+        }
+
+        /// @brief Get a cone bounding the surface normals of the object, which light sources use
+        ///        to bound the directions they emit into
+        /// @param axis receives the axis of the cone
+        /// @return the cosine of the cone half-angle, -1 if the normals span all directions
+        virtual float getNormalCone(glm::vec3 &axis) const
+        {
+            axis = glm::vec3(0.0f, 0.0f, 1.0f);
+            return -1.0f;
+        }
+
         /// @brief Get the PDF value for the given origin and direction
         /// @param origin the origin of the ray
         /// @param direction the direction of the ray
@@ -135,8 +165,9 @@ namespace raytracer
 
         /// @brief Get a random direction from the given origin
         /// @param origin the origin of the ray
+        /// @param u a uniform sample in [0,1)^2 that selects the direction
         /// @return a random direction based on the PDF
-        virtual glm::vec3 random(const glm::vec3 &origin) const
+        virtual glm::vec3 random(const glm::vec3 &origin, const glm::vec2 &u) const
         {
             return glm::vec3(1.0f, 0.0f, 0.0f);
         }
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Utility.h"
+
+#include <stdexcept>
+#include <vector>
+
+namespace raytracer
+{
+/// @class Image
+/// @brief A float32 RGB framebuffer of linear radiance.
+///
+/// Pixels are stored row by row from the top. Unlike the 8-bit images written for display,
+/// the values are neither gamma corrected nor clamped, so they can be saved to HDR formats.
+class Image
+{
+public:
+    /// @brief Default constructor, creates an empty image
+    Image() = default;
+
+    /// @brief Constructor, creates a black image
+    /// @param width the width in pixels
+    /// @param height the height in pixels
+    /// @throw std::invalid_argument if the size is invalid
+    Image(const int width, const int height)
+        : m_width(width)
+        , m_height(height)
+    {
+        if(width <= 0 || height <= 0)
+        {
+            throw std::invalid_argument("Invalid image size");
+        }
+        m_pixels.assign(static_cast<size_t>(width) * height, Color3f(0.0f));
+    }
+
+    /// @brief Get the width in pixels
+    int getWidth() const { return m_width; }
+
+    /// @brief Get the height in pixels
+    int getHeight() const { return m_height; }
+
+    /// @brief Get the number of pixels
+    int getPixelCount() const { return m_width * m_height; }
+
+    //@{
+    /// @brief Set/get the color of a pixel
+    /// @param pixel the index of the pixel, row by row from the top
+    void setPixel(const int pixel, const Color3f &color) { m_pixels[pixel] = color; }
+    const Color3f &getPixel(const int pixel) const { return m_pixels[pixel]; }
+    //@}
+
+    /// @brief Get the color of a pixel
+    /// @param x the column of the pixel
+    /// @param y the row of the pixel from the top
+    const Color3f &getPixel(const int x, const int y) const { return m_pixels[y * m_width + x]; }
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<Color3f> m_pixels;
+};
+} // namespace raytracer
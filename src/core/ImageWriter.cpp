@@ -0,0 +1,380 @@
+#include "ImageWriter.h"
+#include "ThreadPool.h"
+
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace raytracer
+{
+namespace
+{
+/// Number of pixels below which quantizing an image is not worth splitting across threads
+const size_t QUANTIZE_MIN_CHUNK_PIXELS = 1 << 16;
+/// OpenEXR pixel type of 32-bit floats
+const int32_t EXR_PIXEL_TYPE_FLOAT = 2;
+
+//----------------------------------------------------------------------------------
+// Append the bytes of a value in little-endian order, as PFM with a negative scale and
+// OpenEXR store them regardless of the machine
+void appendLittleEndian(std::vector<uint8_t> &buffer, const uint64_t value, const int byteCount)
+{
+    for(int i = 0; i < byteCount; ++i)
+    {
+        buffer.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+//----------------------------------------------------------------------------------
+void appendInt32(std::vector<uint8_t> &buffer, const int32_t value)
+{
+    appendLittleEndian(buffer, static_cast<uint32_t>(value), 4);
+}
+
+//----------------------------------------------------------------------------------
+// Store a float in little-endian order and return the position after it
+uint8_t *storeFloat(uint8_t *destination, const float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    destination[0] = static_cast<uint8_t>(bits);
+    destination[1] = static_cast<uint8_t>(bits >> 8);
+    destination[2] = static_cast<uint8_t>(bits >> 16);
+    destination[3] = static_cast<uint8_t>(bits >> 24);
+    return destination + 4;
+}
+
+//----------------------------------------------------------------------------------
+void appendFloat(std::vector<uint8_t> &buffer, const float value)
+{
+    uint8_t bytes[4];
+    storeFloat(bytes, value);
+    buffer.insert(buffer.end(), bytes, bytes + 4);
+}
+
+//----------------------------------------------------------------------------------
+void appendString(std::vector<uint8_t> &buffer, const std::string &value)
+{
+    buffer.insert(buffer.end(), value.begin(), value.end());
+}
+
+//----------------------------------------------------------------------------------
+// Append an OpenEXR header attribute, whose value the caller appends afterwards
+void appendExrAttribute(std::vector<uint8_t> &buffer, const char *name, const char *type, const int32_t size)
+{
+    appendString(buffer, name);
+    buffer.push_back(0);
+    appendString(buffer, type);
+    buffer.push_back(0);
+    appendInt32(buffer, size);
+}
+
+//----------------------------------------------------------------------------------
+void appendExrBox(std::vector<uint8_t> &buffer, const char *name, const int width, const int height)
+{
+    appendExrAttribute(buffer, name, "box2i", 16);
+    appendInt32(buffer, 0);
+    appendInt32(buffer, 0);
+    appendInt32(buffer, width - 1);
+    appendInt32(buffer, height - 1);
+}
+
+//----------------------------------------------------------------------------------
+// Callback of stb_image_write that collects the encoded bytes in a buffer
+void appendToBuffer(void *context, void *data, const int size)
+{
+    std::vector<uint8_t> &buffer = *static_cast<std::vector<uint8_t> *>(context);
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+//----------------------------------------------------------------------------------
+uint8_t quantizeChannel(float value)
+{
+    // Also maps nan to zero
+    value = value > 0.0f ? std::min(value, 1.0f) : 0.0f;
+    return static_cast<uint8_t>(255.0f * value);
+}
+} // namespace
+
+//----------------------------------------------------------------------------------
+ImageWriter::Format ImageWriter::formatFromFilename(const std::string &filename)
+{
+    const size_t dot = filename.find_last_of('.');
+    std::string extension = dot == std::string::npos ? std::string() : filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](const unsigned char c)
+    {
+        return static_cast<char>(std::tolower(c));
+    });
+
+    if(extension == "ppm")
+    {
+        return Format::PPM;
+    }
+    else if(extension == "png")
+    {
+        return Format::PNG;
+    }
+    else if(extension == "pfm")
+    {
+        return Format::PFM;
+    }
+    else if(extension == "exr")
+    {
+        return Format::EXR;
+    }
+    throw std::invalid_argument("Unsupported image format: " + filename + " (use .ppm, .png, .pfm or .exr)");
+}
+
+//----------------------------------------------------------------------------------
+std::vector<uint8_t> ImageWriter::encode(const Image &image, const Format format, const Encoding encoding)
+{
+    switch(format)
+    {
+    case Format::PPM:
+        return encodePPM(image, encoding);
+    case Format::PNG:
+        return encodePNG(image, encoding);
+    case Format::PFM:
+        return encodePFM(image);
+    case Format::EXR:
+        return encodeEXR({Layer{std::string(), &image, false}});
+    }
+    throw std::invalid_argument("Unknown image format");
+}
+
+//----------------------------------------------------------------------------------
+void ImageWriter::write(const Image &image, const Format format, std::ostream &out, const Encoding encoding)
+{
+    const std::vector<uint8_t> data = encode(image, format, encoding);
+    out.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    out.flush();
+    if(!out)
+    {
+        throw std::runtime_error("Failed to write image");
+    }
+}
+
+//----------------------------------------------------------------------------------
+void ImageWriter::write(const Image &image, const std::string &filename, const Encoding encoding)
+{
+    writeFile(encode(image, formatFromFilename(filename), encoding), filename);
+}
+
+//----------------------------------------------------------------------------------
+void ImageWriter::write(const std::vector<Layer> &layers, const std::string &filename)
+{
+    if(formatFromFilename(filename) != Format::EXR)
+    {
+        throw std::invalid_argument("Only OpenEXR files can hold several layers: " + filename);
+    }
+    writeFile(encodeEXR(layers), filename);
+}
+
+//----------------------------------------------------------------------------------
+void ImageWriter::writeFile(const std::vector<uint8_t> &data, const std::string &filename)
+{
+    std::ofstream outFile(filename, std::ios::binary);
+    if(!outFile.is_open())
+    {
+        throw std::runtime_error("Could not open file " + filename + " for writing");
+    }
+    outFile.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    outFile.close();
+    if(!outFile)
+    {
+        throw std::runtime_error("Failed to write image to " + filename);
+    }
+}
+
+//----------------------------------------------------------------------------------
+std::vector<uint8_t> ImageWriter::quantize(const Image &image, const Encoding encoding)
+{
+    std::vector<uint8_t> pixels(static_cast<size_t>(image.getPixelCount()) * 3);
+    ThreadPool::global().parallelFor(pixels.size() / 3, QUANTIZE_MIN_CHUNK_PIXELS, [&](size_t begin, size_t end, int)
+    {
+        for(size_t pixel = begin; pixel < end; ++pixel)
+        {
+            Color3f color = image.getPixel(static_cast<int>(pixel));
+            if(encoding == Encoding::Gamma)
+            {
+                color = RaytracingUtility::gammaCorrect(glm::max(color, Color3f(0.0f)));
+            }
+            pixels[pixel * 3 + 0] = quantizeChannel(color.r);
+            pixels[pixel * 3 + 1] = quantizeChannel(color.g);
+            pixels[pixel * 3 + 2] = quantizeChannel(color.b);
+        }
+    });
+    return pixels;
+}
+
+//----------------------------------------------------------------------------------
+std::vector<uint8_t> ImageWriter::encodePPM(const Image &image, const Encoding encoding)
+{
+    const std::string header = "P6\n" + std::to_string(image.getWidth()) + ' '
+                             + std::to_string(image.getHeight()) + "\n255\n";
+    const std::vector<uint8_t> pixels = quantize(image, encoding);
+
+    std::vector<uint8_t> buffer;
+    buffer.reserve(header.size() + pixels.size());
+    appendString(buffer, header);
+    buffer.insert(buffer.end(), pixels.begin(), pixels.end());
+    return buffer;
+}
+
+//----------------------------------------------------------------------------------
+std::vector<uint8_t> ImageWriter::encodePNG(const Image &image, const Encoding encoding)
+{
+    const std::vector<uint8_t> pixels = quantize(image, encoding);
+
+    std::vector<uint8_t> buffer;
+    if(!stbi_write_png_to_func(appendToBuffer, &buffer, image.getWidth(), image.getHeight(), 3,
+                               pixels.data(), image.getWidth() * 3))
+    {
+        throw std::runtime_error("Failed to encode PNG image");
+    }
+    return buffer;
+}
+
+//----------------------------------------------------------------------------------
+std::vector<uint8_t> ImageWriter::encodePFM(const Image &image)
+{
+    // A negative scale marks little-endian data
+    const std::string header = "PF\n" + std::to_string(image.getWidth()) + ' '
+                             + std::to_string(image.getHeight()) + "\n-1.0\n";
+
+    std::vector<uint8_t> buffer;
+    appendString(buffer, header);
+    buffer.resize(header.size() + static_cast<size_t>(image.getPixelCount()) * 12);
+
+    // Rows are stored from the bottom
+    uint8_t *data = buffer.data() + header.size();
+    for(int y = image.getHeight() - 1; y >= 0; --y)
+    {
+        for(int x = 0; x < image.getWidth(); ++x)
+        {
+            const Color3f &color = image.getPixel(x, y);
+            data = storeFloat(data, color.r);
+            data = storeFloat(data, color.g);
+            data = storeFloat(data, color.b);
+        }
+    }
+    return buffer;
+}
+
+//----------------------------------------------------------------------------------
+std::vector<uint8_t> ImageWriter::encodeEXR(const std::vector<Layer> &layers)
+{
+    // A component of a layer stored as one channel
+    struct Channel
+    {
+        std::string name;
+        const Image *image;
+        int component;
+    };
+
+    if(layers.empty())
+    {
+        throw std::invalid_argument("No layers to write");
+    }
+
+    const int width = layers.front().image->getWidth();
+    const int height = layers.front().image->getHeight();
+
+    // Channels are stored in alphabetical order
+    std::vector<Channel> channels;
+    for(const Layer &layer : layers)
+    {
+        if(layer.image->getWidth() != width || layer.image->getHeight() != height)
+        {
+            throw std::invalid_argument("Layer " + layer.name + " differs in size from the first layer");
+        }
+
+        if(layer.singleChannel)
+        {
+            channels.push_back(Channel{layer.name, layer.image, 0});
+        }
+        else
+        {
+            const std::string prefix = layer.name.empty() ? std::string() : layer.name + '.';
+            channels.push_back(Channel{prefix + 'R', layer.image, 0});
+            channels.push_back(Channel{prefix + 'G', layer.image, 1});
+            channels.push_back(Channel{prefix + 'B', layer.image, 2});
+        }
+    }
+    std::sort(channels.begin(), channels.end(), [](const Channel &a, const Channel &b)
+    {
+        return a.name < b.name;
+    });
+
+    std::vector<uint8_t> buffer;
+
+    // Magic number and version 2, single-part scanline file
+    appendInt32(buffer, 20000630);
+    appendInt32(buffer, 2);
+
+    int32_t channelListSize = 1;
+    for(const Channel &channel : channels)
+    {
+        channelListSize += static_cast<int32_t>(channel.name.size()) + 1 + 16;
+    }
+    appendExrAttribute(buffer, "channels", "chlist", channelListSize);
+    for(const Channel &channel : channels)
+    {
+        appendString(buffer, channel.name);
+        buffer.push_back(0);
+        appendInt32(buffer, EXR_PIXEL_TYPE_FLOAT);
+        appendInt32(buffer, 0); // pLinear and reserved bytes
+        appendInt32(buffer, 1); // x sampling
+        appendInt32(buffer, 1); // y sampling
+    }
+    buffer.push_back(0);
+
+    appendExrAttribute(buffer, "compression", "compression", 1);
+    buffer.push_back(0); // none
+    appendExrBox(buffer, "dataWindow", width, height);
+    appendExrBox(buffer, "displayWindow", width, height);
+    appendExrAttribute(buffer, "lineOrder", "lineOrder", 1);
+    buffer.push_back(0); // increasing y
+    appendExrAttribute(buffer, "pixelAspectRatio", "float", 4);
+    appendFloat(buffer, 1.0f);
+    appendExrAttribute(buffer, "screenWindowCenter", "v2f", 8);
+    appendFloat(buffer, 0.0f);
+    appendFloat(buffer, 0.0f);
+    appendExrAttribute(buffer, "screenWindowWidth", "float", 4);
+    appendFloat(buffer, 1.0f);
+    buffer.push_back(0);
+
+    // Offset table, uncompressed files store one scanline per chunk
+    const int32_t lineSize = width * static_cast<int32_t>(channels.size()) * 4;
+    const uint64_t firstChunk = buffer.size() + static_cast<uint64_t>(height) * 8;
+    for(int y = 0; y < height; ++y)
+    {
+        appendLittleEndian(buffer, firstChunk + static_cast<uint64_t>(y) * (8 + lineSize), 8);
+    }
+
+    // Every scanline stores the channels one after the other
+    buffer.reserve(firstChunk + static_cast<uint64_t>(height) * (8 + lineSize));
+    for(int y = 0; y < height; ++y)
+    {
+        appendInt32(buffer, y);
+        appendInt32(buffer, lineSize);
+
+        const size_t lineStart = buffer.size();
+        buffer.resize(lineStart + lineSize);
+        uint8_t *data = buffer.data() + lineStart;
+        for(const Channel &channel : channels)
+        {
+            for(int x = 0; x < width; ++x)
+            {
+                data = storeFloat(data, channel.image->getPixel(x, y)[channel.component]);
+            }
+        }
+    }
+    return buffer;
+}
+} // namespace raytracer
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Image.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace raytracer
+{
+/// @class ImageWriter
+/// @brief Encodes float framebuffers into image files.
+///
+/// 8-bit formats (binary PPM and PNG) are quantized from the framebuffer while encoding, the
+/// float formats (PFM and uncompressed scanline OpenEXR) keep the linear values. Every image
+/// is encoded into memory first and then written with a single call, so writing a large
+/// image costs one system call rather than one formatted insertion per channel. OpenEXR files
+/// can hold several images as layers of named channels.
+class ImageWriter
+{
+public:
+    /// @brief File format of an encoded image
+    enum class Format
+    {
+        PPM,    ///< binary portable pixmap (P6), 8 bits per channel
+        PNG,    ///< portable network graphics, 8 bits per channel
+        PFM,    ///< portable float map, 32-bit linear floats
+        EXR     ///< OpenEXR with uncompressed scanlines, 32-bit linear floats
+    };
+
+    /// @brief How linear values are mapped to the 8 bits of PPM and PNG
+    enum class Encoding
+    {
+        Gamma,  ///< gamma corrected for display, as the rendered images
+        Linear  ///< stored as they are, e.g. for data already in [0,1]
+    };
+
+    /// @struct Layer
+    /// @brief An image stored as channels of a multi-layer file
+    struct Layer
+    {
+        std::string name;       ///< prefix of the channel names, empty for the main image
+        const Image *image;     ///< not owned
+        bool singleChannel;     ///< store only the red component, in a channel named after the layer
+    };
+
+    /// @brief Get the format of a file from its extension, e.g. ".png", case-insensitive
+    /// @param filename the name of the file
+    /// @return the format
+    /// @throw std::invalid_argument if the extension is not one of a supported format
+    static Format formatFromFilename(const std::string &filename);
+
+    /// @brief Encode an image in memory
+    /// @param image the image
+    /// @param format the file format
+    /// @param encoding the mapping of values to 8-bit formats, ignored by float formats
+    /// @return the encoded file contents
+    static std::vector<uint8_t> encode(const Image &image, const Format format, const Encoding encoding = Encoding::Gamma);
+
+    /// @brief Write an image to a stream
+    /// @param image the image
+    /// @param format the file format
+    /// @param out the output stream, which should be opened in binary mode
+    /// @param encoding the mapping of values to 8-bit formats, ignored by float formats
+    /// @throw std::runtime_error if the stream fails
+    static void write(const Image &image, const Format format, std::ostream &out, const Encoding encoding = Encoding::Gamma);
+
+    /// @brief Write an image to a file in the format given by its extension
+    /// @param image the image
+    /// @param filename the name of the file
+    /// @param encoding the mapping of values to 8-bit formats, ignored by float formats
+    /// @throw std::invalid_argument if the extension is not supported
+    /// @throw std::runtime_error if the file cannot be written
+    static void write(const Image &image, const std::string &filename, const Encoding encoding = Encoding::Gamma);
+
+    /// @brief Write images of the same size as the layers of one OpenEXR file. The channels
+    ///        of a layer are named "<name>.R", "<name>.G" and "<name>.B".
+    /// @param layers the images and their names
+    /// @param filename the name of the file, which must end with .exr
+    /// @throw std::invalid_argument if the file is not an OpenEXR file or the sizes differ
+    /// @throw std::runtime_error if the file cannot be written
+    static void write(const std::vector<Layer> &layers, const std::string &filename);
+
+private:
+    static std::vector<uint8_t> quantize(const Image &image, const Encoding encoding);
+    static std::vector<uint8_t> encodePPM(const Image &image, const Encoding encoding);
+    static std::vector<uint8_t> encodePNG(const Image &image, const Encoding encoding);
+    static std::vector<uint8_t> encodePFM(const Image &image);
+    static std::vector<uint8_t> encodeEXR(const std::vector<Layer> &layers);
+    static void writeFile(const std::vector<uint8_t> &data, const std::string &filename);
+};
+} // namespace raytracer
@@ -0,0 +1,147 @@
+#include "Instance.h"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <limits>
+#include <stdexcept>
+
+namespace raytracer
+{
+//----------------------------------------------------------------------------------
+Instance::Instance(std::shared_ptr<Hittable> geometry,
+                   const glm::mat4 &objectToWorld,
+                   std::shared_ptr<Material> material)
+        : m_geometry(geometry)
+        , m_material(material)
+{
+    if(!m_geometry)
+    {
+        throw std::invalid_argument("Instance geometry must not be null");
+    }
+
+    this->updateTransform(objectToWorld);
+}
+
+//----------------------------------------------------------------------------------
+void Instance::updateTransform(const glm::mat4 &objectToWorld)
+{
+    if(glm::determinant(objectToWorld) == 0.0f)
+    {
+        throw std::invalid_argument("Instance transform must be invertible");
+    }
+
+    m_modelMatrix = objectToWorld;
+    m_worldToObject = glm::inverse(objectToWorld);
+    m_normalMatrix = glm::inverseTranspose(glm::mat3(objectToWorld));
+
+    // Bound the transformed corners of the object space bounds
+    const AxisAlignedBoundingBox objectBounds = m_geometry->getBounds();
+    glm::vec3 minPoint( std::numeric_limits<float>::max());
+    glm::vec3 maxPoint(-std::numeric_limits<float>::max());
+
+    for(int corner = 0; corner < 8; ++corner)
+    {
+        const glm::vec3 point((corner & 1) ? objectBounds.pMax().x : objectBounds.pMin().x,
+                              (corner & 2) ? objectBounds.pMax().y : objectBounds.pMin().y,
+                              (corner & 4) ? objectBounds.pMax().z : objectBounds.pMin().z);
+        const glm::vec3 worldPoint = glm::vec3(objectToWorld * glm::vec4(point, 1.0f));
+        minPoint = glm::min(minPoint, worldPoint);
+        maxPoint = glm::max(maxPoint, worldPoint);
+    }
+
+    m_bounds = AxisAlignedBoundingBox(minPoint, maxPoint);
+}
+
+//----------------------------------------------------------------------------------
+Ray Instance::toObjectSpace(const Ray &ray, float &directionScale) const
+{
+    // Shapes expect unit length directions, so the object space ray is normalized and its
+    // interval rescaled by the length the transform gave the direction
+    const glm::vec3 objectOrigin = glm::vec3(m_worldToObject * glm::vec4(ray.origin(), 1.0f));
+    const glm::vec3 objectDirection = glm::vec3(m_worldToObject * glm::vec4(ray.direction(), 0.0f));
+    directionScale = glm::length(objectDirection);
+
+    return Ray(objectOrigin,
+               objectDirection / directionScale,
+               ray.tMin() * directionScale,
+               ray.tMax() * directionScale);
+}
+
+//----------------------------------------------------------------------------------
+bool Instance::hit(const Ray &ray, HitRecord &record) const
+{
+    if(!m_bounds.intersect(ray))
+    {
+        return false;
+    }
+
+    float directionScale;
+    const Ray objectRay = this->toObjectSpace(ray, directionScale);
+
+    HitRecord objectRecord;
+    if(!m_geometry->hit(objectRay, objectRecord))
+    {
+        return false;
+    }
+
+    record = objectRecord;
+    record.t = objectRecord.t / directionScale;
+    record.point = ray(record.t);
+    // The transform preserves the sign of dot(direction, normal), so frontFace stays valid
+    record.normal = glm::normalize(m_normalMatrix * objectRecord.normal);
+
+    if(m_material)
+    {
+        record.material = m_material.get();
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------------
+bool Instance::occluded(const Ray &ray) const
+{
+    if(!m_bounds.intersect(ray))
+    {
+        return false;
+    }
+
+    float directionScale;
+    return m_geometry->occluded(this->toObjectSpace(ray, directionScale));
+}
+
+//----------------------------------------------------------------------------------
+glm::vec3 Instance::center() const
+{
+    return glm::vec3(m_modelMatrix * glm::vec4(m_geometry->center(), 1.0f));
+}
+
+//----------------------------------------------------------------------------------
+void Instance::translate(const glm::vec3 &translation)
+{
+    this->updateTransform(glm::translate(glm::mat4(1.0f), translation) * m_modelMatrix);
+}
+
+//----------------------------------------------------------------------------------
+void Instance::rotate(const float angle, const glm::vec3 &axis)
+{
+    const auto c = this->center();
+    const auto translationToOrigin = glm::translate(glm::mat4(1.0f), -c);
+    const auto rotationMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(angle), axis);
+    const auto translationBack = glm::translate(glm::mat4(1.0f), c);
+
+    this->updateTransform(translationBack * rotationMatrix * translationToOrigin * m_modelMatrix);
+}
+
+//----------------------------------------------------------------------------------
+void Instance::scale(const glm::vec3 &scale)
+{
+    const auto c = this->center();
+    const auto translationToOrigin = glm::translate(glm::mat4(1.0f), -c);
+    const auto scaleMatrix = glm::scale(glm::mat4(1.0f), scale);
+    const auto translationBack = glm::translate(glm::mat4(1.0f), c);
+
+    this->updateTransform(translationBack * scaleMatrix * translationToOrigin * m_modelMatrix);
+}
+
+} // namespace raytracer
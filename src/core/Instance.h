@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Hittable.h"
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+
+#include <memory>
+
+namespace raytracer
+{
+/// @class Instance
+/// @brief A placement of shared geometry in the scene with its own transform.
+///
+/// The geometry, usually a BVH built once over an asset, is defined in object space and can
+/// be referenced by any number of instances. Rays are transformed into object space at the
+/// instance boundary and the hit is transformed back to world space, so adding the instances
+/// to a scene BVH gives a two-level hierarchy in which each copy costs a matrix instead of
+/// its own primitives.
+class Instance : public Hittable
+{
+public:
+    /// @brief no default constructor for the instance.
+    Instance() = delete;
+
+    /// @brief a constructor to place shared geometry in the scene.
+    /// @param geometry the object space geometry, shared between instances
+    /// @param objectToWorld the transform from object space to world space
+    /// @param material overrides the material of the geometry if not null
+    /// @throw std::invalid_argument if geometry is null or the transform is not invertible
+    Instance(std::shared_ptr<Hittable> geometry,
+             const glm::mat4 &objectToWorld = glm::mat4(1.0f),
+             std::shared_ptr<Material> material = nullptr);
+
+    /// @brief the destructor for the instance.
+    virtual ~Instance() = default;
+
+    /// @brief Determines if the ray intersects the instanced geometry.
+    /// @see Hittable::hit
+    bool hit(const Ray &ray, HitRecord &record) const override;
+
+    /// @brief Determines if the ray intersects the instanced geometry anywhere.
+    /// @see Hittable::occluded
+    bool occluded(const Ray &ray) const override;
+
+    /// @brief Get the world space bounds of the transformed geometry
+    /// @see Hittable::getBounds
+    AxisAlignedBoundingBox getBounds() const override { return m_bounds; }
+
+    /// @brief the world space center of the instance
+    /// @see Hittable::center
+    glm::vec3 center() const override;
+
+    /// @brief translate the instance in world space
+    /// @param translation the coordinates, in world space, of a translation vector
+    /// @see Hittable::translate
+    void translate(const glm::vec3 &translation) override;
+
+    /// @brief rotate the instance in world space about its center
+    /// @param angle the angle to rotate in degrees
+    /// @param axis rotation axis, recommended to be normalized
+    /// @see Hittable::rotate
+    void rotate(const float angle, const glm::vec3 &axis) override;
+
+    /// @brief scale the instance in world space about its center
+    /// @param scale ratio of scaling for each axis
+    /// @see Hittable::scale
+    void scale(const glm::vec3 &scale) override;
+
+    /// @brief Get the shared object space geometry
+    /// @return the geometry referenced by this instance
+    const std::shared_ptr<Hittable> &getGeometry() const { return m_geometry; }
+
+private:
+    void updateTransform(const glm::mat4 &objectToWorld);
+    Ray toObjectSpace(const Ray &ray, float &directionScale) const;
+
+    std::shared_ptr<Hittable> m_geometry;
+    std::shared_ptr<Material> m_material;
+
+    glm::mat4 m_worldToObject;
+    glm::mat3 m_normalMatrix;
+    AxisAlignedBoundingBox m_bounds;
+};
+} // namespace raytracer
@@ -0,0 +1,444 @@
+#include "LightTree.h"
+#include "AABB.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace raytracer
+{
+namespace
+{
+/// Number of buckets used per axis when evaluating the surface area orientation heuristic
+const int NUM_SAOH_BUCKETS = 12;
+/// Maximum depth of the tree, which bounds the size of the traversal stack
+const int LIGHT_TREE_MAX_DEPTH = 64;
+/// Nodes deeper than this are split into equal halves, which keeps the tree within its
+/// maximum depth for any number of lights that fits in an int
+const int LIGHT_TREE_SAOH_MAX_DEPTH = 32;
+/// Largest float below one, keeps remapped random numbers in [0,1)
+const float ONE_MINUS_EPSILON = 1.0f - std::numeric_limits<float>::epsilon() / 2.0f;
+
+/// @struct DirectionCone
+/// @brief A cone of directions given by its axis and the cosine of its half-angle
+struct DirectionCone
+{
+    glm::vec3 axis = glm::vec3(0.0f, 0.0f, 1.0f);
+    float cosTheta = -1.0f;
+};
+
+/// @struct LightInfo
+/// @brief Cached bounds, normal cone and power of a light used during the build
+struct LightInfo
+{
+    size_t index;
+    AxisAlignedBoundingBox bounds;
+    glm::vec3 centroid;
+    DirectionCone cone;
+    float power;
+};
+
+/// @struct SAOHBucket
+/// @brief Bounds, normal cone and power of the lights whose centroids fall in a bucket
+struct SAOHBucket
+{
+    int count = 0;
+    AxisAlignedBoundingBox bounds;
+    DirectionCone cone;
+    float power = 0.0f;
+};
+
+//----------------------------------------------------------------------------------
+float safeSqrt(const float x)
+{
+    return std::sqrt(std::max(0.0f, x));
+}
+
+//----------------------------------------------------------------------------------
+float safeAcos(const float x)
+{
+    return std::acos(glm::clamp(x, -1.0f, 1.0f));
+}
+
+//----------------------------------------------------------------------------------
+// cos(max(0, a - b)) given the sines and cosines of the angles a and b in [0, pi]
+float cosSubClamped(const float sinA, const float cosA, const float sinB, const float cosB)
+{
+    if(cosA > cosB)
+    {
+        return 1.0f;
+    }
+    return cosA * cosB + sinA * sinB;
+}
+
+//----------------------------------------------------------------------------------
+// Smallest cone that contains both cones
+DirectionCone coneUnion(const DirectionCone &a, const DirectionCone &b)
+{
+    const float pi = glm::pi<float>();
+    const float thetaA = safeAcos(a.cosTheta);
+    const float thetaB = safeAcos(b.cosTheta);
+    const float thetaD = safeAcos(glm::dot(a.axis, b.axis));
+
+    if(std::min(thetaD + thetaB, pi) <= thetaA)
+    {
+        return a;
+    }
+    if(std::min(thetaD + thetaA, pi) <= thetaB)
+    {
+        return b;
+    }
+
+    DirectionCone cone;
+    const float theta = 0.5f * (thetaA + thetaD + thetaB);
+    const glm::vec3 rotationAxis = glm::cross(a.axis, b.axis);
+    if(theta >= pi || glm::dot(rotationAxis, rotationAxis) == 0.0f)
+    {
+        return cone;
+    }
+
+    // Rotate the axis of a towards b so the new cone just touches the far sides of both
+    const float rotation = theta - thetaA;
+    const glm::vec3 k = glm::normalize(rotationAxis);
+    cone.axis = glm::normalize(a.axis * std::cos(rotation) + glm::cross(k, a.axis) * std::sin(rotation) +
+                               k * glm::dot(k, a.axis) * (1.0f - std::cos(rotation)));
+    cone.cosTheta = std::cos(theta);
+
+    return cone;
+}
+
+//----------------------------------------------------------------------------------
+// Solid angle measure of the directions a cone of emitters with a cosine falloff lights
+float orientationMeasure(const DirectionCone &cone)
+{
+    const float pi = glm::pi<float>();
+    const float thetaO = safeAcos(cone.cosTheta);
+    const float thetaW = std::min(thetaO + 0.5f * pi, pi);
+    const float sinThetaO = std::sin(thetaO);
+
+    return 2.0f * pi * (1.0f - cone.cosTheta) +
+           0.5f * pi * (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW) -
+                        2.0f * thetaO * sinThetaO + cone.cosTheta);
+}
+
+//----------------------------------------------------------------------------------
+// Conservative estimate of the light a node can send to a point
+float importance(const LightTreeNode &node, const glm::vec3 &point)
+{
+    if(node.power <= 0.0f)
+    {
+        return 0.0f;
+    }
+
+    const glm::vec3 center = 0.5f * (node.pMin + node.pMax);
+    const glm::vec3 toPoint = point - center;
+    const float distance2 = glm::dot(toPoint, toPoint);
+    const float radius2 = glm::dot(node.pMax - center, node.pMax - center);
+
+    // Clamp the distance so points close to or inside the node do not blow up the estimate
+    const float clampedDistance2 = std::max(distance2, 0.5f * glm::length(node.pMax - node.pMin));
+
+    if(distance2 <= radius2)
+    {
+        return node.power / clampedDistance2;
+    }
+
+    // Angle between the cone axis and the point, reduced by the cone and the bounding sphere
+    const float cosThetaW = glm::dot(node.axis, toPoint / std::sqrt(distance2));
+    const float sinThetaW = safeSqrt(1.0f - cosThetaW * cosThetaW);
+    const float sinThetaO = safeSqrt(1.0f - node.cosTheta * node.cosTheta);
+    const float cosThetaB = safeSqrt(1.0f - radius2 / distance2);
+    const float sinThetaB = safeSqrt(1.0f - cosThetaB * cosThetaB);
+
+    const float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cosTheta);
+    const float sinThetaX = safeSqrt(1.0f - cosThetaX * cosThetaX);
+    const float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+
+    // Emitters only light the hemisphere around their normal
+    if(cosThetaP <= 0.0f)
+    {
+        return 0.0f;
+    }
+
+    return node.power * cosThetaP / clampedDistance2;
+}
+
+//----------------------------------------------------------------------------------
+// Slab test of a ray against the bounds of a node over [0, tMax]
+bool intersectNode(const LightTreeNode &node, const glm::vec3 &origin, const glm::vec3 &invDirection, const float tMax)
+{
+    const glm::vec3 tLower = (node.pMin - origin) * invDirection;
+    const glm::vec3 tUpper = (node.pMax - origin) * invDirection;
+    const glm::vec3 tNear = glm::min(tLower, tUpper);
+    const glm::vec3 tFar = glm::max(tLower, tUpper);
+
+    const float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    const float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+
+    return tEnter <= tExit;
+}
+
+//----------------------------------------------------------------------------------
+int buildRecursive(std::vector<LightInfo> &lightInfo, const size_t start, const size_t end,
+                   const int depth, std::vector<LightTreeNode> &nodes)
+{
+    AxisAlignedBoundingBox bounds = lightInfo[start].bounds;
+    AxisAlignedBoundingBox centroidBounds(lightInfo[start].centroid, lightInfo[start].centroid);
+    DirectionCone cone = lightInfo[start].cone;
+    float power = lightInfo[start].power;
+
+    for(size_t i = start + 1; i < end; ++i)
+    {
+        bounds = AxisAlignedBoundingBox::combine(bounds, lightInfo[i].bounds);
+        centroidBounds = AxisAlignedBoundingBox::combine(centroidBounds, lightInfo[i].centroid);
+        cone = coneUnion(cone, lightInfo[i].cone);
+        power += lightInfo[i].power;
+    }
+
+    const int nodeIndex = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    nodes[nodeIndex].pMin = bounds.pMin();
+    nodes[nodeIndex].pMax = bounds.pMax();
+    nodes[nodeIndex].axis = cone.axis;
+    nodes[nodeIndex].cosTheta = cone.cosTheta;
+    nodes[nodeIndex].power = power;
+
+    if(end - start == 1)
+    {
+        nodes[nodeIndex].lightIndex = static_cast<int>(lightInfo[start].index);
+        nodes[nodeIndex].isLeaf = true;
+        return nodeIndex;
+    }
+
+    // Find the bucket boundary with the lowest surface area orientation cost over all axes
+    const glm::vec3 extent = centroidBounds.pMax() - centroidBounds.pMin();
+    const glm::vec3 boundsExtent = bounds.diagonal();
+    const float maxBoundsExtent = std::max(std::max(boundsExtent.x, boundsExtent.y), boundsExtent.z);
+
+    float bestCost = std::numeric_limits<float>::infinity();
+    int bestAxis = -1;
+    int bestBucket = -1;
+
+    for(int axis = 0; axis < 3 && depth < LIGHT_TREE_SAOH_MAX_DEPTH; ++axis)
+    {
+        if(extent[axis] <= 0.0f)
+        {
+            continue;
+        }
+
+        SAOHBucket buckets[NUM_SAOH_BUCKETS];
+        for(size_t i = start; i < end; ++i)
+        {
+            const float offset = (lightInfo[i].centroid[axis] - centroidBounds.pMin()[axis]) / extent[axis];
+            const int b = std::min(static_cast<int>(NUM_SAOH_BUCKETS * offset), NUM_SAOH_BUCKETS - 1);
+            SAOHBucket &bucket = buckets[b];
+            bucket.bounds = bucket.count == 0 ? lightInfo[i].bounds : AxisAlignedBoundingBox::combine(bucket.bounds, lightInfo[i].bounds);
+            bucket.cone = bucket.count == 0 ? lightInfo[i].cone : coneUnion(bucket.cone, lightInfo[i].cone);
+            bucket.power += lightInfo[i].power;
+            bucket.count++;
+        }
+
+        // Penalize splits along thin axes, whose child bounds overlap a lot in practice
+        const float axisWeight = maxBoundsExtent / std::max(boundsExtent[axis], std::numeric_limits<float>::min());
+
+        for(int split = 0; split < NUM_SAOH_BUCKETS - 1; ++split)
+        {
+            SAOHBucket below;
+            SAOHBucket above;
+            for(int b = 0; b < NUM_SAOH_BUCKETS; ++b)
+            {
+                SAOHBucket &side = b <= split ? below : above;
+                if(buckets[b].count == 0)
+                {
+                    continue;
+                }
+                side.bounds = side.count == 0 ? buckets[b].bounds : AxisAlignedBoundingBox::combine(side.bounds, buckets[b].bounds);
+                side.cone = side.count == 0 ? buckets[b].cone : coneUnion(side.cone, buckets[b].cone);
+                side.power += buckets[b].power;
+                side.count += buckets[b].count;
+            }
+
+            if(below.count == 0 || above.count == 0)
+            {
+                continue;
+            }
+
+            const float cost = axisWeight *
+                (below.power * orientationMeasure(below.cone) * below.bounds.surfaceArea() +
+                 above.power * orientationMeasure(above.cone) * above.bounds.surfaceArea());
+
+            if(cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBucket = split;
+            }
+        }
+    }
+
+    size_t mid = start;
+    if(bestAxis >= 0)
+    {
+        const float pMin = centroidBounds.pMin()[bestAxis];
+        const float axisExtent = extent[bestAxis];
+        auto midIt = std::partition(lightInfo.begin() + start, lightInfo.begin() + end,
+            [=](const LightInfo &info)
+            {
+                const float offset = (info.centroid[bestAxis] - pMin) / axisExtent;
+                return std::min(static_cast<int>(NUM_SAOH_BUCKETS * offset), NUM_SAOH_BUCKETS - 1) <= bestBucket;
+            });
+        mid = static_cast<size_t>(midIt - lightInfo.begin());
+    }
+
+    // Deep nodes and lights with coincident centroids are split into equal halves
+    if(mid == start || mid == end)
+    {
+        const int axis = centroidBounds.maxExtent();
+        mid = (start + end) / 2;
+        std::nth_element(lightInfo.begin() + start, lightInfo.begin() + mid, lightInfo.begin() + end,
+            [axis](const LightInfo &a, const LightInfo &b)
+            {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+    }
+
+    buildRecursive(lightInfo, start, mid, depth + 1, nodes);
+    const int secondChild = buildRecursive(lightInfo, mid, end, depth + 1, nodes);
+    nodes[nodeIndex].secondChildOffset = secondChild;
+    nodes[nodeIndex].isLeaf = false;
+
+    return nodeIndex;
+}
+} // namespace
+
+//----------------------------------------------------------------------------------
+void LightTree::build(const std::vector<std::shared_ptr<Hittable>> &lights)
+{
+    m_nodes.clear();
+    m_lights = lights;
+
+    if(m_lights.empty())
+    {
+        return;
+    }
+
+    std::vector<LightInfo> lightInfo(m_lights.size());
+    for(size_t i = 0; i < m_lights.size(); ++i)
+    {
+        LightInfo &info = lightInfo[i];
+        info.index = i;
+        info.bounds = m_lights[i]->getBounds();
+        info.centroid = 0.5f * (info.bounds.pMin() + info.bounds.pMax());
+        info.cone.cosTheta = m_lights[i]->getNormalCone(info.cone.axis);
+        info.power = m_lights[i]->getPower();
+    }
+
+    m_nodes.reserve(2 * m_lights.size() - 1);
+    buildRecursive(lightInfo, 0, lightInfo.size(), 0, m_nodes);
+}
+
+//----------------------------------------------------------------------------------
+float LightTree::leftChildProbability(const glm::vec3 &point, const int nodeIndex) const
+{
+    const float left = importance(m_nodes[nodeIndex + 1], point);
+    const float right = importance(m_nodes[m_nodes[nodeIndex].secondChildOffset], point);
+
+    // Both children may be estimated to send no light, pick either then
+    if(left + right <= 0.0f)
+    {
+        return 0.5f;
+    }
+
+    return left / (left + right);
+}
+
+//----------------------------------------------------------------------------------
+int LightTree::sample(const glm::vec3 &point, float u, float &pmf) const
+{
+    pmf = 0.0f;
+
+    if(m_nodes.empty())
+    {
+        return -1;
+    }
+
+    int nodeIndex = 0;
+    pmf = 1.0f;
+
+    while(!m_nodes[nodeIndex].isLeaf)
+    {
+        const float pLeft = this->leftChildProbability(point, nodeIndex);
+
+        // Reuse the random number for the next level by remapping it to [0,1)
+        if(u < pLeft)
+        {
+            u = std::min(u / pLeft, ONE_MINUS_EPSILON);
+            pmf *= pLeft;
+            nodeIndex = nodeIndex + 1;
+        }
+        else
+        {
+            u = std::min((u - pLeft) / (1.0f - pLeft), ONE_MINUS_EPSILON);
+            pmf *= 1.0f - pLeft;
+            nodeIndex = m_nodes[nodeIndex].secondChildOffset;
+        }
+    }
+
+    return m_nodes[nodeIndex].lightIndex;
+}
+
+//----------------------------------------------------------------------------------
+float LightTree::pdfValue(const glm::vec3 &origin, const glm::vec3 &direction, const float tMax) const
+{
+    if(m_nodes.empty())
+    {
+        return 0.0f;
+    }
+
+    const glm::vec3 invDirection = 1.0f / direction;
+
+    // Nodes to visit together with the probability of reaching them from the root
+    int nodeStack[LIGHT_TREE_MAX_DEPTH + 1];
+    float pmfStack[LIGHT_TREE_MAX_DEPTH + 1];
+    int stackSize = 0;
+
+    nodeStack[stackSize] = 0;
+    pmfStack[stackSize++] = 1.0f;
+
+    float pdfValue = 0.0f;
+
+    while(stackSize > 0)
+    {
+        --stackSize;
+        const int nodeIndex = nodeStack[stackSize];
+        const float pmf = pmfStack[stackSize];
+        const LightTreeNode &node = m_nodes[nodeIndex];
+
+        if(pmf <= 0.0f || !intersectNode(node, origin, invDirection, tMax))
+        {
+            continue;
+        }
+
+        if(node.isLeaf)
+        {
+            const Hittable &light = *m_lights[node.lightIndex];
+            if(tMax == std::numeric_limits<float>::max() || light.occluded(Ray(origin, direction, 0.0f, tMax)))
+            {
+                pdfValue += pmf * light.pdfValue(origin, direction);
+            }
+            continue;
+        }
+
+        const float pLeft = this->leftChildProbability(origin, nodeIndex);
+        nodeStack[stackSize] = node.secondChildOffset;
+        pmfStack[stackSize++] = pmf * (1.0f - pLeft);
+        nodeStack[stackSize] = nodeIndex + 1;
+        pmfStack[stackSize++] = pmf * pLeft;
+    }
+
+    return pdfValue;
+}
+
+} // namespace raytracer
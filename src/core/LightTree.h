@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Hittable.h"
+
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace raytracer
+{
+/// @struct LightTreeNode
+/// @brief A node of the light tree stored in a flat, depth-first ordered array.
+///
+/// Every node bounds the emitters beneath it by position, by a cone around the directions of
+/// their surface normals, and by their total power. As in the BVH, the first child of an
+/// interior node immediately follows it in the array.
+struct LightTreeNode
+{
+    glm::vec3 pMin;
+    glm::vec3 pMax;
+    glm::vec3 axis;             ///< axis of the cone bounding the emitter normals
+    float cosTheta;             ///< cosine of the normal cone half-angle, -1 for all directions
+    float power;                ///< total power of the emitters beneath the node
+    union
+    {
+        int lightIndex;         ///< leaf: index of the light
+        int secondChildOffset;  ///< interior: index of the second child
+    };
+    bool isLeaf;
+};
+
+/// @class LightTree
+/// @brief A bounding hierarchy over the light sources of a scene used to pick a light
+///        proportionally to its estimated contribution at a shading point.
+///
+/// Sampling walks down the tree, choosing at every node between the two children by a
+/// conservative estimate of the light they can send to the shading point: their power,
+/// divided by the squared distance and scaled by how far the point lies outside their normal
+/// cones. Lights that are far away or face away are rarely chosen, so the cost of sampling
+/// and evaluating the PDF grows logarithmically with the number of lights.
+///
+/// The tree is split with the surface area orientation heuristic, which weighs the area of
+/// the child bounds by their power and the solid angle of their emission cones.
+class LightTree
+{
+public:
+    /// @brief Default constructor, creates an empty tree
+    LightTree() = default;
+
+    /// @brief Build the tree over the given light sources
+    /// @param lights the light sources
+    void build(const std::vector<std::shared_ptr<Hittable>> &lights);
+
+    /// @brief Check if the tree has no lights
+    bool empty() const { return m_lights.empty(); }
+
+    /// @brief Get a light of the tree
+    /// @param index the index of the light, as returned by sample()
+    /// @return the light source
+    const Hittable& light(const int index) const { return *m_lights[index]; }
+
+    /// @brief Choose a light for a shading point
+    /// @param point the shading point
+    /// @param u a uniformly distributed number in [0,1)
+    /// @param pmf receives the probability of choosing the light
+    /// @return the index of the chosen light, -1 if the tree is empty
+    int sample(const glm::vec3 &point, float u, float &pmf) const;
+
+    /// @brief Get the probability density of sampling a direction from a shading point by
+    ///        choosing a light with sample() and then a direction towards it. Only the lights
+    ///        whose bounds the ray enters are visited.
+    /// @param origin the shading point
+    /// @param direction the direction
+    /// @param tMax lights the ray only hits beyond this distance along the direction are skipped,
+    ///        e.g. to get the density of the light a ray actually hit
+    /// @return the PDF value
+    float pdfValue(const glm::vec3 &origin,
+                   const glm::vec3 &direction,
+                   float tMax = std::numeric_limits<float>::max()) const;
+
+private:
+    float leftChildProbability(const glm::vec3 &point, const int nodeIndex) const;
+
+    std::vector<LightTreeNode> m_nodes;
+    std::vector<std::shared_ptr<Hittable>> m_lights;
+};
+} // namespace raytracer
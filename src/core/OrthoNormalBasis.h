@@ -38,13 +38,13 @@ public:
         m_u = glm::cross(m_w, m_v);
     }
 
-    // /// @brief Transforms a vector from local space to world space.
-    // /// @param a the vector in local space
-    // /// @return the vector in world space
-    // glm::vec3 localToWorld(const glm::vec3 &a) const
-    // {
-    //     return a.x * m_u + a.y * m_v + a.z * m_w;
-    // }   
+    /// @brief Transforms a vector from local space to world space.
+    /// @param a the vector in local space
+    /// @return the vector in world space
+    glm::vec3 localToWorld(const glm::vec3 &a) const
+    {
+        return a.x * m_u + a.y * m_v + a.z * m_w;
+    }
 
     /// @brief Transforms a vector from basis coordinates to local space.
     /// @param a basis coordinates
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+namespace raytracer
+{
+/// @class Pcg32
+/// @brief A small and fast pseudo-random number generator of the PCG family (XSH RR variant).
+///
+/// The generator keeps 64 bits of state and a 64-bit increment that selects one of 2^63
+/// independent sequences. Any position of a sequence can be reached in logarithmic time with
+/// advance(), so the numbers used by a pixel sample can be made to depend only on the pixel,
+/// the sample index and the frame instead of on the order in which threads render.
+/// See https://www.pcg-random.org
+class Pcg32
+{
+public:
+    /// @brief Default constructor, starts the default sequence
+    Pcg32() : m_state(DEFAULT_STATE), m_increment(DEFAULT_STREAM) {}
+
+    /// @brief Constructor
+    /// @param sequenceIndex the sequence to draw numbers from
+    /// @param seed the starting offset into the sequence
+    Pcg32(const uint64_t sequenceIndex, const uint64_t seed) { this->setSequence(sequenceIndex, seed); }
+
+    /// @brief Restart the generator on a sequence
+    /// @param sequenceIndex the sequence to draw numbers from
+    /// @param seed the starting offset into the sequence
+    void setSequence(const uint64_t sequenceIndex, const uint64_t seed)
+    {
+        m_state = 0u;
+        m_increment = (sequenceIndex << 1u) | 1u;
+        this->nextUInt();
+        m_state += seed;
+        this->nextUInt();
+    }
+
+    /// @brief Generate a uniformly distributed 32-bit integer
+    uint32_t nextUInt()
+    {
+        const uint64_t oldState = m_state;
+        m_state = oldState * MULTIPLIER + m_increment;
+        const uint32_t xorShifted = static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u);
+        const uint32_t rotation = static_cast<uint32_t>(oldState >> 59u);
+        return (xorShifted >> rotation) | (xorShifted << ((~rotation + 1u) & 31u));
+    }
+
+    /// @brief Generate a uniformly distributed integer in [0,bound) without modulo bias
+    /// @param bound the exclusive upper bound, must be positive
+    uint32_t nextUInt(const uint32_t bound)
+    {
+        const uint32_t threshold = (~bound + 1u) % bound;
+        while(true)
+        {
+            const uint32_t value = this->nextUInt();
+            if(value >= threshold)
+            {
+                return value % bound;
+            }
+        }
+    }
+
+    /// @brief Generate a uniformly distributed float in [0,1)
+    float nextFloat()
+    {
+        // Scale by 2^-32 and clamp to the largest float below 1, rounding may otherwise produce 1
+        const float oneMinusEpsilon = 0.99999994f;
+        return std::min(oneMinusEpsilon, static_cast<float>(this->nextUInt()) * 2.3283064365386963e-10f);
+    }
+
+    /// @brief Skip ahead or back in the sequence
+    /// @param delta the number of 32-bit outputs to skip, may be negative
+    void advance(const int64_t delta)
+    {
+        uint64_t currentMultiplier = MULTIPLIER;
+        uint64_t currentIncrement = m_increment;
+        uint64_t accumulatedMultiplier = 1u;
+        uint64_t accumulatedIncrement = 0u;
+        for(uint64_t remaining = static_cast<uint64_t>(delta); remaining > 0; remaining /= 2)
+        {
+            if(remaining & 1)
+            {
+                accumulatedMultiplier *= currentMultiplier;
+                accumulatedIncrement = accumulatedIncrement * currentMultiplier + currentIncrement;
+            }
+            currentIncrement = (currentMultiplier + 1) * currentIncrement;
+            currentMultiplier *= currentMultiplier;
+        }
+        m_state = accumulatedMultiplier * m_state + accumulatedIncrement;
+    }
+
+    /// @brief Scramble the bits of a value, used to turn structured keys such as pixel
+    ///        indices into well distributed sequence indices
+    /// @param value the value to scramble
+    /// @return the scrambled value
+    static uint64_t mixBits(uint64_t value)
+    {
+        value ^= value >> 31;
+        value *= 0x7fb5d329728ea185ull;
+        value ^= value >> 27;
+        value *= 0x81dadef4bc2dd44dull;
+        value ^= value >> 33;
+        return value;
+    }
+
+private:
+    static constexpr uint64_t DEFAULT_STATE = 0x853c49e6748fea9bull;
+    static constexpr uint64_t DEFAULT_STREAM = 0xda3e39cb94b95bdbull;
+    static constexpr uint64_t MULTIPLIER = 0x5851f42d4c957f2dull;
+
+    uint64_t m_state;
+    uint64_t m_increment;
+};
+} // namespace raytracer
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Ray.h"
+
+#include <glm/vec3.hpp>
+
+namespace raytracer
+{
+/// @class RayPacket
+/// @brief A group of up to 16 coherent rays, e.g. the primary rays of a 4x4 pixel tile.
+///
+/// Origins, directions and intervals are stored in structure-of-arrays layout so the rays can
+/// be tested against a BVH node together. The packet is traversed as a whole as long as its
+/// direction signs agree on every axis; otherwise the rays are traced one by one.
+class RayPacket
+{
+public:
+    /// @brief maximum number of rays in a packet
+    static const int MAX_SIZE = 16;
+
+    /// @brief Default constructor, creates an empty packet
+    RayPacket() : m_size(0) {}
+
+    /// @brief Remove all rays from the packet
+    void clear() noexcept { m_size = 0; }
+
+    /// @brief Add a ray to the packet
+    /// @param ray the ray to add
+    /// @return the index of the ray in the packet, or -1 if the packet is full
+    int add(const Ray &ray)
+    {
+        if(m_size >= MAX_SIZE)
+        {
+            return -1;
+        }
+
+        const glm::vec3 origin = ray.origin();
+        const glm::vec3 direction = ray.direction();
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            m_origin[axis][m_size] = origin[axis];
+            m_direction[axis][m_size] = direction[axis];
+            m_invDirection[axis][m_size] = 1.0f / direction[axis];
+        }
+        m_tMin[m_size] = ray.tMin();
+        m_tMax[m_size] = ray.tMax();
+
+        return m_size++;
+    }
+
+    /// @brief Get the number of rays in the packet
+    int size() const noexcept { return m_size; }
+
+    /// @brief Get a ray of the packet
+    /// @param i the index of the ray
+    /// @return the ray with its current interval
+    Ray ray(const int i) const
+    {
+        return Ray(glm::vec3(m_origin[0][i], m_origin[1][i], m_origin[2][i]),
+                   glm::vec3(m_direction[0][i], m_direction[1][i], m_direction[2][i]),
+                   m_tMin[i],
+                   m_tMax[i]);
+    }
+
+    //@{
+    /// @brief Get the structure-of-arrays ray data, indexed by axis then by ray
+    const float (&origins() const)[3][MAX_SIZE] { return m_origin; }
+    const float (&directions() const)[3][MAX_SIZE] { return m_direction; }
+    const float (&invDirections() const)[3][MAX_SIZE] { return m_invDirection; }
+    //@}
+
+    //@{
+    /// @brief Get/Set the interval of a ray. Traversal narrows tMax as hits are found.
+    float tMin(const int i) const noexcept { return m_tMin[i]; }
+    float tMax(const int i) const noexcept { return m_tMax[i]; }
+    void setTMax(const int i, const float tMax) noexcept { m_tMax[i] = tMax; }
+    //@}
+
+    /// @brief Check if all ray directions have the same sign on every axis, which the packet
+    ///        traversal needs for its conservative interval test
+    /// @return true if the packet can be traversed as a whole
+    bool isCoherent() const noexcept
+    {
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            const bool negative = m_invDirection[axis][0] < 0.0f;
+            for(int i = 1; i < m_size; ++i)
+            {
+                if((m_invDirection[axis][i] < 0.0f) != negative)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    int m_size;
+    float m_origin[3][MAX_SIZE];
+    float m_direction[3][MAX_SIZE];
+    float m_invDirection[3][MAX_SIZE];
+    float m_tMin[MAX_SIZE];
+    float m_tMax[MAX_SIZE];
+};
+} // namespace raytracer
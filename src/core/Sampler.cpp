@@ -0,0 +1,350 @@
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <glm/common.hpp>
+
+namespace raytracer
+{
+namespace
+{
+/// Numbers of the PCG32 sequence of a pixel reserved for each of its samples
+const int64_t SEQUENCE_NUMBERS_PER_SAMPLE = 1 << 16;
+/// Number of dimensions with their own prime base in the Halton sampler
+const int HALTON_DIMENSIONS = 1000;
+
+//----------------------------------------------------------------------------------
+// Convert 32 random bits to a float in [0,1)
+float toUnitFloat(const uint32_t bits)
+{
+    const float oneMinusEpsilon = 0.99999994f;
+    return std::min(oneMinusEpsilon, static_cast<float>(bits) * 2.3283064365386963e-10f);
+}
+
+//----------------------------------------------------------------------------------
+// Element i of a pseudo-random permutation of [0,length) selected by seed, see Kensler,
+// "Correlated Multi-Jittered Sampling"
+int permutationElement(uint32_t i, const uint32_t length, const uint32_t seed)
+{
+    uint32_t mask = length - 1;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+
+    // Cycle walk until the hashed index falls into the range
+    do
+    {
+        i ^= seed;
+        i *= 0xe170893d;
+        i ^= seed >> 16;
+        i ^= (i & mask) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3f;
+        i ^= seed >> 23;
+        i ^= (i & mask) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & mask) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & mask) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & mask) >> 2;
+        i *= 0xc860a3df;
+        i &= mask;
+        i ^= i >> 5;
+    } while(i >= length);
+
+    return static_cast<int>((i + seed) % length);
+}
+
+//----------------------------------------------------------------------------------
+uint32_t reverseBits(uint32_t v)
+{
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+//----------------------------------------------------------------------------------
+// Owen scrambling of the bits of a value in [0,1) in fixed point: every bit is flipped
+// depending on the bits above it. Uses the hash of Laine and Karras, which scrambles the
+// higher bits well at a fraction of the cost of the exact construction.
+uint32_t owenScramble(uint32_t v, const uint32_t seed)
+{
+    v = reverseBits(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return reverseBits(v);
+}
+
+//----------------------------------------------------------------------------------
+// Dimension 0 or 1 of the Sobol sequence in fixed point. The generator matrix of dimension 0
+// is the bit reversal (van der Corput), that of dimension 1 follows from the primitive
+// polynomial x + 1.
+uint32_t sobol(uint32_t index, const int dimension)
+{
+    uint32_t result = 0;
+    uint32_t direction = 0x80000000u;
+    for(; index != 0; index >>= 1)
+    {
+        if(index & 1)
+        {
+            result ^= direction;
+        }
+        direction = dimension == 0 ? direction >> 1 : direction ^ (direction >> 1);
+    }
+    return result;
+}
+
+//----------------------------------------------------------------------------------
+const std::vector<int> &primes()
+{
+    static const std::vector<int> table = []()
+    {
+        std::vector<int> result;
+        result.reserve(HALTON_DIMENSIONS);
+        for(int candidate = 2; static_cast<int>(result.size()) < HALTON_DIMENSIONS; ++candidate)
+        {
+            bool isPrime = true;
+            for(const int prime : result)
+            {
+                if(prime * prime > candidate)
+                {
+                    break;
+                }
+                if(candidate % prime == 0)
+                {
+                    isPrime = false;
+                    break;
+                }
+            }
+            if(isPrime)
+            {
+                result.push_back(candidate);
+            }
+        }
+        return result;
+    }();
+    return table;
+}
+
+//----------------------------------------------------------------------------------
+// Radical inverse of index in a prime base with every digit shifted by a random offset that
+// depends on the digits below it, a nested variant of Owen scrambling in base b. Digits are
+// produced until they no longer change the float result, so the zero digits above the index
+// are scrambled as well.
+float owenScrambledRadicalInverse(const int base, uint64_t index, const uint64_t seed)
+{
+    const uint64_t limit = ~0ull / base - base;
+    const float invBase = 1.0f / static_cast<float>(base);
+    float invBaseM = 1.0f;
+    uint64_t reversedDigits = 0;
+    for(uint64_t digitIndex = 0; 1.0f - invBaseM < 1.0f && reversedDigits < limit; ++digitIndex)
+    {
+        // Key the offset by the position as well, prefixes of zero digits differ only in length
+        const uint64_t next = index / base;
+        const uint64_t digit = index - next * base;
+        const uint64_t offset = Pcg32::mixBits(seed ^ (digitIndex << 56) ^ reversedDigits) % base;
+        reversedDigits = reversedDigits * base + (digit + offset) % base;
+        invBaseM *= invBase;
+        index = next;
+    }
+    return std::min(0.99999994f, invBaseM * static_cast<float>(reversedDigits));
+}
+} // namespace
+
+//----------------------------------------------------------------------------------
+Sampler::Sampler(const int samplesPerPixel, const uint32_t seed)
+    : m_samplesPerPixel(samplesPerPixel)
+    , m_seed(seed)
+    , m_pixel(0)
+    , m_sampleIndex(0)
+    , m_dimension(0)
+{
+    if(samplesPerPixel <= 0)
+    {
+        throw std::invalid_argument("Samplers need at least one sample per pixel");
+    }
+}
+
+//----------------------------------------------------------------------------------
+std::unique_ptr<Sampler> Sampler::create(const Type type, const int samplesPerPixel, const uint32_t seed)
+{
+    switch(type)
+    {
+    case Type::Independent:
+        return std::unique_ptr<Sampler>(new IndependentSampler(samplesPerPixel, seed));
+    case Type::Stratified:
+        return std::unique_ptr<Sampler>(new StratifiedSampler(samplesPerPixel, seed));
+    case Type::Sobol:
+        return std::unique_ptr<Sampler>(new SobolSampler(samplesPerPixel, seed));
+    case Type::Halton:
+        return std::unique_ptr<Sampler>(new HaltonSampler(samplesPerPixel, seed));
+    }
+    throw std::invalid_argument("Unknown sampler type");
+}
+
+//----------------------------------------------------------------------------------
+void Sampler::startPixelSample(const int pixel, const int sampleIndex, const int dimension)
+{
+    m_pixel = pixel;
+    m_sampleIndex = sampleIndex;
+    m_dimension = dimension;
+}
+
+//----------------------------------------------------------------------------------
+uint64_t Sampler::hash(const int dimension) const
+{
+    const uint64_t pixelHash = Pcg32::mixBits((static_cast<uint64_t>(m_seed) << 32) | static_cast<uint32_t>(m_pixel));
+    return Pcg32::mixBits(pixelHash ^ static_cast<uint64_t>(dimension));
+}
+
+//----------------------------------------------------------------------------------
+uint64_t Sampler::patternHash(const int dimension, const int patternSize) const
+{
+    // The first block keeps the plain hash, so renders within the sample count are unchanged
+    const uint64_t block = static_cast<uint64_t>(m_sampleIndex / patternSize);
+    const uint64_t dimensionHash = this->hash(dimension);
+    return block == 0 ? dimensionHash : Pcg32::mixBits(dimensionHash ^ (block << 32));
+}
+
+//----------------------------------------------------------------------------------
+std::unique_ptr<Sampler> IndependentSampler::clone() const
+{
+    return std::unique_ptr<Sampler>(new IndependentSampler(*this));
+}
+
+//----------------------------------------------------------------------------------
+void IndependentSampler::startPixelSample(const int pixel, const int sampleIndex, const int dimension)
+{
+    this->Sampler::startPixelSample(pixel, sampleIndex, dimension);
+    m_generator.setSequence(this->hash(0), Pcg32::mixBits(m_seed));
+    m_generator.advance(sampleIndex * SEQUENCE_NUMBERS_PER_SAMPLE + dimension);
+}
+
+//----------------------------------------------------------------------------------
+float IndependentSampler::get1D()
+{
+    ++m_dimension;
+    return m_generator.nextFloat();
+}
+
+//----------------------------------------------------------------------------------
+glm::vec2 IndependentSampler::get2D()
+{
+    m_dimension += 2;
+    const float x = m_generator.nextFloat();
+    const float y = m_generator.nextFloat();
+    return glm::vec2(x, y);
+}
+
+//----------------------------------------------------------------------------------
+StratifiedSampler::StratifiedSampler(const int samplesPerPixel, const uint32_t seed)
+    : Sampler(samplesPerPixel, seed)
+    , m_gridSize(std::max(1, static_cast<int>(std::sqrt(static_cast<float>(samplesPerPixel)))))
+{
+}
+
+//----------------------------------------------------------------------------------
+std::unique_ptr<Sampler> StratifiedSampler::clone() const
+{
+    return std::unique_ptr<Sampler>(new StratifiedSampler(*this));
+}
+
+//----------------------------------------------------------------------------------
+void StratifiedSampler::startPixelSample(const int pixel, const int sampleIndex, const int dimension)
+{
+    this->Sampler::startPixelSample(pixel, sampleIndex, dimension);
+    m_generator.setSequence(this->hash(0), Pcg32::mixBits(m_seed));
+    m_generator.advance(sampleIndex * SEQUENCE_NUMBERS_PER_SAMPLE + dimension);
+}
+
+//----------------------------------------------------------------------------------
+float StratifiedSampler::get1D()
+{
+    const uint32_t seed = static_cast<uint32_t>(this->patternHash(m_dimension, m_samplesPerPixel));
+    const int stratum = permutationElement(m_sampleIndex % m_samplesPerPixel, m_samplesPerPixel, seed);
+    ++m_dimension;
+
+    const float jitter = m_generator.nextFloat();
+    return std::min(0.99999994f, (stratum + jitter) / m_samplesPerPixel);
+}
+
+//----------------------------------------------------------------------------------
+glm::vec2 StratifiedSampler::get2D()
+{
+    // The grid covers the largest square number of samples, further samples start a new grid
+    const int strata = m_gridSize * m_gridSize;
+    const uint32_t seed = static_cast<uint32_t>(this->patternHash(m_dimension, strata));
+    const int stratum = permutationElement(m_sampleIndex % strata, strata, seed);
+    m_dimension += 2;
+
+    const float jitterX = m_generator.nextFloat();
+    const float jitterY = m_generator.nextFloat();
+    return glm::min(glm::vec2(0.99999994f),
+                    glm::vec2(stratum % m_gridSize + jitterX, stratum / m_gridSize + jitterY) / static_cast<float>(m_gridSize));
+}
+
+//----------------------------------------------------------------------------------
+std::unique_ptr<Sampler> SobolSampler::clone() const
+{
+    return std::unique_ptr<Sampler>(new SobolSampler(*this));
+}
+
+//----------------------------------------------------------------------------------
+float SobolSampler::get1D()
+{
+    const uint64_t hash = this->patternHash(m_dimension, m_samplesPerPixel);
+    const int index = permutationElement(m_sampleIndex % m_samplesPerPixel, m_samplesPerPixel, static_cast<uint32_t>(hash));
+    ++m_dimension;
+
+    return toUnitFloat(owenScramble(sobol(index, 0), static_cast<uint32_t>(hash >> 32)));
+}
+
+//----------------------------------------------------------------------------------
+glm::vec2 SobolSampler::get2D()
+{
+    const uint64_t hash = this->patternHash(m_dimension, m_samplesPerPixel);
+    const int index = permutationElement(m_sampleIndex % m_samplesPerPixel, m_samplesPerPixel, static_cast<uint32_t>(hash));
+    m_dimension += 2;
+
+    // Scramble the two dimensions independently
+    const uint64_t scrambleSeeds = Pcg32::mixBits(hash);
+    return glm::vec2(toUnitFloat(owenScramble(sobol(index, 0), static_cast<uint32_t>(scrambleSeeds))),
+                     toUnitFloat(owenScramble(sobol(index, 1), static_cast<uint32_t>(scrambleSeeds >> 32))));
+}
+
+//----------------------------------------------------------------------------------
+std::unique_ptr<Sampler> HaltonSampler::clone() const
+{
+    return std::unique_ptr<Sampler>(new HaltonSampler(*this));
+}
+
+//----------------------------------------------------------------------------------
+float HaltonSampler::get1D()
+{
+    // Dimensions beyond the table reuse its bases with other scrambles
+    const int base = primes()[m_dimension % HALTON_DIMENSIONS];
+    const float value = owenScrambledRadicalInverse(base, m_sampleIndex, this->hash(m_dimension));
+    ++m_dimension;
+    return value;
+}
+
+//----------------------------------------------------------------------------------
+glm::vec2 HaltonSampler::get2D()
+{
+    const float x = this->get1D();
+    const float y = this->get1D();
+    return glm::vec2(x, y);
+}
+} // namespace raytracer
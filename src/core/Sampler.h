@@ -0,0 +1,184 @@
+#pragma once
+
+#include "Pcg32.h"
+
+#include <glm/vec2.hpp>
+
+#include <cstdint>
+#include <memory>
+
+namespace raytracer
+{
+/// @class Sampler
+/// @brief Generates the sample values consumed by the camera rays and the paths of a pixel.
+///
+/// Every pixel sample draws its values dimension by dimension: the camera takes the first
+/// dimensions for the position in the pixel and on the lens, and every bounce of the path
+/// takes the same number of dimensions after that. The values of a dimension depend only on
+/// the pixel, the sample index, the dimension and the seed, so a sample can be suspended and
+/// resumed at any dimension with startPixelSample(). Samplers other than the independent one
+/// distribute the values of a dimension over the samples of a pixel more evenly than random
+/// numbers, which lowers the variance of the pixel estimates.
+class Sampler
+{
+public:
+    /// @brief Algorithm used to generate the sample values
+    enum class Type
+    {
+        Independent,    ///< uniform random values
+        Stratified,     ///< one jittered value per stratum, strata shuffled per dimension
+        Sobol,          ///< Owen-scrambled Sobol points, shuffled per dimension pair
+        Halton          ///< Owen-scrambled Halton points with one prime base per dimension
+    };
+
+    /// @brief Constructor
+    /// @param samplesPerPixel the number of samples taken per pixel
+    /// @param seed selects independent sample patterns, e.g. per frame
+    explicit Sampler(int samplesPerPixel, uint32_t seed = 0);
+
+    /// @brief Destructor
+    virtual ~Sampler() = default;
+
+    /// @brief Create a sampler
+    /// @param type the algorithm used to generate the sample values
+    /// @param samplesPerPixel the number of samples taken per pixel
+    /// @param seed selects independent sample patterns, e.g. per frame
+    /// @return the sampler
+    static std::unique_ptr<Sampler> create(Type type, int samplesPerPixel, uint32_t seed = 0);
+
+    /// @brief Copy the sampler, e.g. to give every thread its own
+    virtual std::unique_ptr<Sampler> clone() const = 0;
+
+    /// @brief Get the number of samples taken per pixel
+    int getSamplesPerPixel() const { return m_samplesPerPixel; }
+
+    /// @brief Start or resume drawing the values of a pixel sample
+    /// @param pixel the index of the pixel
+    /// @param sampleIndex the index of the sample within the pixel
+    /// @param dimension the first dimension to draw, as returned by getDimension()
+    virtual void startPixelSample(int pixel, int sampleIndex, int dimension = 0);
+
+    /// @brief Get the next dimension that will be drawn
+    int getDimension() const { return m_dimension; }
+
+    /// @brief Draw the value of the next dimension
+    /// @return the value in [0,1)
+    virtual float get1D() = 0;
+
+    /// @brief Draw the values of the next two dimensions
+    /// @return the values in [0,1)^2
+    virtual glm::vec2 get2D() = 0;
+
+    /// @brief Draw the position of the sample within the pixel
+    /// @return the position in [0,1)^2
+    virtual glm::vec2 getPixel2D() { return this->get2D(); }
+
+protected:
+    /// @brief Get a hash of the current pixel, the seed and a dimension
+    uint64_t hash(int dimension) const;
+
+    /// @brief Get a hash of the current pixel, the seed, a dimension and the block of
+    ///        patternSize samples the current sample falls into. Samplers whose patterns
+    ///        cover a fixed number of samples draw every further block from a new pattern,
+    ///        so sample indices past the sample count do not repeat earlier samples.
+    uint64_t patternHash(int dimension, int patternSize) const;
+
+    int m_samplesPerPixel;
+    uint32_t m_seed;
+    int m_pixel;
+    int m_sampleIndex;
+    int m_dimension;
+};
+
+/// @class IndependentSampler
+/// @brief Draws uniform random values, one number of a PCG32 sequence per dimension.
+class IndependentSampler : public Sampler
+{
+public:
+    /// @see Sampler::Sampler
+    explicit IndependentSampler(int samplesPerPixel, uint32_t seed = 0) : Sampler(samplesPerPixel, seed) {}
+
+    /// @see Sampler::clone
+    std::unique_ptr<Sampler> clone() const override;
+
+    /// @see Sampler::startPixelSample
+    void startPixelSample(int pixel, int sampleIndex, int dimension = 0) override;
+
+    /// @see Sampler::get1D
+    float get1D() override;
+
+    /// @see Sampler::get2D
+    glm::vec2 get2D() override;
+
+private:
+    Pcg32 m_generator;
+};
+
+/// @class StratifiedSampler
+/// @brief Splits every dimension into one stratum per sample, and every pair of dimensions
+///        into a grid of strata, and places one jittered value in each stratum. The strata
+///        are visited in a different order per pixel and dimension so that dimensions do not
+///        correlate. Samples beyond the number of strata are stratified anew.
+class StratifiedSampler : public Sampler
+{
+public:
+    /// @see Sampler::Sampler
+    explicit StratifiedSampler(int samplesPerPixel, uint32_t seed = 0);
+
+    /// @see Sampler::clone
+    std::unique_ptr<Sampler> clone() const override;
+
+    /// @see Sampler::startPixelSample
+    void startPixelSample(int pixel, int sampleIndex, int dimension = 0) override;
+
+    /// @see Sampler::get1D
+    float get1D() override;
+
+    /// @see Sampler::get2D
+    glm::vec2 get2D() override;
+
+private:
+    int m_gridSize;
+    Pcg32 m_generator;
+};
+
+/// @class SobolSampler
+/// @brief Draws the first two dimensions of the Sobol sequence for every pair of dimensions,
+///        with the sample order shuffled and the values Owen-scrambled per pixel and pair.
+///        The points are best distributed when the number of samples is a power of two.
+///        Every further block of that many samples is shuffled and scrambled anew.
+class SobolSampler : public Sampler
+{
+public:
+    /// @see Sampler::Sampler
+    explicit SobolSampler(int samplesPerPixel, uint32_t seed = 0) : Sampler(samplesPerPixel, seed) {}
+
+    /// @see Sampler::clone
+    std::unique_ptr<Sampler> clone() const override;
+
+    /// @see Sampler::get1D
+    float get1D() override;
+
+    /// @see Sampler::get2D
+    glm::vec2 get2D() override;
+};
+
+/// @class HaltonSampler
+/// @brief Draws the radical inverse of the sample index in a different prime base per
+///        dimension, with the digits Owen-scrambled per pixel and dimension.
+class HaltonSampler : public Sampler
+{
+public:
+    /// @see Sampler::Sampler
+    explicit HaltonSampler(int samplesPerPixel, uint32_t seed = 0) : Sampler(samplesPerPixel, seed) {}
+
+    /// @see Sampler::clone
+    std::unique_ptr<Sampler> clone() const override;
+
+    /// @see Sampler::get1D
+    float get1D() override;
+
+    /// @see Sampler::get2D
+    glm::vec2 get2D() override;
+};
+} // namespace raytracer
@@ -0,0 +1,257 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace raytracer
+{
+namespace
+{
+/// Size of the process-wide pool set by ThreadPool::configureGlobal(), -1 if not set
+int g_globalThreadCount = -1;
+/// Whether the workers of the process-wide pool are pinned, set by ThreadPool::configureGlobal()
+bool g_globalPinThreads = false;
+/// Whether the process-wide pool has been started
+bool g_globalStarted = false;
+
+//----------------------------------------------------------------------------------
+// Bind a thread to one core. Only supported on Linux, elsewhere the request is ignored.
+void pinToCore(std::thread &thread, const int core)
+{
+#if defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core, &cpuSet);
+    if(pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuSet) != 0)
+    {
+        std::clog << "Could not pin worker thread to core " << core << "\n";
+    }
+#else
+    (void)thread;
+    (void)core;
+#endif
+}
+} // namespace
+
+//----------------------------------------------------------------------------------
+ThreadPool::TaskGroup::~TaskGroup()
+{
+    try
+    {
+        this->wait();
+    }
+    catch(...)
+    {
+        // Exceptions are only reported by an explicit wait()
+    }
+}
+
+//----------------------------------------------------------------------------------
+void ThreadPool::TaskGroup::run(std::function<void()> task)
+{
+    m_pool.submit(Task{std::move(task), this});
+}
+
+//----------------------------------------------------------------------------------
+void ThreadPool::TaskGroup::wait()
+{
+    std::unique_lock<std::mutex> lock(m_pool.m_mutex);
+    while(m_pending > 0)
+    {
+        // Run queued tasks, this group's or others, rather than leave a thread blocked
+        if(!m_pool.runQueuedTask(lock))
+        {
+            m_pool.m_taskFinished.wait(lock);
+        }
+    }
+
+    if(m_exception)
+    {
+        std::exception_ptr exception = m_exception;
+        m_exception = nullptr;
+        lock.unlock();
+        std::rethrow_exception(exception);
+    }
+}
+
+//----------------------------------------------------------------------------------
+ThreadPool::ThreadPool(const int threadCount, const bool pinThreads)
+    : m_stopping(false)
+{
+    const int hardwareThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int totalThreads = threadCount > 0 ? threadCount : hardwareThreads;
+
+    m_workers.reserve(totalThreads - 1);
+    for(int w = 1; w < totalThreads; ++w)
+    {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this);
+        if(pinThreads)
+        {
+            // Core 0 is left free for the submitting thread, which is not pinned
+            pinToCore(m_workers.back(), w % hardwareThreads);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_taskAvailable.notify_all();
+
+    for(auto &worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+//----------------------------------------------------------------------------------
+ThreadPool &ThreadPool::global()
+{
+    static const std::unique_ptr<ThreadPool> pool = []()
+    {
+        int threadCount = g_globalThreadCount;
+        bool pinThreads = g_globalPinThreads;
+        if(threadCount < 0)
+        {
+            const char *threadsVariable = std::getenv("RAYTRACER_THREADS");
+            const char *pinVariable = std::getenv("RAYTRACER_PIN_THREADS");
+            threadCount = threadsVariable ? std::max(0, std::atoi(threadsVariable)) : 0;
+            pinThreads = pinVariable && std::string(pinVariable) != "0";
+        }
+        g_globalStarted = true;
+        return std::unique_ptr<ThreadPool>(new ThreadPool(threadCount, pinThreads));
+    }();
+    return *pool;
+}
+
+//----------------------------------------------------------------------------------
+void ThreadPool::configureGlobal(const int threadCount, const bool pinThreads)
+{
+    if(g_globalStarted)
+    {
+        std::clog << "The thread pool is already running, its size can no longer be changed\n";
+        return;
+    }
+    g_globalThreadCount = std::max(0, threadCount);
+    g_globalPinThreads = pinThreads;
+}
+
+//----------------------------------------------------------------------------------
+int ThreadPool::parallelFor(const size_t count,
+                            const size_t minChunkSize,
+                            const std::function<void(size_t, size_t, int)> &func)
+{
+    return this->parallelFor(count, minChunkSize, this->getThreadCount(), func);
+}
+
+//----------------------------------------------------------------------------------
+int ThreadPool::parallelFor(const size_t count,
+                            const size_t minChunkSize,
+                            const int maxChunks,
+                            const std::function<void(size_t, size_t, int)> &func)
+{
+    const size_t chunkCount = std::min(static_cast<size_t>(std::max(1, maxChunks)),
+                                       count / std::max<size_t>(1, minChunkSize));
+
+    if(chunkCount <= 1)
+    {
+        func(0, count, 0);
+        return 1;
+    }
+
+    TaskGroup group(*this);
+    for(size_t c = 1; c < chunkCount; ++c)
+    {
+        group.run([&func, c, count, chunkCount]()
+        {
+            func(c * count / chunkCount, (c + 1) * count / chunkCount, static_cast<int>(c));
+        });
+    }
+    func(0, count / chunkCount, 0);
+    group.wait();
+
+    return static_cast<int>(chunkCount);
+}
+
+//----------------------------------------------------------------------------------
+void ThreadPool::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+        m_taskAvailable.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+        if(!this->runQueuedTask(lock))
+        {
+            return;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------
+void ThreadPool::submit(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++task.group->m_pending;
+        m_queue.push_back(std::move(task));
+    }
+    m_taskAvailable.notify_one();
+
+    // Threads waiting for a group may take the task too
+    m_taskFinished.notify_all();
+}
+
+//----------------------------------------------------------------------------------
+bool ThreadPool::runQueuedTask(std::unique_lock<std::mutex> &lock)
+{
+    if(m_queue.empty())
+    {
+        return false;
+    }
+
+    Task task = std::move(m_queue.front());
+    m_queue.pop_front();
+    lock.unlock();
+    this->execute(task);
+    lock.lock();
+    return true;
+}
+
+//----------------------------------------------------------------------------------
+void ThreadPool::execute(Task &task)
+{
+    std::exception_ptr exception;
+    try
+    {
+        task.function();
+    }
+    catch(...)
+    {
+        exception = std::current_exception();
+    }
+
+    // The group may be destroyed as soon as its last task is counted, so it is not touched
+    // after the count drops
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(exception && !task.group->m_exception)
+        {
+            task.group->m_exception = exception;
+        }
+        --task.group->m_pending;
+    }
+    m_taskFinished.notify_all();
+}
+} // namespace raytracer
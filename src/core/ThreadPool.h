@@ -0,0 +1,123 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raytracer
+{
+/// @class ThreadPool
+/// @brief A fixed set of worker threads that run tasks submitted by any phase of the program.
+///
+/// The workers are started once and kept until the pool is destroyed, so rendering many
+/// frames or building many trees does not pay for creating threads every time. Tasks are
+/// submitted through a TaskGroup and awaited with TaskGroup::wait(). A waiting thread runs
+/// queued tasks itself instead of blocking, so tasks may submit and wait for further tasks,
+/// e.g. to build the subtrees of a tree in parallel, without running out of workers.
+///
+/// Most code uses the process-wide pool returned by global(). Its size and whether its
+/// workers are pinned to cores can be set with configureGlobal() before it is first used, or
+/// with the environment variables RAYTRACER_THREADS and RAYTRACER_PIN_THREADS.
+class ThreadPool
+{
+public:
+    /// @class TaskGroup
+    /// @brief Tasks submitted to a pool that are awaited together.
+    class TaskGroup
+    {
+    public:
+        /// @brief Constructor
+        /// @param pool the pool that runs the tasks
+        explicit TaskGroup(ThreadPool &pool) : m_pool(pool), m_pending(0) {}
+
+        /// @brief Destructor, waits for the remaining tasks
+        ~TaskGroup();
+
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        /// @brief Submit a task to the pool
+        /// @param task the function to run
+        void run(std::function<void()> task);
+
+        /// @brief Wait until all submitted tasks have finished, running queued tasks meanwhile
+        /// @throw the first exception thrown by a task of the group
+        void wait();
+
+    private:
+        friend class ThreadPool;
+
+        ThreadPool &m_pool;
+        int m_pending;                  ///< guarded by the pool's mutex
+        std::exception_ptr m_exception; ///< guarded by the pool's mutex
+    };
+
+    /// @brief Constructor, starts the workers
+    /// @param threadCount the number of threads running tasks including the thread that waits
+    ///        for them, so threadCount-1 workers are started. 0 uses one per hardware thread.
+    /// @param pinThreads whether to bind every worker to its own core, where supported
+    explicit ThreadPool(int threadCount = 0, bool pinThreads = false);
+
+    /// @brief Destructor, lets the workers finish the queued tasks and joins them
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// @brief Get the process-wide pool, started on first use
+    static ThreadPool &global();
+
+    /// @brief Set the size of the process-wide pool. Has no effect once the pool is started.
+    /// @param threadCount the number of threads, 0 for one per hardware thread
+    /// @param pinThreads whether to bind every worker to its own core
+    static void configureGlobal(int threadCount, bool pinThreads);
+
+    /// @brief Get the number of threads that run tasks, including the waiting thread
+    int getThreadCount() const { return static_cast<int>(m_workers.size()) + 1; }
+
+    /// @brief Split [0,count) into contiguous chunks and run func(begin, end, chunk) on each
+    ///        chunk in parallel. The calling thread runs the first chunk.
+    /// @param count the number of items
+    /// @param minChunkSize the smallest number of items worth a chunk of its own
+    /// @param func the function to run on every chunk
+    /// @return the number of chunks, at most getThreadCount()
+    int parallelFor(size_t count, size_t minChunkSize, const std::function<void(size_t, size_t, int)> &func);
+
+    /// @brief Split [0,count) into at most maxChunks contiguous chunks and run
+    ///        func(begin, end, chunk) on each chunk in parallel. The chunks depend only on the
+    ///        arguments, not on the size of the pool, so results merged in chunk order are the
+    ///        same with any number of threads. The calling thread runs the first chunk.
+    /// @param count the number of items
+    /// @param minChunkSize the smallest number of items worth a chunk of its own
+    /// @param maxChunks the largest number of chunks, may exceed getThreadCount()
+    /// @param func the function to run on every chunk
+    /// @return the number of chunks
+    int parallelFor(size_t count, size_t minChunkSize, int maxChunks, const std::function<void(size_t, size_t, int)> &func);
+
+private:
+    /// @struct Task
+    /// @brief A queued function and the group that waits for it
+    struct Task
+    {
+        std::function<void()> function;
+        TaskGroup *group;
+    };
+
+    void workerLoop();
+    void submit(Task task);
+    bool runQueuedTask(std::unique_lock<std::mutex> &lock);
+    void execute(Task &task);
+
+    std::vector<std::thread> m_workers;
+    std::deque<Task> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_taskAvailable;
+    std::condition_variable m_taskFinished;
+    bool m_stopping;
+};
+} // namespace raytracer
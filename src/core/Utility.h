@@ -1,9 +1,15 @@
 #ifndef INCLUDED_RAYTRACING_UTILITY_H
 #define INCLUDED_RAYTRACING_UTILITY_H
 
+#include "Pcg32.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
-#include <random>
+#include <limits>
 
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp> // glm::pi
@@ -31,13 +37,36 @@ public:
     // https://en.wikipedia.org/wiki/SRGB
     // https://en.wikipedia.org/wiki/Gamma_correction
 
+    /// @brief Get the random number generator of the calling thread. Every random number of
+    ///        the renderer is drawn from it.
+    /// @return the generator of the calling thread
+    static Pcg32 &randomGenerator()
+    {
+        thread_local Pcg32 generator;
+        return generator;
+    }
+
+    /// @brief Generate a random float in the range [0,1).
+    /// @return a random float in the range [0,1)
+    static float randomFloat()
+    {
+        return randomGenerator().nextFloat();
+    }
+
+    /// @brief Generate a random float in the range [min,max).
+    /// @param min the minimum value of the range
+    /// @param max the maximum value of the range
+    /// @return a random float in the range [min,max)
+    static float randomFloat(const float min, const float max)
+    {
+        return min + (max - min) * randomFloat();
+    }
+
     /// @brief Generate a random double in the range [0,1).
     /// @return a random double in the range [0,1)
     static double randomDouble()
     {
-        thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
-        thread_local std::mt19937 generator(std::random_device{}());  // seed once
-        return distribution(generator);
+        return static_cast<double>(randomFloat());
     }
 
     /// @brief Generate a random double in the range [min,max).
@@ -55,9 +84,10 @@ public:
     /// @return a random integer in the range [min,max]
     static int randomInt(int min, int max)
     {
-        std::uniform_int_distribution<int> distribution(min, max);
-        thread_local std::mt19937 generator(std::random_device{}());
-        return distribution(generator);
+        const uint32_t range = static_cast<uint32_t>(static_cast<int64_t>(max) - min + 1);
+        // A range of zero means all 2^32 values
+        const uint32_t value = range == 0 ? randomGenerator().nextUInt() : randomGenerator().nextUInt(range);
+        return static_cast<int>(static_cast<int64_t>(min) + value);
     }
 
     /// @brief Generate a random integer in the range [0, max_int].
@@ -67,6 +97,14 @@ public:
         return randomInt(0, std::numeric_limits<int>::max());
     }
 
+    /// @brief Get the luminance of a linear color using the Rec. 709 primaries.
+    /// @param color the linear color
+    /// @return the luminance of the color
+    static float luminance(const Color3f &color)
+    {
+        return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+    }
+
     /// @brief Convert a linear color to gamma-corrected color.
     /// @param color the linear color
     /// @return the gamma-corrected color
@@ -79,7 +117,10 @@ public:
     /// @return a random vector in the range [0,1)
     static glm::vec3 randomVector()
     {
-        return glm::vec3(static_cast<float>(randomDouble()), static_cast<float>(randomDouble()), static_cast<float>(randomDouble()));
+        const float x = randomFloat();
+        const float y = randomFloat();
+        const float z = randomFloat();
+        return glm::vec3(x, y, z);
     }
     
     /// @brief Generate a random vector in the range [min,max).
@@ -88,9 +129,10 @@ public:
     /// @return a random vector in the range [min,max)
     static glm::vec3 randomVector(const float min, const float max)
     {
-        return glm::vec3(static_cast<float>(randomDouble(min, max)), 
-                         static_cast<float>(randomDouble(min, max)),
-                         static_cast<float>(randomDouble(min, max)));
+        const float x = randomFloat(min, max);
+        const float y = randomFloat(min, max);
+        const float z = randomFloat(min, max);
+        return glm::vec3(x, y, z);
     }
 
     /// @brief Generate a random unit vector.
@@ -138,17 +180,68 @@ public:
     /// @return a random cosine-weighted direction
     static glm::vec3 randomCosineDirection()
     {
-        auto r1 = randomDouble();
-        auto r2 = randomDouble();
-        auto phi = 2 * glm::pi<double>() * r1;
+        const float r1 = randomFloat();
+        const float r2 = randomFloat();
+        const float phi = 2.0f * glm::pi<float>() * r1;
 
-        auto x = static_cast<float>(glm::cos(phi) * glm::sqrt(r2));
-        auto y = static_cast<float>(glm::sin(phi) * glm::sqrt(r2));
-        auto z = static_cast<float>(glm::sqrt(1 - r2));
+        const float x = glm::cos(phi) * glm::sqrt(r2);
+        const float y = glm::sin(phi) * glm::sqrt(r2);
+        const float z = glm::sqrt(1.0f - r2);
 
         return glm::vec3(x, y, z);
     }
 
+    /// @brief Map a uniform sample of the unit square to a cosine-weighted direction on the
+    ///        hemisphere around +z.
+    /// @param u the sample in [0,1)^2
+    /// @return the direction, its density is cos(theta)/pi
+    static glm::vec3 sampleCosineHemisphere(const glm::vec2 &u)
+    {
+        const glm::vec2 d = sampleUniformDiskConcentric(u);
+        const float z = glm::sqrt(std::max(0.0f, 1.0f - d.x * d.x - d.y * d.y));
+        return glm::vec3(d.x, d.y, z);
+    }
+
+    /// @brief Map a uniform sample of the unit square to a uniformly distributed unit vector.
+    /// @param u the sample in [0,1)^2
+    /// @return the unit vector, its density is 1/(4 pi)
+    static glm::vec3 sampleUniformSphere(const glm::vec2 &u)
+    {
+        const float z = 1.0f - 2.0f * u.x;
+        const float r = glm::sqrt(std::max(0.0f, 1.0f - z * z));
+        const float phi = 2.0f * glm::pi<float>() * u.y;
+        return glm::vec3(r * glm::cos(phi), r * glm::sin(phi), z);
+    }
+
+    /// @brief Map a uniform sample of the unit square to a uniformly distributed point in the
+    ///        unit disk with Shirley's concentric mapping, which keeps the stratification of
+    ///        the input.
+    /// @param u the sample in [0,1)^2
+    /// @return the point in the unit disk
+    static glm::vec2 sampleUniformDiskConcentric(const glm::vec2 &u)
+    {
+        const glm::vec2 offset = 2.0f * u - glm::vec2(1.0f);
+        if(offset.x == 0.0f && offset.y == 0.0f)
+        {
+            return glm::vec2(0.0f);
+        }
+
+        const float quarterPi = 0.25f * glm::pi<float>();
+        float radius;
+        float theta;
+        if(std::abs(offset.x) > std::abs(offset.y))
+        {
+            radius = offset.x;
+            theta = quarterPi * (offset.y / offset.x);
+        }
+        else
+        {
+            radius = offset.y;
+            theta = 2.0f * quarterPi - quarterPi * (offset.x / offset.y);
+        }
+        return radius * glm::vec2(glm::cos(theta), glm::sin(theta));
+    }
+
     /// @brief Generate a random vector in the unit disk.
     /// This function uses rejection sampling to generate a random vector in the unit disk.
     /// The algorithm works by generating a random vector in the unit square and rejecting it if it
@@ -159,7 +252,9 @@ public:
     {
         for (int i = 0; i < maxAttempts; i++)
         {
-            glm::vec3 p(static_cast<float>(randomDouble(-1, 1)), static_cast<float>(randomDouble(-1, 1)), 0.0f);
+            const float x = randomFloat(-1.0f, 1.0f);
+            const float y = randomFloat(-1.0f, 1.0f);
+            glm::vec3 p(x, y, 0.0f);
 
             if (glm::length(p) < 1)
             {
@@ -33,6 +33,12 @@ bool QuadLight::hit(const Ray &ray, HitRecord &record) const
     return m_quad->hit(ray, record);
 }
 
+//----------------------------------------------------------------------------------
+bool QuadLight::occluded(const Ray &ray) const
+{
+    return m_quad->occluded(ray);
+}
+
 //----------------------------------------------------------------------------------
 AxisAlignedBoundingBox QuadLight::getBounds() const
 {
@@ -57,6 +63,18 @@ float QuadLight::getSurfaceArea() const
     return m_quad->getSurfaceArea();
 }
 
+//----------------------------------------------------------------------------------
+float QuadLight::getNormalCone(glm::vec3 &axis) const
+{
+    return m_quad->getNormalCone(axis);
+}
+
+//----------------------------------------------------------------------------------
+float QuadLight::getPower() const
+{
+    return RaytracingUtility::luminance(m_material->averageRadiance()) * this->getSurfaceArea();
+}
+
 //----------------------------------------------------------------------------------
 float QuadLight::pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const
 {
@@ -82,9 +100,9 @@ float QuadLight::getGeometricFactor(const glm::vec3 &origin, const glm::vec3 &di
 }
 
 //----------------------------------------------------------------------------------
-glm::vec3 QuadLight::random(const glm::vec3 &origin) const
+glm::vec3 QuadLight::random(const glm::vec3 &origin, const glm::vec2 &u) const
 {
-    return m_quad->random(origin);
+    return m_quad->random(origin, u);
 }
 
 //----------------------------------------------------------------------------------
@@ -37,6 +37,9 @@ public:
     /// @see Hittable::hit
     bool hit(const Ray &ray, HitRecord &record) const override;
 
+    /// @see Hittable::occluded
+    bool occluded(const Ray &ray) const override;
+
     /// @see Hittable::getBounds
     AxisAlignedBoundingBox getBounds() const override;
 
@@ -45,10 +48,17 @@ public:
 
     /// @see Hittable::isLight
     bool isLight() const override { return true; }
+
+    /// @brief Get the emitted power as the luminance of the average radiance times the area
+    /// @see Hittable::getPower
+    float getPower() const override;
     
     /// @see Hittable::randomPointOnSurface
     glm::vec3 randomPointOnSurface() const override;
 
+    /// @see Hittable::getNormalCone
+    float getNormalCone(glm::vec3 &axis) const override;
+
     /// @see Hittable::getSurfaceArea
     float getSurfaceArea() const override;
 
@@ -59,7 +69,7 @@ public:
     float pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const override;
 
     /// @see Hittable::random
-    glm::vec3 random(const glm::vec3 &origin) const override;
+    glm::vec3 random(const glm::vec3 &origin, const glm::vec2 &u) const override;
 
     /// @brief Get world point of quad corners
     /// @param index the corner index (0-3)
@@ -32,6 +32,12 @@ bool SphereLight::hit(const Ray &ray, HitRecord &record) const
     return m_sphere->hit(ray, record);
 }
 
+//----------------------------------------------------------------------------------
+bool SphereLight::occluded(const Ray &ray) const
+{
+    return m_sphere->occluded(ray);
+}
+
 //----------------------------------------------------------------------------------
 AxisAlignedBoundingBox SphereLight::getBounds() const
 {
@@ -66,6 +72,12 @@ float SphereLight::getGeometricFactor(const glm::vec3 &origin, const glm::vec3 &
     return 0.0f;
 }
 
+//----------------------------------------------------------------------------------
+float SphereLight::getPower() const
+{
+    return RaytracingUtility::luminance(m_material->averageRadiance()) * this->getSurfaceArea();
+}
+
 //----------------------------------------------------------------------------------
 float SphereLight::pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const
 {
@@ -73,9 +85,9 @@ float SphereLight::pdfValue(const glm::vec3 &origin, const glm::vec3 &direction)
 }
 
 //----------------------------------------------------------------------------------
-glm::vec3 SphereLight::random(const glm::vec3 &origin) const
+glm::vec3 SphereLight::random(const glm::vec3 &origin, const glm::vec2 &u) const
 {
-    return m_sphere->random(origin);
+    return m_sphere->random(origin, u);
 }
 
 } // namespace raytracer
\ No newline at end of file
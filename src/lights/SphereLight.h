@@ -37,6 +37,9 @@ public:
     /// @see Shape::hit
     bool hit(const Ray &ray, HitRecord &record) const override;
 
+    /// @see Hittable::occluded
+    bool occluded(const Ray &ray) const override;
+
     /// @see Shape::getBounds
     AxisAlignedBoundingBox getBounds() const override;
 
@@ -55,6 +58,10 @@ public:
     /// @see Hittable::isLight
     bool isLight() const override { return true; }
 
+    /// @brief Get the emitted power as the luminance of the average radiance times the area
+    /// @see Hittable::getPower
+    float getPower() const override;
+
     /// @brief Get the radius of the sphere light
     /// @return the radius of the sphere light
     float radius() const { return m_sphere->radius(); }
@@ -63,7 +70,7 @@ public:
     float pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const override;
 
     /// @see Hittable::random
-    glm::vec3 random(const glm::vec3 &origin) const override;
+    glm::vec3 random(const glm::vec3 &origin, const glm::vec2 &u) const override;
 
 private:
     std::shared_ptr<Sphere> m_sphere;
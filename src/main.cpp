@@ -12,12 +12,18 @@
 #include "QuadLight.h"
 #include "SphereLight.h"
 #include "Box.h"
+#include "Instance.h"
+#include "ThreadPool.h"
+#include "ImageWriter.h"
 
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 using PerspectiveCamera = raytracer::PerspectiveCamera;
@@ -26,6 +32,92 @@ using Hittable = raytracer::Hittable;
 using HitRecord = raytracer::HitRecord;
 using BVH = raytracer::BVH;
 using RaytracingUtility = raytracer::RaytracingUtility;
+using Sampler = raytracer::Sampler;
+using ThreadPool = raytracer::ThreadPool;
+using ImageWriter = raytracer::ImageWriter;
+
+namespace
+{
+/// Integrator selected on the command line, used by every scene
+PerspectiveCamera::Integrator g_integrator = PerspectiveCamera::Integrator::Recursive;
+/// Light sampling strategy selected on the command line, used by every scene
+PerspectiveCamera::LightSampling g_lightSampling = PerspectiveCamera::LightSampling::Mixture;
+/// Number of bounces before Russian roulette, selected on the command line, used by every scene
+int g_rouletteDepth = PerspectiveCamera::DEFAULT_ROULETTE_DEPTH;
+/// Sampler selected on the command line, used by every scene
+Sampler::Type g_samplerType = Sampler::Type::Sobol;
+/// Error threshold of adaptive sampling selected on the command line, 0 to sample uniformly
+float g_adaptiveThreshold = 0.0f;
+/// Time budget of adaptive sampling in seconds selected on the command line, 0 for none
+float g_timeBudget = 0.0f;
+/// File the sample count of every pixel is written to, empty for none
+std::string g_sampleCountMapFile;
+/// File the rendered image is written to, empty to write a PPM image to standard output
+std::string g_outputFile;
+/// Whether the auxiliary images are rendered and written next to the output file
+bool g_aovs = false;
+/// Whether the rendered image is denoised before it is written
+bool g_denoise = false;
+/// Samples per pixel selected on the command line, 0 for the scene's own number
+int g_samplesPerPixel = 0;
+/// Checkpoint file of progressive rendering, empty for none
+std::string g_checkpointFile;
+/// Time in seconds between checkpoints
+float g_checkpointInterval = static_cast<float>(PerspectiveCamera::DEFAULT_CHECKPOINT_INTERVAL);
+/// Preview image file of progressive rendering, empty for none
+std::string g_previewFile;
+/// Time in seconds between preview images
+float g_previewInterval = static_cast<float>(PerspectiveCamera::DEFAULT_PREVIEW_INTERVAL);
+/// Accumulation file the film is written to for merging, empty for none
+std::string g_accumulationFile;
+/// Seed of the sample patterns, different in every process whose films are merged
+int g_seed = 0;
+
+//----------------------------------------------------------------------------------
+// Apply the options selected on the command line to a scene's camera
+void applyRenderOptions(PerspectiveCamera &camera)
+{
+    camera.setIntegrator(g_integrator);
+    camera.setLightSampling(g_lightSampling);
+    camera.setRouletteDepth(g_rouletteDepth);
+    camera.setSamplerType(g_samplerType);
+    camera.setAdaptiveThreshold(g_adaptiveThreshold);
+    camera.setTimeBudget(g_timeBudget);
+    camera.setSampleCountMapFile(g_sampleCountMapFile);
+    camera.setOutputFile(g_outputFile);
+    camera.setAOVsEnabled(g_aovs);
+    camera.setDenoiseEnabled(g_denoise);
+    camera.setCheckpointFile(g_checkpointFile);
+    camera.setCheckpointInterval(g_checkpointInterval);
+    camera.setPreviewFile(g_previewFile);
+    camera.setPreviewInterval(g_previewInterval);
+    camera.setAccumulationFile(g_accumulationFile);
+    camera.setFrameIndex(g_seed);
+}
+
+//----------------------------------------------------------------------------------
+// Get the number of samples per pixel to render a scene with
+int samplesPerPixel(const int sceneSamples)
+{
+    return g_samplesPerPixel > 0 ? g_samplesPerPixel : sceneSamples;
+}
+
+//----------------------------------------------------------------------------------
+// Check that an image file given on the command line has a supported format before rendering
+bool isSupportedImageFile(const std::string &filename)
+{
+    try
+    {
+        ImageWriter::formatFromFilename(filename);
+        return true;
+    }
+    catch(const std::invalid_argument &e)
+    {
+        std::clog << e.what() << ". Please use -h or --help for usage." << std::endl;
+        return false;
+    }
+}
+} // namespace
 
 //----------------------------------------------------------------------------------
 void random_spheres()
@@ -43,8 +135,8 @@ void random_spheres()
     {
         for(int b=-11; b < 11; ++b)
         {
-            auto chooseMat = static_cast<float>(RaytracingUtility::randomDouble());
-            glm::vec3 center(a + 0.9f * static_cast<float>(RaytracingUtility::randomDouble()), 0.2f, b + 0.9f * static_cast<float>(RaytracingUtility::randomDouble()));
+            auto chooseMat = RaytracingUtility::randomFloat();
+            glm::vec3 center(a + 0.9f * RaytracingUtility::randomFloat(), 0.2f, b + 0.9f * RaytracingUtility::randomFloat());
 
             if(glm::length(center - glm::vec3(4.f, 0.2f, 0.f)) > 0.9f)
             {
@@ -61,7 +153,7 @@ void random_spheres()
                 {
                     // Metal
                     auto albedo = RaytracingUtility::randomVector(0.5f, 1.f);
-                    auto fuzz = static_cast<float>(RaytracingUtility::randomDouble(0, 0.5));
+                    auto fuzz = RaytracingUtility::randomFloat(0.0f, 0.5f);
                     sphereMaterial = std::make_shared<raytracer::Metal>(albedo, fuzz);
                     world.add(std::make_shared<raytracer::Sphere>(center, 0.2f, sphereMaterial));
                 }
@@ -99,7 +191,9 @@ void random_spheres()
     camera.setApertureRadius(0.f);
     camera.setBackgroundColor(raytracer::Color3f(0.7f, 0.8f, 1.f));
 
-    camera.render(world, 3);
+    applyRenderOptions(camera);
+
+    camera.render(world, samplesPerPixel(3));
 }
 
 //----------------------------------------------------------------------------------
@@ -124,7 +218,9 @@ void two_spheres()
     camera.setFocalPoint(glm::vec3(0.f, 0.f, 0.f));
     camera.setApertureRadius(0.f);
 
-    camera.render(world, 50);
+    applyRenderOptions(camera);
+
+    camera.render(world, samplesPerPixel(50));
 }
 
 //----------------------------------------------------------------------------------
@@ -147,7 +243,9 @@ void earth(const std::string &filename)
     camera.setFocalPoint(glm::vec3(0, 0, 0));
     camera.setApertureRadius(0);
 
-    camera.render(world, 5);
+    applyRenderOptions(camera);
+
+    camera.render(world, samplesPerPixel(5));
 }
 
 //----------------------------------------------------------------------------------
@@ -178,7 +276,9 @@ void quads()
     camera.setFocalPoint(glm::vec3(0, 0, 0));
     camera.setApertureRadius(0);
 
-    camera.render(world, 25);
+    applyRenderOptions(camera);
+
+    camera.render(world, samplesPerPixel(25));
 }
 
 //----------------------------------------------------------------------------------
@@ -216,7 +316,9 @@ void simple_light(const std::string &filename)
     camera.setApertureRadius(0);
     camera.setBackgroundColor(raytracer::Color3f(0.0f, 0.0f, 0.0f));
 
-    camera.render(world, 50);
+    applyRenderOptions(camera);
+
+    camera.render(world, samplesPerPixel(50));
 }
 
 //----------------------------------------------------------------------------------
@@ -291,7 +393,8 @@ void cornell_box(const bool debug, int gridResolution=10)
     }
     else
     {
-        camera.render(world, 20);
+        applyRenderOptions(camera);
+        camera.render(world, samplesPerPixel(20));
     }
 }
 
@@ -301,8 +404,9 @@ void final_scene(const std::string &filename)
     std::clog << "Rendering Scene 7: Final Scene" << std::endl;
     BVH world;
     
-    // Ground
+    // Ground, every box is an instance of one shared unit box
     auto groundMaterial = std::make_shared<raytracer::Lambertian>(raytracer::Color3f(0.48f, 0.83f, 0.53f));
+    auto unitBox = std::make_shared<raytracer::Box>(glm::vec3(0.f), glm::vec3(1.f), groundMaterial);
     for(int i=0; i<20; ++i)
     {
         for(int j=0; j<20; ++j)
@@ -313,10 +417,10 @@ void final_scene(const std::string &filename)
             float y0 = 0.f;
             float x1 = x0 + w;
             float z1 = z0 + w;
-            float y1 = static_cast<float>(RaytracingUtility::randomDouble(1, 101));
+            float y1 = RaytracingUtility::randomFloat(1.0f, 101.0f);
             
-            auto box = std::make_shared<raytracer::Box>(glm::vec3(x0, y0, z0), glm::vec3(x1, y1, z1), groundMaterial);
-            world.add(box);
+            auto boxToWorld = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(x0, y0, z0)), glm::vec3(x1 - x0, y1 - y0, z1 - z0));
+            world.add(std::make_shared<raytracer::Instance>(unitBox, boxToWorld));
         }
     }
     
@@ -343,14 +447,17 @@ void final_scene(const std::string &filename)
     
     world.add(std::make_shared<raytracer::Sphere>(glm::vec3(220,280,100), 80, std::make_shared<raytracer::Lambertian>(raytracer::Color3f(0.8f, 0.5f, 0.2f))));
     
-    // Sphere Box
+    // Sphere Box, built once in its own BVH and placed with an instance
     auto whiteMaterial = std::make_shared<raytracer::Lambertian>(raytracer::Color3f(0.73f, 0.73f, 0.73f));
+    auto sphereBox = std::make_shared<BVH>();
     for(int i=0;i<1000; i++)
     {
-        auto sphere = std::make_shared<raytracer::Sphere>(RaytracingUtility::randomVector(0,165), 10, whiteMaterial);
-        sphere->translate(glm::vec3(50.f, 270.f, -150.0f));
-        world.add(sphere);
+        sphereBox->add(std::make_shared<raytracer::Sphere>(RaytracingUtility::randomVector(0,165), 10, whiteMaterial));
     }
+    sphereBox->build();
+    auto sphereBoxInstance = std::make_shared<raytracer::Instance>(sphereBox);
+    sphereBoxInstance->translate(glm::vec3(50.f, 270.f, -150.0f));
+    world.add(sphereBoxInstance);
     
     // Build BVH
     world.build();
@@ -361,14 +468,35 @@ void final_scene(const std::string &filename)
     camera.setFocalPoint(glm::vec3(278, 278, -1));
     camera.setApertureRadius(0);
 
-    camera.render(world, 140);
+    applyRenderOptions(camera);
+
+    camera.render(world, samplesPerPixel(140));
 }
 
 //----------------------------------------------------------------------------------
 void print_usage()
 {
-    std::clog << "Usage: raytracing <-s scene_number> [-h] [-f filename] [-d grid_resolution]" << std::endl;
+    std::clog << "Usage: raytracing <-s scene_number> [-h] [-f filename] [-d grid_resolution] [-i integrator] [-l light_sampling] [-r roulette_depth] [-p sampler] [-a threshold] [-t seconds] [-m filename] [-o filename] [--aovs] [--denoise] [-n samples] [--checkpoint filename] [--checkpoint-interval seconds] [--preview filename] [--preview-interval seconds] [--accumulate filename] [--seed seed] [-j threads] [--pin-threads]" << std::endl;
     std::clog << "-h --help: show help" << std::endl;
+    std::clog << "-i recursive|wavefront: path tracing integrator (default: recursive)" << std::endl;
+    std::clog << "-l mixture|nee: light sampling, nee for next-event estimation with MIS (default: mixture)" << std::endl;
+    std::clog << "-r depth: bounces before paths are ended by Russian roulette (default: " << PerspectiveCamera::DEFAULT_ROULETTE_DEPTH << ")" << std::endl;
+    std::clog << "-p independent|stratified|sobol|halton: sample generator (default: sobol)" << std::endl;
+    std::clog << "-a threshold: sample adaptively until the pixel error is below the threshold, e.g. 0.01 (default: off)" << std::endl;
+    std::clog << "-t seconds: time budget of adaptive sampling (default: none)" << std::endl;
+    std::clog << "-m filename: write the number of samples of every pixel to an image" << std::endl;
+    std::clog << "-o filename: write the image to a .ppm, .png, .pfm or .exr file (default: PPM to standard output)" << std::endl;
+    std::clog << "--aovs: also write albedo, normal, depth, object id, direct and indirect light, as layers of an .exr output file or as separate files (requires -o)" << std::endl;
+    std::clog << "--denoise: filter the noise out of the image guided by albedo, normals and variance, AOVs are written unfiltered" << std::endl;
+    std::clog << "-n samples: samples per pixel (default: the scene's own number)" << std::endl;
+    std::clog << "--checkpoint filename: render progressively, save the progress to the file and resume from it if it exists, a larger -n adds samples" << std::endl;
+    std::clog << "--checkpoint-interval seconds: time between checkpoints (default: " << PerspectiveCamera::DEFAULT_CHECKPOINT_INTERVAL << ")" << std::endl;
+    std::clog << "--preview filename: render progressively and write the image rendered so far to the file" << std::endl;
+    std::clog << "--preview-interval seconds: time between preview images (default: " << PerspectiveCamera::DEFAULT_PREVIEW_INTERVAL << ")" << std::endl;
+    std::clog << "--accumulate filename: also write the sample sums and counts to an accumulation file, to be merged with raytracing-merge" << std::endl;
+    std::clog << "--seed seed: seed of the sample patterns, use a different one in every process whose accumulation files are merged (default: 0)" << std::endl;
+    std::clog << "-j threads: number of threads, 0 for one per hardware thread (default: RAYTRACER_THREADS or 0)" << std::endl;
+    std::clog << "--pin-threads: bind every worker thread to its own core (default: RAYTRACER_PIN_THREADS or off)" << std::endl;
     std::clog << "-s 1: random_spheres" << std::endl;
     std::clog << "-s 2: two_spheres" << std::endl;
     std::clog << "-s 3 -f filename: earth" << std::endl;
@@ -381,6 +509,185 @@ void print_usage()
 //----------------------------------------------------------------------------------
 int main(int argc, char *argv[])
 {
+    // Options that apply to every scene may appear anywhere, remove them before the scene
+    // arguments are parsed
+    std::vector<char *> arguments(argv, argv + argc);
+    int threadCount = -1;
+    bool pinThreads = false;
+    for(auto it = arguments.begin() + 1; it != arguments.end();)
+    {
+        if(std::string(*it) == "-i" && (it + 1) != arguments.end())
+        {
+            const std::string integrator(*(it + 1));
+            if(integrator == "wavefront")
+            {
+                g_integrator = PerspectiveCamera::Integrator::Wavefront;
+            }
+            else if(integrator != "recursive")
+            {
+                std::clog << "Unknown integrator " << integrator << ". Please use -h or --help for usage." << std::endl;
+                return 1;
+            }
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "-l" && (it + 1) != arguments.end())
+        {
+            const std::string lightSampling(*(it + 1));
+            if(lightSampling == "nee")
+            {
+                g_lightSampling = PerspectiveCamera::LightSampling::NextEvent;
+            }
+            else if(lightSampling != "mixture")
+            {
+                std::clog << "Unknown light sampling " << lightSampling << ". Please use -h or --help for usage." << std::endl;
+                return 1;
+            }
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "-p" && (it + 1) != arguments.end())
+        {
+            const std::string sampler(*(it + 1));
+            if(sampler == "independent")
+            {
+                g_samplerType = Sampler::Type::Independent;
+            }
+            else if(sampler == "stratified")
+            {
+                g_samplerType = Sampler::Type::Stratified;
+            }
+            else if(sampler == "sobol")
+            {
+                g_samplerType = Sampler::Type::Sobol;
+            }
+            else if(sampler == "halton")
+            {
+                g_samplerType = Sampler::Type::Halton;
+            }
+            else
+            {
+                std::clog << "Unknown sampler " << sampler << ". Please use -h or --help for usage." << std::endl;
+                return 1;
+            }
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "-r" && (it + 1) != arguments.end())
+        {
+            g_rouletteDepth = std::stoi(*(it + 1));
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "-a" && (it + 1) != arguments.end())
+        {
+            g_adaptiveThreshold = std::stof(*(it + 1));
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "-t" && (it + 1) != arguments.end())
+        {
+            g_timeBudget = std::stof(*(it + 1));
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "-m" && (it + 1) != arguments.end())
+        {
+            g_sampleCountMapFile = *(it + 1);
+            if(!isSupportedImageFile(g_sampleCountMapFile))
+            {
+                return 1;
+            }
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "-o" && (it + 1) != arguments.end())
+        {
+            g_outputFile = *(it + 1);
+            if(!isSupportedImageFile(g_outputFile))
+            {
+                return 1;
+            }
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "-j" && (it + 1) != arguments.end())
+        {
+            threadCount = std::stoi(*(it + 1));
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "--aovs")
+        {
+            g_aovs = true;
+            it = arguments.erase(it);
+        }
+        else if(std::string(*it) == "--denoise")
+        {
+            g_denoise = true;
+            it = arguments.erase(it);
+        }
+        else if(std::string(*it) == "-n" && (it + 1) != arguments.end())
+        {
+            g_samplesPerPixel = std::stoi(*(it + 1));
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "--checkpoint" && (it + 1) != arguments.end())
+        {
+            g_checkpointFile = *(it + 1);
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "--checkpoint-interval" && (it + 1) != arguments.end())
+        {
+            g_checkpointInterval = std::stof(*(it + 1));
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "--preview" && (it + 1) != arguments.end())
+        {
+            g_previewFile = *(it + 1);
+            if(!isSupportedImageFile(g_previewFile))
+            {
+                return 1;
+            }
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "--preview-interval" && (it + 1) != arguments.end())
+        {
+            g_previewInterval = std::stof(*(it + 1));
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "--accumulate" && (it + 1) != arguments.end())
+        {
+            g_accumulationFile = *(it + 1);
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "--seed" && (it + 1) != arguments.end())
+        {
+            g_seed = std::stoi(*(it + 1));
+            it = arguments.erase(it, it + 2);
+        }
+        else if(std::string(*it) == "--pin-threads")
+        {
+            pinThreads = true;
+            it = arguments.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    argc = static_cast<int>(arguments.size());
+    argv = arguments.data();
+
+    if(g_aovs && g_outputFile.empty())
+    {
+        std::clog << "AOVs need an output file given with -o. Please use -h or --help for usage." << std::endl;
+        return 1;
+    }
+
+    if(g_adaptiveThreshold > 0.0f && (!g_checkpointFile.empty() || !g_previewFile.empty()))
+    {
+        std::clog << "Adaptive sampling cannot be combined with checkpoints or previews. Please use -h or --help for usage." << std::endl;
+        return 1;
+    }
+
+    // The command line takes precedence over the environment variables read by the pool
+    if(threadCount >= 0 || pinThreads)
+    {
+        ThreadPool::configureGlobal(std::max(0, threadCount), pinThreads);
+    }
+
     // check if user provided -h or --help
     if(argc == 2)
     {
@@ -22,10 +22,10 @@ float Dielectric::scatteringPDF(const Ray &ray, const HitRecord &record, const R
 }
 
 //----------------------------------------------------------------------------------
-bool Dielectric::scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord) const
+bool Dielectric::scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord, float uc, const glm::vec2 &u) const
 {
     scatterRecord.attenuation = glm::vec3(1.0, 1.0, 1.0);
-    scatterRecord.pdfPtr = nullptr;
+    scatterRecord.clearPdf();
     scatterRecord.skipPdf = true;
     
     auto refractionRatio = record.frontFace ? (1.0 / m_ir) : m_ir;
@@ -35,9 +35,7 @@ bool Dielectric::scatter(const Ray &ray, const HitRecord &record, ScatterRecord
 
     bool cannotRefract = refractionRatio * sinTheta > 1.0;
     glm::vec3 direction;
-    const float randomVal = static_cast<float>(RaytracingUtility::randomDouble());
-    
-    if(cannotRefract || reflectance(cosTheta, refractionRatio) > randomVal)
+    if(cannotRefract || reflectance(cosTheta, refractionRatio) > uc)
     {
         direction = glm::reflect(unitDirection, record.normal);
     }
@@ -16,7 +16,7 @@ public:
 
     /// @brief Determines if the ray scatters when it hits the object.
     /// @see Material::scatter
-    bool scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord) const override;
+    bool scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord, float uc, const glm::vec2 &u) const override;
 
     /// @brief Computes the scattering PDF for the material.
     /// @see Material::scatteringPDF
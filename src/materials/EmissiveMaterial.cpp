@@ -29,4 +29,22 @@ Color3f EmissiveMaterial::emitted(const HitRecord &record) const
     return m_intensity * m_texture->value(record.u, record.v, record.point);
 }
 
+//----------------------------------------------------------------------------------
+Color3f EmissiveMaterial::averageRadiance() const
+{
+    // Sample the texture on a regular grid of texture coordinates
+    const int gridSize = 8;
+    Color3f sum(0.0f);
+
+    for(int j = 0; j < gridSize; ++j)
+    {
+        for(int i = 0; i < gridSize; ++i)
+        {
+            sum += m_texture->value((i + 0.5f) / gridSize, (j + 0.5f) / gridSize, glm::vec3(0.0f));
+        }
+    }
+
+    return m_intensity * sum / static_cast<float>(gridSize * gridSize);
+}
+
 } // namespace raytracer
@@ -25,7 +25,7 @@ public:
 
     /// @brief Scatters the ray
     /// @see Material::scatter
-    bool scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord) const override
+    bool scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord, float uc, const glm::vec2 &u) const override
     {
         return false;
     }
@@ -34,6 +34,10 @@ public:
     /// @see Material::emitted
     Color3f emitted(const HitRecord &record) const override;
 
+    /// @brief Get the radiance emitted from the front face averaged over the texture
+    /// @return the average emitted radiance
+    Color3f averageRadiance() const;
+
 private:
     std::shared_ptr<Texture> m_texture;
     float m_intensity;
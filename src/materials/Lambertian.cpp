@@ -24,10 +24,10 @@ Lambertian::Lambertian(const std::shared_ptr<Texture> &albedo)
 }
 
 //----------------------------------------------------------------------------------
-bool Lambertian::scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord) const
+bool Lambertian::scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord, float uc, const glm::vec2 &u) const
 {
     scatterRecord.attenuation = m_albedo->value(record.u, record.v, record.point);
-    scatterRecord.pdfPtr = std::make_shared<CosinePdf>(record.normal);
+    scatterRecord.setPdf<CosinePdf>(record.normal);
     scatterRecord.skipPdf = false;
     
     return true;
@@ -4,7 +4,11 @@
 #include "Utility.h"
 
 #include <cmath>
+#include <cstddef>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 #include <glm/vec3.hpp>
 #include <glm/glm.hpp>
@@ -16,13 +20,62 @@ class Pdf;
 
 /// @class ScatterRecord
 /// @brief A record that contains information about a scattered ray.
+///
+/// The PDF used to sample the scattered direction is constructed in place inside the record by
+/// setPdf(), so scattering does not allocate. The record owns its PDF and cannot be copied.
 class ScatterRecord
 {
 public:
+    /// @brief Largest PDF, in bytes, that a record can hold
+    static const std::size_t MAX_PDF_SIZE = 64;
+
+    /// @brief Default constructor, creates a record without a PDF
+    ScatterRecord()
+        : attenuation(0.0f)
+        , pdfPtr(nullptr)
+        , skipPdf(false)
+        , m_destroyPdf(nullptr)
+    {
+    }
+
+    /// @brief Destructor, destroys the PDF held by the record
+    ~ScatterRecord() { this->clearPdf(); }
+
+    ScatterRecord(const ScatterRecord &) = delete;
+    ScatterRecord &operator=(const ScatterRecord &) = delete;
+
+    /// @brief Construct the PDF of the record in place, replacing the previous one
+    /// @param args the arguments of the PDF constructor
+    template<typename PdfType, typename... Args>
+    void setPdf(Args&&... args)
+    {
+        static_assert(sizeof(PdfType) <= MAX_PDF_SIZE, "PDF does not fit in a scatter record");
+        static_assert(alignof(PdfType) <= alignof(std::max_align_t), "PDF alignment is not supported");
+
+        this->clearPdf();
+        pdfPtr = new (&m_pdfStorage) PdfType(std::forward<Args>(args)...);
+        m_destroyPdf = [](void *pdf) { static_cast<PdfType *>(pdf)->~PdfType(); };
+    }
+
+    /// @brief Destroy the PDF of the record, if any
+    void clearPdf()
+    {
+        if(m_destroyPdf != nullptr)
+        {
+            m_destroyPdf(&m_pdfStorage);
+            m_destroyPdf = nullptr;
+        }
+        pdfPtr = nullptr;
+    }
+
     Color3f attenuation;
-    std::shared_ptr<Pdf> pdfPtr;
+    const Pdf *pdfPtr;      ///< PDF the scattered direction is sampled from, unless skipPdf is set
     bool skipPdf;
     Ray skipPdfRay;
+
+private:
+    typename std::aligned_storage<MAX_PDF_SIZE, alignof(std::max_align_t)>::type m_pdfStorage;
+    void (*m_destroyPdf)(void *);
 };
 
 /// @class Material
@@ -37,8 +90,12 @@ public:
     /// @param ray the ray that hit the object
     /// @param record the hit record that contains the intersection information
     /// @param scatterRecord the scatter record to fill with scattering information
+    /// @param uc a uniform sample in [0,1) for discrete choices, e.g. between reflection and
+    ///        refraction
+    /// @param u a uniform sample in [0,1)^2 for materials that choose the scattered direction
+    ///        themselves instead of through a PDF
     /// @return true if the ray scatters, false otherwise
-    virtual bool scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord) const = 0;
+    virtual bool scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord, float uc, const glm::vec2 &u) const = 0;
 
     /// @brief Computes the scattering PDF for the material.
     /// @param ray the ray that hit the object
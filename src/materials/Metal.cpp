@@ -27,14 +27,14 @@ Metal::Metal(std::shared_ptr<Texture> albedo, float roughness)
 }
 
 //----------------------------------------------------------------------------------
-bool Metal::scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord) const
+bool Metal::scatter(const Ray &ray, const HitRecord &record, ScatterRecord &scatterRecord, float uc, const glm::vec2 &u) const
 {    
     glm::vec3 reflected = glm::reflect(ray.direction(), record.normal);
-    reflected = glm::normalize(reflected) + (m_roughness * RaytracingUtility::randomUnitVector());
+    reflected = glm::normalize(reflected) + (m_roughness * RaytracingUtility::sampleUniformSphere(u));
     
     scatterRecord.attenuation = m_albedo->value(record.u, record.v, record.point);
     scatterRecord.skipPdf = true;
-    scatterRecord.pdfPtr = nullptr;
+    scatterRecord.clearPdf();
     scatterRecord.skipPdfRay = Ray(record.point, reflected);
     // The scattered ray is reflected if the dot product of the scattered ray and the normal is greater than zero.
     // This way can absorb rays that scatter below the surface of the object.
@@ -0,0 +1,80 @@
+#include "AccumulationFile.h"
+#include "ImageWriter.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using AccumulationFile = raytracer::AccumulationFile;
+using Image = raytracer::Image;
+using ImageWriter = raytracer::ImageWriter;
+
+namespace
+{
+//----------------------------------------------------------------------------------
+void print_usage()
+{
+    std::clog << "Usage: raytracing-merge -o filename [-a filename] [-h] accumulation_file..." << std::endl;
+    std::clog << "Sums the samples of accumulation files written by raytracing --accumulate for the same scene" << std::endl;
+    std::clog << "-h --help: show help" << std::endl;
+    std::clog << "-o filename: write the merged image to a .ppm, .png, .pfm or .exr file" << std::endl;
+    std::clog << "-a filename: also write the merged accumulation file, which can be merged again" << std::endl;
+}
+} // namespace
+
+//----------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    std::string outputFile;
+    std::string mergedFile;
+    std::vector<std::string> inputFiles;
+    for(int i = 1; i < argc; ++i)
+    {
+        const std::string argument(argv[i]);
+        if(argument == "-h" || argument == "--help")
+        {
+            print_usage();
+            return 0;
+        }
+        else if(argument == "-o" && i + 1 < argc)
+        {
+            outputFile = argv[++i];
+        }
+        else if(argument == "-a" && i + 1 < argc)
+        {
+            mergedFile = argv[++i];
+        }
+        else
+        {
+            inputFiles.push_back(argument);
+        }
+    }
+
+    if(outputFile.empty() || inputFiles.empty())
+    {
+        print_usage();
+        return 1;
+    }
+
+    try
+    {
+        // Fail on an unsupported output format before reading the inputs
+        ImageWriter::formatFromFilename(outputFile);
+
+        std::clog << "Merging " << inputFiles.size() << " accumulation files" << std::endl;
+        const Image image = AccumulationFile::merge(inputFiles, mergedFile);
+        ImageWriter::write(image, outputFile);
+        std::clog << "Wrote image to " << outputFile << std::endl;
+        if(!mergedFile.empty())
+        {
+            std::clog << "Wrote accumulation file " << mergedFile << std::endl;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        std::clog << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
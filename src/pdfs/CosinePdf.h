@@ -30,9 +30,10 @@ public:
 
     /// @brief Generate a random direction based on the PDF.
     /// @return a random direction based on the PDF
-    glm::vec3 generate() const override
+    glm::vec3 generate(float uc, const glm::vec2 &u) const override
     {
-        return RaytracingUtility::randomOnHemisphere(m_normal);
+        const OrthoNormalBasis uvw(m_normal);
+        return uvw.localToWorld(RaytracingUtility::sampleCosineHemisphere(u));
     }
 private:
     glm::vec3 m_normal;
@@ -37,9 +37,9 @@ public:
 
     /// @brief Generate a random direction based on the PDF.
     /// @return a random direction based on the PDF
-    glm::vec3 generate() const override
+    glm::vec3 generate(float uc, const glm::vec2 &u) const override
     {
-        return m_hittable->random(m_origin);
+        return m_hittable->random(m_origin, u);
     }
 
 private:
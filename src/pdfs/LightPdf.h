@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Pdf.h"
+#include "LightTree.h"
+#include "Utility.h"
+
+namespace raytracer
+{
+/// @class LightPdf
+/// @brief A PDF that generates directions towards the lights of a scene, choosing a light
+///        from a light tree by its estimated contribution at the origin.
+///
+/// The tree is referenced, not copied, so it must outlive the PDF.
+class LightPdf : public Pdf
+{
+public:
+    /// @brief Constructor
+    /// @param lightTree the hierarchy over the light sources
+    /// @param origin the origin point
+    LightPdf(const LightTree &lightTree, const glm::vec3 &origin)
+        : m_lightTree(lightTree)
+        , m_origin(origin)
+    {
+    }
+
+    /// @brief Evaluate the PDF for a given direction.
+    /// @param direction the direction to evaluate the PDF for
+    /// @return the PDF value
+    float value(const glm::vec3 &direction) const override
+    {
+        return m_lightTree.pdfValue(m_origin, direction);
+    }
+
+    /// @brief Generate a random direction towards a light chosen in logarithmic time.
+    /// @param uc chooses the light
+    /// @param u places the point on the light
+    /// @return a random direction based on the PDF
+    glm::vec3 generate(float uc, const glm::vec2 &u) const override
+    {
+        float pmf;
+        const int index = m_lightTree.sample(m_origin, uc, pmf);
+        return m_lightTree.light(index).random(m_origin, u);
+    }
+
+private:
+    const LightTree &m_lightTree;
+    glm::vec3 m_origin;
+};
+} // namespace raytracer
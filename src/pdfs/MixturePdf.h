@@ -1,27 +1,37 @@
 #pragma once
 
 #include "Pdf.h"
-#include "CosinePdf.h"
-#include "HittablePdf.h"
 #include "Utility.h"
 
-#include <memory>
-#include <vector>
-
-
+#include <algorithm>
+#include <stdexcept>
 
 namespace raytracer
 {
 /// @class MixturePdf
-/// @brief A PDF that combines multiple PDFs.
+/// @brief A PDF that combines multiple PDFs with equal weights.
+///
+/// The components are referenced, not copied or owned, so a mixture can be built on the stack
+/// around PDFs that outlive it without allocating.
 class MixturePdf : public Pdf
 {
-public:  
-    /// @brief Constructor
-    /// @param pdfs the list of PDFs to combine
-    MixturePdf(const std::vector<std::shared_ptr<Pdf>> &pdfs)
-        : m_pdfs(pdfs)
+public:
+    /// @brief maximum number of PDFs in a mixture
+    static const int MAX_COMPONENTS = 4;
+
+    /// @brief Default constructor, creates an empty mixture
+    MixturePdf() : m_count(0) {}
+
+    /// @brief Add a PDF to the mixture
+    /// @param pdf the PDF, which must outlive the mixture
+    /// @throw std::length_error if the mixture is full
+    void add(const Pdf &pdf)
     {
+        if(m_count >= MAX_COMPONENTS)
+        {
+            throw std::length_error("Too many PDFs in mixture");
+        }
+        m_pdfs[m_count++] = &pdf;
     }
 
     /// @brief Evaluate the PDF for a given direction.
@@ -30,9 +40,9 @@ public:
     float value(const glm::vec3 &direction) const override
     {
         float pdfValue = 0.0f;
-        float weight = 1.0f / static_cast<float>(m_pdfs.size());
+        float weight = 1.0f / static_cast<float>(m_count);
 
-        for(std::size_t i = 0; i < m_pdfs.size(); ++i)
+        for(int i = 0; i < m_count; ++i)
         {
             pdfValue += m_pdfs[i]->value(direction) * weight;
         }
@@ -41,20 +51,18 @@ public:
     }
 
     /// @brief Generate a random direction based on the PDF.
+    /// @param uc chooses the component, what remains of it is passed on to the component
+    /// @param u a uniform sample in [0,1)^2 passed on to the component
     /// @return a random direction based on the PDF
-    glm::vec3 generate() const override
+    glm::vec3 generate(float uc, const glm::vec2 &u) const override
     {
-        int index = 0;
-        
-        if(m_pdfs.size() > 1)
-        {
-            index = RaytracingUtility::randomInt(0, static_cast<int>(m_pdfs.size()) - 1);
-        }
-        
-        return m_pdfs[index]->generate();
+        const int index = std::min(static_cast<int>(uc * m_count), m_count - 1);
+        const float ucRemapped = std::min(uc * m_count - index, 0.99999994f);
+        return m_pdfs[index]->generate(ucRemapped, u);
     }
 
 private:
-    std::vector<std::shared_ptr<Pdf>> m_pdfs;
+    const Pdf *m_pdfs[MAX_COMPONENTS];
+    int m_count;
 };
-} // namespace raytracer
\ No newline at end of file
+} // namespace raytracer
@@ -23,7 +23,9 @@ public:
     virtual float value(const glm::vec3 &direction) const = 0;
 
     /// @brief Generate a random direction based on the PDF.
+    /// @param uc a uniform sample in [0,1) for discrete choices, e.g. of a mixture component
+    /// @param u a uniform sample in [0,1)^2 that places the direction
     /// @return a random direction based on the PDF
-    virtual glm::vec3 generate() const = 0;
+    virtual glm::vec3 generate(float uc, const glm::vec2 &u) const = 0;
 };
 } // namespace raytracer
\ No newline at end of file
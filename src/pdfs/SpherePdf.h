@@ -22,10 +22,9 @@ public:
 
     /// @brief Generate a random direction based on the PDF.
     /// @return a random direction based on the PDF
-    glm::vec3 generate() const override
+    glm::vec3 generate(float uc, const glm::vec2 &u) const override
     {
-        auto randomVector = RaytracingUtility::randomVector(-1,1);
-        return glm::normalize(randomVector);
+        return RaytracingUtility::sampleUniformSphere(u);
     }
 };
 } // namespace raytracer
\ No newline at end of file
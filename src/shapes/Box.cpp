@@ -3,6 +3,8 @@
 
 #include <glm/gtx/norm.hpp>
 
+#include <algorithm>
+
 namespace raytracer
 {
 //----------------------------------------------------------------------------------
@@ -33,18 +35,7 @@ Box::Box(std::vector<glm::vec3> points, std::shared_ptr<Material> material)
 //----------------------------------------------------------------------------------
 AxisAlignedBoundingBox Box::getBounds() const
 {
-    auto worldPoints = this->getWorldPoints();
-    glm::vec3 minPoint( std::numeric_limits<float>::max());
-    glm::vec3 maxPoint(-std::numeric_limits<float>::max());
-
-    for(const auto &point : worldPoints)
-    {
-        minPoint = glm::min(minPoint, point);
-        maxPoint = glm::max(maxPoint, point);
-    }
-
-    AxisAlignedBoundingBox bb(minPoint, maxPoint);
-    return bb;
+    return m_bounds;
 }
 
 //----------------------------------------------------------------------------------
@@ -126,6 +117,16 @@ void Box::createSides()
 
     auto worldPoints = this->getWorldPoints();
 
+    // The bounds are queried on every hit, so they are computed once per transformation
+    glm::vec3 minPoint( std::numeric_limits<float>::max());
+    glm::vec3 maxPoint(-std::numeric_limits<float>::max());
+    for(const auto &point : worldPoints)
+    {
+        minPoint = glm::min(minPoint, point);
+        maxPoint = glm::max(maxPoint, point);
+    }
+    m_bounds = AxisAlignedBoundingBox(minPoint, maxPoint);
+
     // Bottom vertices counter-clockwise
     auto p0 = worldPoints[0];
     auto p1 = worldPoints[1];
@@ -150,9 +151,7 @@ void Box::createSides()
 bool Box::hit(const Ray &ray, HitRecord &record) const
 {
     // Check if ray hits the bounding box
-    auto bounds = this->getBounds();
-    
-    if(!bounds.intersect(ray))
+    if(!m_bounds.intersect(ray))
     {
         return false;
     }
@@ -179,6 +178,25 @@ bool Box::hit(const Ray &ray, HitRecord &record) const
     return hit;
 }
 
+//----------------------------------------------------------------------------------
+bool Box::occluded(const Ray &ray) const
+{
+    if(!m_bounds.intersect(ray))
+    {
+        return false;
+    }
+
+    for(const auto &side : m_sides)
+    {
+        if(side->occluded(ray))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 //----------------------------------------------------------------------------------
 glm::vec3 Box::randomPointOnSurface() const
 {
@@ -229,10 +247,18 @@ float Box::pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const
 }
 
 //----------------------------------------------------------------------------------
-glm::vec3 Box::random(const glm::vec3 &origin) const
+glm::vec3 Box::random(const glm::vec3 &origin, const glm::vec2 &u) const
 {
-    glm::vec3 randomPoint = this->randomPointOnSurface();
-    return randomPoint - origin;
+    if(m_sides.empty())
+    {
+        return glm::vec3(0.0f);
+    }
+
+    // Pick a side with the first dimension and reuse what remains of it on the side
+    const float sideCount = static_cast<float>(m_sides.size());
+    const int sideIndex = std::min(static_cast<int>(u.x * sideCount), static_cast<int>(m_sides.size()) - 1);
+    const glm::vec2 uSide(std::min(u.x * sideCount - sideIndex, 0.99999994f), u.y);
+    return m_sides[sideIndex]->random(origin, uSide);
 }
 
 } // namespace raytracer
\ No newline at end of file
@@ -4,6 +4,9 @@
 
 #include <glm/vec3.hpp>
 
+#include <memory>
+#include <vector>
+
 namespace raytracer
 {
 class Quad;
@@ -37,6 +40,10 @@ public:
     /// @see Hittable::hit
     bool hit(const Ray &ray, HitRecord &record) const override;
 
+    /// @brief Determines if the ray intersects any side of the box.
+    /// @see Hittable::occluded
+    bool occluded(const Ray &ray) const override;
+
     /// @brief Set the material for the box
     /// @param material the material to set
     void setMaterial(std::shared_ptr<Material> material) { m_material = material; }
@@ -93,7 +100,7 @@ public:
     float pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const override;
 
     /// @see Hittable::random
-    glm::vec3 random(const glm::vec3 &origin) const override;
+    glm::vec3 random(const glm::vec3 &origin, const glm::vec2 &u) const override;
 
 private:
     void createSides();
@@ -102,5 +109,6 @@ private:
     std::shared_ptr<Material> m_material;
 
     std::vector<std::shared_ptr<Quad>> m_sides;
+    AxisAlignedBoundingBox m_bounds;
 };
 } // namespace raytracer
\ No newline at end of file
@@ -32,7 +32,7 @@ Quad::Quad(const glm::vec3 &Q,
 }
 
 //----------------------------------------------------------------------------------
-bool Quad::hit(const Ray &ray, HitRecord &record) const
+bool Quad::intersect(const Ray &ray, float &t, float &alpha, float &beta) const
 {
     auto normal = glm::normalize(m_n);
     auto denom = glm::dot(normal, ray.direction());
@@ -44,7 +44,7 @@ bool Quad::hit(const Ray &ray, HitRecord &record) const
     }
 
     // Check if hit point is within the ray interval
-    auto t = (m_D - glm::dot(normal, ray.origin())) / denom;
+    t = (m_D - glm::dot(normal, ray.origin())) / denom;
 
     if (!ray.contains(t))
     {
@@ -59,10 +59,18 @@ bool Quad::hit(const Ray &ray, HitRecord &record) const
 
     // Check if the hit point is within the quad
     auto p = intersectionPoint - m_Q;
-    auto alpha = glm::dot(m_w, glm::cross(p, m_v));
-    auto beta = glm::dot(m_w, glm::cross(m_u, p));
+    alpha = glm::dot(m_w, glm::cross(p, m_v));
+    beta = glm::dot(m_w, glm::cross(m_u, p));
+
+    return (alpha >= 0.0f) && (alpha <= 1.0f) && (beta >= 0.0f) && (beta <= 1.0f);
+}
+
+//----------------------------------------------------------------------------------
+bool Quad::hit(const Ray &ray, HitRecord &record) const
+{
+    float t, alpha, beta;
 
-    if((alpha < 0.0f) || (alpha > 1.0f) || (beta < 0.0f) || (beta > 1.0f))
+    if(!this->intersect(ray, t, alpha, beta))
     {
         return false;
     }
@@ -71,13 +79,20 @@ bool Quad::hit(const Ray &ray, HitRecord &record) const
     record.u = alpha;
     record.v = beta;
     record.t = t;
-    record.point = intersectionPoint;
-    record.material = m_material;
-    record.setFaceNormal(ray, normal);
+    record.point = ray(t);
+    record.material = m_material.get();
+    record.setFaceNormal(ray, glm::normalize(m_n));
 
     return true;
 }
 
+//----------------------------------------------------------------------------------
+bool Quad::occluded(const Ray &ray) const
+{
+    float t, alpha, beta;
+    return this->intersect(ray, t, alpha, beta);
+}
+
 //----------------------------------------------------------------------------------
 glm::vec3 Quad::center() const
 {
@@ -89,7 +104,9 @@ glm::vec3 Quad::center() const
 //----------------------------------------------------------------------------------
 AxisAlignedBoundingBox Quad::getBounds() const
 {
-    return AxisAlignedBoundingBox(m_Q, m_Q + m_u + m_v);
+    // Bound both diagonals, the corners opposite along one need not bound the whole quad
+    return AxisAlignedBoundingBox::combine(AxisAlignedBoundingBox(m_Q, m_Q + m_u + m_v),
+                                           AxisAlignedBoundingBox(m_Q + m_u, m_Q + m_v));
 }
 
 //----------------------------------------------------------------------------------
@@ -164,14 +181,21 @@ void Quad::updateW()
 glm::vec3 Quad::randomPointOnSurface() const
 {
     // Generate two random numbers in the range [0, 1)
-    float u = static_cast<float>(RaytracingUtility::randomDouble());
-    float v = static_cast<float>(RaytracingUtility::randomDouble());
+    float u = RaytracingUtility::randomFloat();
+    float v = RaytracingUtility::randomFloat();
 
     // Compute the random point on the quad
     glm::vec3 randomPoint = m_Q + u * m_u + v * m_v;
     return randomPoint;
 }
 
+//----------------------------------------------------------------------------------
+float Quad::getNormalCone(glm::vec3 &axis) const
+{
+    axis = glm::normalize(m_n);
+    return 1.0f;
+}
+
 //----------------------------------------------------------------------------------
 float Quad::pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const
 {
@@ -193,9 +217,9 @@ float Quad::pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const
 }
 
 //----------------------------------------------------------------------------------
-glm::vec3 Quad::random(const glm::vec3 &origin) const
+glm::vec3 Quad::random(const glm::vec3 &origin, const glm::vec2 &u) const
 {
-    glm::vec3 randomPoint = this->randomPointOnSurface();
+    glm::vec3 randomPoint = m_Q + u.x * m_u + u.y * m_v;
     return randomPoint - origin;
 }
 
@@ -41,6 +41,9 @@ public:
     /// @see Hittable::hit
     bool hit(const Ray &ray, HitRecord &record) const override;
 
+    /// @see Hittable::occluded
+    bool occluded(const Ray &ray) const override;
+
     /// @brief Get the world space bounds for this quad
     /// @see Hittable::getBounds
     AxisAlignedBoundingBox getBounds() const override;
@@ -71,11 +74,15 @@ public:
     /// @see Hittable::randomPointOnSurface
     glm::vec3 randomPointOnSurface() const override;
 
+    /// @brief Get the normal of the quad, the only direction of its normal cone
+    /// @see Hittable::getNormalCone
+    float getNormalCone(glm::vec3 &axis) const override;
+
     /// @see Hittable::pdfValue
     float pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const override;
 
     /// @see Hittable::random
-    glm::vec3 random(const glm::vec3 &origin) const override;
+    glm::vec3 random(const glm::vec3 &origin, const glm::vec2 &u) const override;
 
     /// @see Hittable::getSurfaceArea
     float getSurfaceArea() const override { return glm::length(m_n); }
@@ -86,6 +93,7 @@ public:
     glm::vec3 getCorner(int index) const;
 
 private:
+    bool intersect(const Ray &ray, float &t, float &alpha, float &beta) const;
     void updateQ();
     void updateU();
     void updateV();
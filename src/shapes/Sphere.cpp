@@ -63,7 +63,7 @@ void Sphere::scale(const glm::vec3 &scale)
 }
 
 //----------------------------------------------------------------------------------
-bool Sphere::hit(const Ray &ray, HitRecord &record) const
+bool Sphere::intersect(const Ray &ray, float &t) const
 {
     auto bounds = this->getBounds();
 
@@ -105,12 +105,7 @@ bool Sphere::hit(const Ray &ray, HitRecord &record) const
 
         if(ray.contains(t0))
         {
-            record.t = t0;
-            record.point = ray(t0);
-            auto outwardNormal = glm::normalize(record.point - sphereCenter);
-            record.setFaceNormal(ray, outwardNormal);
-            record.material = m_material;
-            Sphere::getSphereUV(outwardNormal, record.u, record.v);
+            t = t0;
             return true;
         }
     }
@@ -118,12 +113,38 @@ bool Sphere::hit(const Ray &ray, HitRecord &record) const
     return false;
 }
 
+//----------------------------------------------------------------------------------
+bool Sphere::hit(const Ray &ray, HitRecord &record) const
+{
+    float t;
+
+    if(!this->intersect(ray, t))
+    {
+        return false;
+    }
+
+    record.t = t;
+    record.point = ray(t);
+    auto outwardNormal = glm::normalize(record.point - this->center());
+    record.setFaceNormal(ray, outwardNormal);
+    record.material = m_material.get();
+    Sphere::getSphereUV(outwardNormal, record.u, record.v);
+    return true;
+}
+
+//----------------------------------------------------------------------------------
+bool Sphere::occluded(const Ray &ray) const
+{
+    float t;
+    return this->intersect(ray, t);
+}
+
 //----------------------------------------------------------------------------------
 glm::vec3 Sphere::randomPointOnSurface() const
 {
     // Generate two random numbers in the range [0, 1)
-    float u = static_cast<float>(RaytracingUtility::randomDouble());
-    float v = static_cast<float>(RaytracingUtility::randomDouble());
+    float u = RaytracingUtility::randomFloat();
+    float v = RaytracingUtility::randomFloat();
 
     // Generate a random point on the surface of the sphere
     float theta = 2.0f * glm::pi<float>() * u;
@@ -154,19 +175,19 @@ float Sphere::pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) cons
 }
 
 //----------------------------------------------------------------------------------
-glm::vec3 Sphere::random(const glm::vec3 &origin) const
+glm::vec3 Sphere::random(const glm::vec3 &origin, const glm::vec2 &u) const
 {
     auto direction = m_center - origin;
     auto dist2 = glm::length2(direction);
     OrthoNormalBasis uvw(direction);
-    return uvw.transform(this->randomToSphere(m_radius, dist2));
+    return uvw.localToWorld(this->randomToSphere(m_radius, dist2, u));
 }
 
 //----------------------------------------------------------------------------------
-glm::vec3 Sphere::randomToSphere(const float radius, const float distanceSquared) const 
+glm::vec3 Sphere::randomToSphere(const float radius, const float distanceSquared, const glm::vec2 &u) const 
 {
-    float r1 = RaytracingUtility::randomDouble();
-    float r2 = RaytracingUtility::randomDouble();
+    float r1 = u.x;
+    float r2 = u.y;
     float z = 1.0f + r2 * (glm::sqrt(1.0f - radius * radius / distanceSquared) - 1.0f);
 
     float phi = 2.0f * glm::pi<float>() * r1;
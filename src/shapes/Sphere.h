@@ -41,6 +41,9 @@ public:
     /// @see Hittable::hit
     bool hit(const Ray &ray, HitRecord &record) const override;
 
+    /// @see Hittable::occluded
+    bool occluded(const Ray &ray) const override;
+
     /// @brief Get the world space bounds for this sphere
     /// @return Bounding box for the sphere using world space coordinates
     AxisAlignedBoundingBox getBounds() const override { return m_bounds; }
@@ -74,7 +77,7 @@ public:
     float pdfValue(const glm::vec3 &origin, const glm::vec3 &direction) const override;
 
     
-    glm::vec3 random(const glm::vec3 &origin) const override;
+    glm::vec3 random(const glm::vec3 &origin, const glm::vec2 &u) const override;
 
     /// @brief Get the texture coordinates of the sphere
     /// @param p the point on the sphere
@@ -94,9 +97,10 @@ public:
     float radius() const { return m_radius; }
 
 private:
+    bool intersect(const Ray &ray, float &t) const;
     void updateCenter();
     void updateBounds();
-    glm::vec3 randomToSphere(const float radius, const float distanceSquared) const; 
+    glm::vec3 randomToSphere(const float radius, const float distanceSquared, const glm::vec2 &u) const; 
 
     glm::vec3 m_center;
     float m_radius;